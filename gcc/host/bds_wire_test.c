@@ -0,0 +1,139 @@
+/** @file
+ *
+ * @brief Test of the Bulk Data Service control point encoding (peri/bds_wire.c).
+ *
+ * Every command and event is encoded and checked byte by byte against its documented wire
+ * format (opcode, then the parameters little-endian), and the same bytes are decoded back.
+ * Lengths that do not match the opcode and unknown opcodes are refused.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bds_wire.h"
+
+/**@brief Command and its bytes on the wire. */
+typedef struct
+{
+    bds_cmd_t               cmd;
+    uint8_t                 length;
+    uint8_t                 data[BDS_CMD_MAX_LEN];
+} test_cmd_vector_t;
+
+/**@brief Event and its bytes on the wire. */
+typedef struct
+{
+    bds_evt_t               evt;
+    uint8_t                 length;
+    uint8_t                 data[BDS_EVT_MAX_LEN];
+} test_evt_vector_t;
+
+static const test_cmd_vector_t m_cmds[] =
+{
+    {{BDS_OP_INSTANT,    0,          0},    1, {0x49}},
+    {{BDS_OP_TRANSFER,   0,          0},    1, {0x54}},
+    {{BDS_OP_SYNC,       0,          0},    1, {0x59}},
+    {{BDS_OP_TIME_SET,   1413936000, 0},    5, {0x45, 0x80, 0xF3, 0x46, 0x54}},
+    {{BDS_OP_RANGE,      1,          2},    9, {0x42, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00}},
+    {{BDS_OP_RANGE,      0x01020304, 0xFFFFFFFF}, 9, {0x42, 0x04, 0x03, 0x02, 0x01, 0xFF, 0xFF, 0xFF, 0xFF}},
+    {{BDS_OP_SINCE,      0x80000000, 0},    5, {0x53, 0x00, 0x00, 0x00, 0x80}},
+    {{BDS_OP_RESUME,     0x00ABCDEF, 0x7F}, 6, {0x52, 0xEF, 0xCD, 0xAB, 0x00, 0x7F}},
+    {{BDS_OP_ACK,        0xFFFFFFFE, 0},    5, {0x41, 0xFE, 0xFF, 0xFF, 0xFF}},
+    {{BDS_OP_PERIOD_SET, 3600000,    0},    5, {0x50, 0x80, 0xEE, 0x36, 0x00}},
+    {{BDS_OP_WIDTH_SET,  2,          0},    5, {0x57, 0x02, 0x00, 0x00, 0x00}},
+};
+
+static const test_evt_vector_t m_evts[] =
+{
+    {{BDS_EVT_START,     0},                1, {0x01}},
+    {{BDS_EVT_END,       0x1234},           3, {0x02, 0x34, 0x12}},
+    {{BDS_EVT_END,       0xFFFF},           3, {0x02, 0xFF, 0xFF}},
+};
+
+static uint32_t             m_failures;                                         /**< Failed checks. */
+
+/**@brief Record a check. */
+static void check(bool ok, const char *p_label, uint32_t idx)
+{
+    if (!ok)
+    {
+        printf("  FAILED: %s (#%u)\n", p_label, idx);
+        m_failures++;
+    }
+}
+
+/**@brief Commands, against their bytes on the wire. */
+static void test_cmds(void)
+{
+    uint8_t     data[BDS_CMD_MAX_LEN + 1];
+    uint8_t     length;
+    bds_cmd_t   cmd;
+    uint32_t    failures = m_failures;
+    uint32_t    i;
+
+    for (i = 0; i < sizeof(m_cmds) / sizeof(m_cmds[0]); i++)
+    {
+        memset(data, 0xA5, sizeof(data));
+        length = bds_cmd_encode(&m_cmds[i].cmd, data);
+        check(length == m_cmds[i].length && memcmp(data, m_cmds[i].data, length) == 0, "command encoded", i);
+        check(data[length] == 0xA5, "nothing written past the command", i);
+
+        check(bds_cmd_decode(m_cmds[i].data, m_cmds[i].length, &cmd)
+              && cmd.op == m_cmds[i].cmd.op && cmd.value == m_cmds[i].cmd.value && cmd.value2 == m_cmds[i].cmd.value2,
+              "command decoded", i);
+        check(!bds_cmd_decode(m_cmds[i].data, m_cmds[i].length - 1, &cmd), "truncated command refused", i);
+
+        memcpy(data, m_cmds[i].data, m_cmds[i].length);
+        check(!bds_cmd_decode(data, m_cmds[i].length + 1, &cmd), "trailing byte refused", i);
+    }
+
+    cmd.op = 'Z';
+    check(bds_cmd_encode(&cmd, data) == 0, "unknown opcode not encoded", 0);
+    data[0] = 'Z';
+    check(!bds_cmd_decode(data, 1, &cmd), "unknown opcode refused", 0);
+    check(!bds_cmd_decode(data, 0, &cmd), "empty command refused", 0);
+
+    printf("  %-19s: %u vectors, %s\n", "commands",
+           (uint32_t)(sizeof(m_cmds) / sizeof(m_cmds[0])), (m_failures != failures) ? "FAILED" : "OK");
+}
+
+/**@brief Events, against their bytes on the wire. */
+static void test_evts(void)
+{
+    uint8_t     data[BDS_EVT_MAX_LEN + 1];
+    uint8_t     length;
+    bds_evt_t   evt;
+    uint32_t    failures = m_failures;
+    uint32_t    i;
+
+    for (i = 0; i < sizeof(m_evts) / sizeof(m_evts[0]); i++)
+    {
+        memset(data, 0xA5, sizeof(data));
+        length = bds_evt_encode(&m_evts[i].evt, data);
+        check(length == m_evts[i].length && memcmp(data, m_evts[i].data, length) == 0, "event encoded", i);
+        check(data[length] == 0xA5, "nothing written past the event", i);
+
+        check(bds_evt_decode(m_evts[i].data, m_evts[i].length, &evt)
+              && evt.type == m_evts[i].evt.type && evt.packets == m_evts[i].evt.packets, "event decoded", i);
+        check(!bds_evt_decode(m_evts[i].data, m_evts[i].length - 1, &evt), "truncated event refused", i);
+
+        memcpy(data, m_evts[i].data, m_evts[i].length);
+        check(!bds_evt_decode(data, m_evts[i].length + 1, &evt), "trailing byte refused", i);
+    }
+
+    data[0] = 0x03;
+    check(!bds_evt_decode(data, 1, &evt), "unknown event refused", 0);
+
+    printf("  %-19s: %u vectors, %s\n", "events",
+           (uint32_t)(sizeof(m_evts) / sizeof(m_evts[0])), (m_failures != failures) ? "FAILED" : "OK");
+}
+
+int main(void)
+{
+    printf("Bulk Data Service control point\n");
+
+    test_cmds();
+    test_evts();
+
+    return m_failures ? 1 : 0;
+}
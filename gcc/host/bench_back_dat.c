@@ -0,0 +1,287 @@
+/** @file
+ *
+ * @brief Throughput benchmark of the background recording engine on the simulated flash.
+ *
+ * The store is filled sample by sample through data_report_timeout_handler(), exactly as the
+ * data report timer drives it on target, with the scheduler run after every timer event.
+ * A reset is simulated on an empty, a half-full and a full store (wrapped around once in
+ * ring buffer mode) to time the boot scan in back_data_init(), and to size the NUS transfer
+ * of the whole store. All times are simulated nRF51 CPU time, see pstorage_sim.h.
+ *
+ * Usage: bench_back_dat [-c channels] [-w width] [-f image] [-s seed] [-t trace] [-k] [-v]
+ *   -c mask    DS1621 channels on the bus (bit # is the channel #, 0x01 by default).
+ *   -w width   Data width in bytes, BD_WIDTH_HALF (0.5 degC) or BD_WIDTH_FINE (1/32 degC).
+ *   -f image   Back the flash with a file (kept between runs).
+ *   -s seed    Seed of the synthetic temperature trace.
+ *   -t trace   Replay a recorded temperature trace (one reading in degC per line).
+ *   -k         Keep the content of an existing image instead of erasing it first.
+ *   -v         Echo the firmware's UART log on stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nordic_common.h"
+#include "pstorage.h"
+#include "app_scheduler.h"
+#include "app_util.h"
+#include "ble_nus.h"
+
+#include "back_dat.h"
+#include "uart.h"
+#include "bluetooth.h"
+
+#include "pstorage_sim.h"
+#include "sim_board.h"
+
+#if BD_RING_BUFFER
+#define BENCH_FILL_BLOCKS       (2 * BD_BLOCK_COUNT)                            /**< The ring buffer never fills up: wrap around once. */
+#define BENCH_FILL_LABEL        "wrap"
+#else
+#define BENCH_FILL_BLOCKS       0                                               /**< Record until the store is full. */
+#define BENCH_FILL_LABEL        "full"
+#endif
+
+#define BENCH_TX_BUFFERS        7                                               /**< SoftDevice application packet buffers (S110). */
+#define BENCH_TX_PER_EVENT      6                                               /**< Packets sent per connection event. */
+#define BENCH_SAMPLE_PERIOD     2                                               /**< Seconds per sample: two data report timer events of 1 s. */
+
+static FILE *               m_report;                                           /**< Real stdout (stdout itself is the simulated UART). */
+static uint32_t             m_width = BD_DATA_WIDTH;                            /**< Data width, applied at each boot as the saved setting. */
+
+/**@brief Simulate a reset followed by pstorage_init() (which erases the swap page). */
+static void boot_pstorage(void)
+{
+    uint32_t err_code;
+
+    sim_reboot();
+
+    err_code = pstorage_init();
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Simulate the storage part of main() after pstorage_init(). */
+static void boot_back_data(void)
+{
+    uint32_t err_code;
+
+    back_data_init();
+    err_code = back_data_width_set(m_width);
+    APP_ERROR_CHECK(err_code);
+    set_sys_state(SYS_DATA_RECORDING);
+}
+
+/**@brief Record one sample: a data report timer event (conversion start) and a conversion timer event (read). */
+static void record_sample(void)
+{
+    data_report_timeout_handler(NULL);
+    app_sched_execute();
+    data_conversion_timeout_handler(NULL);
+    app_sched_execute();
+    sim_clock_advance(BENCH_SAMPLE_PERIOD);
+}
+
+/**@brief Print the boot scan cost (back_data_init() and on, not the swap page erase of pstorage_init()). */
+static void report_boot(const char *p_label)
+{
+    boot_pstorage();
+    sim_stats_reset();
+    boot_back_data();
+
+    fprintf(m_report, "  init scan, %-5s : %6u loads, %9.3f ms (flash read %.3f ms, uart %.3f ms)\n",
+            p_label, sim_stats.load_ops,
+            sim_time_ns() / 1e6, sim_stats.load_ns / 1e6, sim_stats.uart_ns / 1e6);
+}
+
+/**@brief Print the size of a NUS transfer of the whole store ('T' command).
+ *
+ * @details The link is modelled as connection events sending up to BENCH_TX_PER_EVENT packets
+ *          from a SoftDevice queue of BENCH_TX_BUFFERS packets. The queue is refilled from each
+ *          TX complete event, as ble_data_transfer() does, and the scheduler runs between
+ *          connection events. Frames fetched from the TX complete event (stalls) delay the refill.
+ */
+static void report_transfer(const char *p_label)
+{
+    uint8_t     packet[BLE_NUS_MAX_DATA_LEN];
+    uint8_t     length  = 1;
+    uint32_t    packets = 0;
+    uint32_t    bytes   = 0;
+    uint32_t    queued  = 0;
+    uint32_t    events  = 0;
+    uint32_t    loads   = sim_stats.load_ops;
+
+    set_sys_state(SYS_BLE_DATA_TRANSFER);
+    back_data_transfer_ble_init();
+
+    while (length != 0 || queued != 0)
+    {
+        // TX complete event: refill the queue.
+        while (length != 0 && queued < BENCH_TX_BUFFERS)
+        {
+            back_data_ble_nus_fill(packet, &length);
+            if (length == 0) break;
+
+            queued ++;
+            packets ++;
+            bytes += length;
+        }
+
+        // Main loop, then the next connection event.
+        app_sched_execute();
+
+        if (queued == 0) break;
+
+        queued -= MIN(queued, BENCH_TX_PER_EVENT);
+        events ++;
+    }
+
+    set_sys_state(SYS_DATA_RECORDING);
+
+    fprintf(m_report, "  nus transfer %-5s: %6u packets, %7u B (%5.1f%% of the store)\n",
+            p_label, packets, bytes, bytes * 100.0 / (BD_BLOCK_COUNT * BD_BLOCK_SIZE));
+    if (events)
+    {
+        fprintf(m_report, "  %-18s: %.2f packets/event, %u stalls, %u pstorage loads\n",
+                "", (double) packets / events, back_data_ble_stall_count_get(), sim_stats.load_ops - loads);
+        fprintf(m_report, "  %-18s: %.1f s at a %.1f ms transfer interval, %.1f s at a %.1f ms idle interval\n",
+                "", events * TRANSFER_MAX_CONN_INTERVAL * 1.25e-3, TRANSFER_MAX_CONN_INTERVAL * 1.25,
+                events * MIN_CONN_INTERVAL * 1.25e-3, MIN_CONN_INTERVAL * 1.25);
+    }
+}
+
+/**@brief Record samples until the store is full (or n more blocks are preserved when n != 0).
+ *
+ * @retval Number of samples recorded.
+ */
+static uint32_t record(uint32_t n)
+{
+    uint32_t count = 0;
+    uint32_t first = sim_stats.store_ops + sim_stats.update_ops;
+
+    while ((n == 0 || sim_stats.store_ops + sim_stats.update_ops - first < n) && !is_data_full())
+    {
+        record_sample();
+        count ++;
+    }
+
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *    p_image = NULL;
+    const char *    p_trace = NULL;
+    uint32_t        seed    = 1;
+    uint8_t         channels = 0x01;
+    bool            keep    = false;
+    bool            verbose = false;
+    uint32_t        samples;
+    uint32_t        points;
+    sim_stats_t     rec;
+    uint64_t        rec_ns;
+    uart_tx_stats_t uart_stats;
+    int             opt;
+
+    while ((opt = getopt(argc, argv, "c:w:f:s:t:kv")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': channels = strtoul(optarg, NULL, 0);      break;
+            case 'w': m_width = strtoul(optarg, NULL, 0);       break;
+            case 'f': p_image = optarg;                         break;
+            case 's': seed    = strtoul(optarg, NULL, 0);       break;
+            case 't': p_trace = optarg;                         break;
+            case 'k': keep    = true;                           break;
+            case 'v': verbose = true;                           break;
+            default:
+                fprintf(stderr, "Usage: %s [-c channels] [-w width] [-f image] [-s seed] [-t trace] [-k] [-v]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (m_width != BD_WIDTH_HALF && m_width != BD_WIDTH_FINE)
+    {
+        fprintf(stderr, "Data width must be %u or %u\n", BD_WIDTH_HALF, BD_WIDTH_FINE);
+        return EXIT_FAILURE;
+    }
+
+    m_report = fdopen(dup(STDOUT_FILENO), "w");
+    sim_uart_attach(verbose);
+    if (p_trace != NULL && !sim_sensor_trace(p_trace))
+    {
+        fprintf(stderr, "Cannot load trace %s\n", p_trace);
+        return EXIT_FAILURE;
+    }
+    sim_sensor_seed(seed);
+    sim_sensor_channels_set(channels);
+
+    sim_flash_open(p_image, BD_BLOCK_COUNT * BD_BLOCK_SIZE);
+    if (!keep) sim_flash_erase_all();
+
+    fprintf(m_report, "store %u KB: %u blocks x %u B, data format %u, channels 0x%02X, data width %u B\n",
+            BD_BLOCK_COUNT * BD_BLOCK_SIZE / 1024, BD_BLOCK_COUNT, BD_BLOCK_SIZE, BD_DATA_FORMAT, channels, m_width);
+
+    report_boot("empty");
+    report_transfer("empty");
+
+    // Fill the first half, reboot, then fill the rest.
+    sim_stats_reset();
+    samples = record(BD_BLOCK_COUNT / 2);
+    rec = sim_stats;
+    rec_ns = sim_time_ns();
+
+    report_boot("half");
+    report_transfer("half");
+
+    sim_stats_reset();
+    samples += record(BENCH_FILL_BLOCKS);
+    wait_flash_op();
+    rec.store_ops     += sim_stats.store_ops;
+    rec.update_ops    += sim_stats.update_ops;
+    rec.words_written += sim_stats.words_written;
+    rec.dirty_writes  += sim_stats.dirty_writes;
+    rec.pages_erased  += sim_stats.pages_erased;
+    rec.flash_ns      += sim_stats.flash_ns;
+    rec.uart_ns       += sim_stats.uart_ns;
+    rec_ns            += sim_time_ns();
+
+    report_boot(BENCH_FILL_LABEL);
+    report_transfer(BENCH_FILL_LABEL);
+
+    // Reclaim the whole store.
+    sim_stats_reset();
+    back_data_clear_storage();
+    wait_flash_op();
+    fprintf(m_report, "  clear storage     : %u page erases, %.3f ms\n",
+            sim_stats.pages_erased, sim_time_ns() / 1e6);
+
+    fprintf(m_report, "  recording         : %u samples, %u store + %u update ops, %.1f samples/block\n",
+            samples, rec.store_ops, rec.update_ops, (double) samples / (rec.store_ops + rec.update_ops));
+    points = samples * __builtin_popcount(channels);
+    fprintf(m_report, "  compression ratio : %.2f (%u B of data points in %u B of data segments)\n",
+            (double) points * m_width / ((rec.store_ops + rec.update_ops) * BD_DATA_END_ADDR),
+            points * m_width, (uint32_t)((rec.store_ops + rec.update_ops) * BD_DATA_END_ADDR));
+    fprintf(m_report, "  storage cost      : %.2f bits/point, %.2f B/sample with the block config, %.1f h of record\n",
+            (rec.store_ops + rec.update_ops) * BD_DATA_END_ADDR * 8.0 / points,
+            (double)(rec.store_ops + rec.update_ops) * BD_BLOCK_SIZE / samples,
+            (double) samples * BENCH_SAMPLE_PERIOD / 3600);
+    fprintf(m_report, "  flash per sample  : %.3f word writes, %.4f page erases, %.3f ms busy\n",
+            (double) rec.words_written / samples, (double) rec.pages_erased / samples,
+            rec.flash_ns / 1e6 / samples);
+    fprintf(m_report, "  sustained rate    : %.1f samples/s (flash only), %.1f samples/s (with UART log)\n",
+            samples * 1e9 / rec.flash_ns, samples * 1e9 / rec_ns);
+    uart_tx_stats_get(&uart_stats);
+    fprintf(m_report, "  uart log          : %u B buffer, %u B max queued, %u characters dropped in %u overflow(s)\n",
+            UART_TX_BUFFER_SIZE, uart_stats.max_used, uart_stats.dropped, uart_stats.overflows);
+    if (rec.dirty_writes)
+    {
+        fprintf(m_report, "  WARNING           : %u words programmed over non-erased flash\n", rec.dirty_writes);
+    }
+
+    sim_flash_close();
+    fclose(m_report);
+
+    return rec.dirty_writes ? EXIT_FAILURE : EXIT_SUCCESS;
+}
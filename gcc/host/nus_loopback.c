@@ -0,0 +1,428 @@
+/** @file
+ *
+ * @brief Loopback test of the NUS block transfer over a lossy link.
+ *
+ * The store is filled through data_report_timeout_handler() as in the benchmark, then sent
+ * through back_data_ble_nus_fill() to the reference receiver (nus_receiver.c), dropping packets
+ * at random. The receiver asks again for the blocks it did not get ('B' command) until it has
+ * all of them, and an interrupted transfer is continued from where the link dropped ('R'
+ * command). The frames received are compared with a lossless transfer of the same store.
+ * A last transfer runs while recording goes on, and must send the store as it was when it started.
+ * The battery voltage in the header of the frames must follow the (simulated) discharge.
+ * The store is filled across a reset, after the clock is set: the time of the blocks must
+ * never go back, back_data_seq_find() must find each block from its time ('S' command), and
+ * only the blocks started while the clock was set must be on the host clock.
+ * Commands and the end of transfer event go through the control point codec of the Bulk Data
+ * Service (bds_wire.c), whose encoding is checked by bds_wire_test.c.
+ *
+ * Usage: nus_loopback [-l loss] [-s seed] [-c cut]
+ *   -l loss    Packet loss rate, in percent (default 5).
+ *   -s seed    Seed of the link and of the synthetic temperature trace.
+ *   -c cut     Drop the link after this number of packets in the resume test (default 1000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pstorage.h"
+#include "app_scheduler.h"
+#include "app_util.h"
+#include "ble_nus.h"
+
+#include "back_dat.h"
+#include "bds_wire.h"
+#include "timers.h"
+
+#include "pstorage_sim.h"
+#include "sim_board.h"
+#include "nus_receiver.h"
+
+#ifndef LOOPBACK_FILL_BLOCKS
+#define LOOPBACK_FILL_BLOCKS    (BD_BLOCK_COUNT / 2)                            /**< Blocks recorded before the transfers. */
+#endif
+#define LOOPBACK_FRAME_COUNT    (BD_BLOCK_COUNT + 1)                            /**< Preserved blocks and the block being recorded. */
+#define LOOPBACK_MAX_ROUNDS     1000                                            /**< Retransmission rounds before giving up. */
+#define LOOPBACK_EPOCH          1413936000                                      /**< Time set by the central ('E' command) while filling the store. */
+
+static FILE *               m_report;                                           /**< Real stdout (stdout itself is the simulated UART). */
+static uint8_t              m_reference[LOOPBACK_FRAME_COUNT][BD_FRAME_MAX_SIZE];   /**< Frames of a lossless transfer, by sequence # modulo LOOPBACK_FRAME_COUNT. */
+static uint8_t              m_frames[LOOPBACK_FRAME_COUNT][BD_FRAME_MAX_SIZE];      /**< Frames received, by sequence # modulo LOOPBACK_FRAME_COUNT. */
+static uint8_t              m_received[(LOOPBACK_FRAME_COUNT + 7) / 8];             /**< Bitmap of the blocks received, bit (seq - m_first_seq). */
+static uint8_t              (*m_p_frames)[BD_FRAME_MAX_SIZE];                   /**< Frame store in use. */
+static uint32_t             m_first_seq;                                        /**< Sequence # of the oldest block. */
+static uint32_t             m_end_seq;                                          /**< Sequence # after the newest block. */
+static uint32_t             m_loss;                                             /**< Packet loss rate (in percent). */
+static uint32_t             m_samples_per_packet;                               /**< Samples recorded while each packet is sent. */
+static uint32_t             m_clock_seq;                                        /**< Sequence # of the first block started after the clock was set. */
+static uint32_t             m_reset_seq;                                        /**< Sequence # of the first block started after the reset. */
+static uint32_t             m_evt_errors;                                       /**< End of transfer events not matching the packets sent. */
+
+/**@brief Simulate a reset followed by the storage part of main(). */
+static void boot(void)
+{
+    uint32_t err_code;
+
+    sim_reboot();
+
+    err_code = pstorage_init();
+    APP_ERROR_CHECK(err_code);
+
+    back_data_init();
+    timers_init();
+    set_sys_state(SYS_DATA_RECORDING);
+}
+
+/**@brief Record one sample: a data report timer event (conversion start) and a conversion timer event (read). */
+static void record_sample(void)
+{
+    data_report_timeout_handler(NULL);
+    app_sched_execute();
+    data_conversion_timeout_handler(NULL);
+    app_sched_execute();
+    sim_clock_advance(2);
+}
+
+/**@brief Record samples until n more blocks are preserved. */
+static void record(uint32_t n)
+{
+    uint32_t first = sim_stats.store_ops + sim_stats.update_ops;
+
+    while (sim_stats.store_ops + sim_stats.update_ops - first < n && !is_data_full())
+    {
+        record_sample();
+    }
+}
+
+/**@brief Frame handler: keep the frame and mark its block as received. */
+static void frame_handler(const uint8_t *p_frame, uint32_t length)
+{
+    uint32_t seq = uint32_decode(&p_frame[BD_CONFIG_SEQ_OFFSET]);
+
+    if (seq < m_first_seq || seq >= m_end_seq)
+    {
+        fprintf(m_report, "  unexpected block SEQ %u\n", seq);
+        return;
+    }
+
+    memset(m_p_frames[seq % LOOPBACK_FRAME_COUNT], 0xFF, BD_FRAME_MAX_SIZE);
+    memcpy(m_p_frames[seq % LOOPBACK_FRAME_COUNT], p_frame, length);
+    m_received[(seq - m_first_seq) / 8] |= 1 << ((seq - m_first_seq) % 8);
+}
+
+/**@brief Check the battery voltage of the lossless frames: measured for each block, never rising.
+ *
+ * @retval TRUE  The voltages are valid.
+ */
+static bool battery_check(void)
+{
+    uint32_t seq;
+    uint16_t first = uint16_decode(&m_reference[m_first_seq % LOOPBACK_FRAME_COUNT][BD_CONFIG_BATTERY_OFFSET]);
+    uint16_t last  = first;
+    uint16_t mv;
+    bool     ok    = true;
+
+    for (seq = m_first_seq; seq < m_end_seq; seq++)
+    {
+        mv  = uint16_decode(&m_reference[seq % LOOPBACK_FRAME_COUNT][BD_CONFIG_BATTERY_OFFSET]);
+        ok &= (mv != 0xFFFF) && (mv <= last);
+        last = mv;
+    }
+
+    fprintf(m_report, "  %-19s: %u to %u mV, %s\n", "battery voltage", first, last, ok ? "OK" : "MISMATCH");
+
+    return ok;
+}
+
+/**@brief Check the time of the lossless frames: never going back, also across the reset, so that
+ *        back_data_seq_find() finds each preserved block from its time. BD_FORMAT_TIME_BOOT is
+ *        set unless the clock was set when the block started.
+ *
+ * @retval TRUE  The times are valid.
+ */
+static bool time_check(void)
+{
+    uint32_t seq;
+    uint32_t first = uint32_decode(&m_reference[m_first_seq % LOOPBACK_FRAME_COUNT][BD_CONFIG_TIME_OFFSET]);
+    uint32_t last  = first;
+    uint32_t time;
+    uint32_t boot  = 0;
+    bool     flag;
+    bool     ok    = true;
+
+    for (seq = m_first_seq; seq < m_end_seq; seq++)
+    {
+        time = uint32_decode(&m_reference[seq % LOOPBACK_FRAME_COUNT][BD_CONFIG_TIME_OFFSET]);
+        flag = (m_reference[seq % LOOPBACK_FRAME_COUNT][BD_CONFIG_FORMAT_OFFSET] & BD_FORMAT_TIME_BOOT) != 0;
+        ok &= (seq == m_first_seq) || (time > last);
+        ok &= (seq + 1 == m_end_seq) || (back_data_seq_find(time) == seq);     //< The block being recorded is not preserved yet
+        ok &= flag == (seq < m_clock_seq || seq >= m_reset_seq);
+        boot += flag;
+        last = time;
+    }
+
+    fprintf(m_report, "  %-19s: %u to %u s, %u block(s) off the host clock, %s\n",
+            "block time", first, last, boot, ok ? "OK" : "MISMATCH");
+
+    return ok;
+}
+
+/**@brief Write a command to the control point, and start the transfer it selects as
+ *        command_handler() (bluetooth.c) does.
+ *
+ * @param[in] op        Opcode (BDS_OP_TRANSFER, BDS_OP_RANGE or BDS_OP_RESUME).
+ * @param[in] value     First parameter.
+ * @param[in] value2    Second parameter.
+ */
+static void command(uint8_t op, uint32_t value, uint32_t value2)
+{
+    bds_cmd_t   cmd = {op, value, value2};
+    uint8_t     data[BDS_CMD_MAX_LEN];
+    uint8_t     length;
+
+    length = bds_cmd_encode(&cmd, data);
+    if (!bds_cmd_decode(data, length, &cmd))
+    {
+        fprintf(m_report, "  command '%c' not decoded\n", op);
+        return;
+    }
+
+    switch (cmd.op)
+    {
+        case BDS_OP_TRANSFER:
+            back_data_transfer_ble_init();
+            break;
+        case BDS_OP_RANGE:
+            back_data_transfer_ble_range_init(cmd.value, cmd.value2);
+            break;
+        case BDS_OP_RESUME:
+            back_data_transfer_ble_resume_init(cmd.value, cmd.value2);
+            break;
+    }
+}
+
+/**@brief Run the transfer selected by a back_data_transfer_ble_*_init() call over the lossy link.
+ *
+ * @param[in] p_rx      Receiver.
+ * @param[in] cut       Drop the link after this number of packets, 0 to send all of them.
+ *
+ * @retval Number of packets sent.
+ */
+static uint32_t link_run(nus_receiver_t *p_rx, uint32_t cut)
+{
+    uint8_t     packet[BLE_NUS_MAX_DATA_LEN];
+    uint8_t     length;
+    uint32_t    sent = 0;
+
+    for (;;)
+    {
+        if (cut != 0 && sent == cut) break;
+
+        back_data_ble_nus_fill(packet, &length);
+        if (length == 0) break;
+        sent ++;
+
+        for (uint32_t i = 0; i < m_samples_per_packet; i++) record_sample();
+
+        if ((uint32_t)(rand() % 100) < m_loss) continue;
+        nus_receiver_packet(p_rx, packet, length);
+    }
+
+    if (cut == 0)                                                   //< End of transfer event, never lost
+    {
+        bds_evt_t   evt = {BDS_EVT_END, back_data_ble_packet_count_get()};
+        uint8_t     data[BDS_EVT_MAX_LEN];
+
+        length = bds_evt_encode(&evt, data);
+        if (!bds_evt_decode(data, length, &evt) || evt.packets != (uint16_t) sent)
+        {
+            m_evt_errors ++;
+        }
+    }
+
+    return sent;
+}
+
+/**@brief Ask for the missing blocks until all of them are received.
+ *
+ * @details Each round requests every range of blocks missing at its start.
+ *
+ * @param[out] p_rounds Number of rounds.
+ *
+ * @retval Number of packets sent.
+ */
+static uint32_t link_recover(uint32_t *p_rounds)
+{
+    nus_receiver_t  rx;
+    uint8_t         missing[sizeof(m_received)];
+    uint32_t        first;
+    uint32_t        last;
+    uint32_t        sent = 0;
+
+    *p_rounds = 0;
+    while (nus_receiver_missing_get(m_received, m_first_seq, m_end_seq, &first, &last)
+           && *p_rounds < LOOPBACK_MAX_ROUNDS)
+    {
+        (*p_rounds) ++;
+        memcpy(missing, m_received, sizeof(missing));
+
+        while (nus_receiver_missing_get(missing, m_first_seq, m_end_seq, &first, &last))
+        {
+            nus_receiver_init(&rx, frame_handler);
+            command(BDS_OP_RANGE, first, last);
+            sent += link_run(&rx, 0);
+
+            for (; first <= last; first++)
+            {
+                missing[(first - m_first_seq) / 8] |= 1 << ((first - m_first_seq) % 8);
+            }
+        }
+    }
+
+    return sent;
+}
+
+/**@brief Compare the frames received with the lossless transfer.
+ *
+ * @retval TRUE  All blocks were received and match.
+ */
+static bool check(const char *p_label, uint32_t packets, uint32_t rounds)
+{
+    uint32_t first;
+    uint32_t last;
+    bool     ok = !nus_receiver_missing_get(m_received, m_first_seq, m_end_seq, &first, &last)
+                  && memcmp(m_frames, m_reference, sizeof(m_frames)) == 0;
+
+    fprintf(m_report, "  %-19s: %6u packets, %3u retransmission round(s), %s\n",
+            p_label, packets, rounds, ok ? "OK" : "MISMATCH");
+
+    return ok;
+}
+
+/**@brief Reset the frames received. */
+static void frames_reset(uint8_t (*p_frames)[BD_FRAME_MAX_SIZE])
+{
+    m_p_frames = p_frames;
+    memset(p_frames, 0xFF, sizeof(m_frames));
+    memset(m_received, 0, sizeof(m_received));
+}
+
+int main(int argc, char *argv[])
+{
+    nus_receiver_t  rx;
+    uint32_t        seed    = 1;
+    uint32_t        cut     = 1000;
+    uint32_t        packets;
+    uint32_t        rounds;
+    uint32_t        seq;
+    uint32_t        offset;
+    bool            ok      = true;
+    int             opt;
+
+    m_loss = 5;
+
+    while ((opt = getopt(argc, argv, "l:s:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': m_loss = strtoul(optarg, NULL, 0);        break;
+            case 's': seed   = strtoul(optarg, NULL, 0);        break;
+            case 'c': cut    = strtoul(optarg, NULL, 0);        break;
+            default:
+                fprintf(stderr, "Usage: %s [-l loss] [-s seed] [-c cut]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    m_report = fdopen(dup(STDOUT_FILENO), "w");
+    sim_uart_attach(false);
+    sim_sensor_seed(seed);
+    srand(seed);
+
+    sim_flash_open(NULL, BD_BLOCK_COUNT * BD_BLOCK_SIZE);
+    sim_flash_erase_all();
+
+    fprintf(m_report, "store %u KB: %u blocks, %u%% packet loss\n",
+            BD_BLOCK_COUNT * BD_BLOCK_SIZE / 1024, BD_BLOCK_COUNT, m_loss);
+
+    boot();
+    record(LOOPBACK_FILL_BLOCKS / 2);
+    timers_time_set(LOOPBACK_EPOCH);
+    m_clock_seq = back_data_next_seq_get() + 1;                     //< The block being recorded started before
+    record(LOOPBACK_FILL_BLOCKS / 4);
+    boot();                                                         //< The clock restarts from the newest block
+    m_reset_seq = back_data_next_seq_get();
+    record(LOOPBACK_FILL_BLOCKS - LOOPBACK_FILL_BLOCKS / 2 - LOOPBACK_FILL_BLOCKS / 4);
+    record_sample();                                                //< The block being recorded is sent last
+    set_sys_state(SYS_BLE_DATA_TRANSFER);
+
+    m_end_seq   = back_data_next_seq_get() + 1;
+    m_first_seq = (m_end_seq > BD_BLOCK_COUNT + 1) ? m_end_seq - 1 - BD_BLOCK_COUNT : 0;
+
+    // Lossless reference.
+    frames_reset(m_reference);
+    nus_receiver_init(&rx, frame_handler);
+    command(BDS_OP_TRANSFER, 0, 0);
+    {
+        uint32_t saved = m_loss;
+
+        m_loss = 0;
+        packets = link_run(&rx, 0);
+        m_loss = saved;
+    }
+    if (nus_receiver_missing_get(m_received, m_first_seq, m_end_seq, &seq, &offset) && seq == m_first_seq)
+    {
+        m_first_seq = offset + 1;                                   //< In ring buffer mode the oldest page is erased ahead of the cursor
+    }
+    ok &= (rx.frames == m_end_seq - m_first_seq) && rx.crc_errors == 0;
+    fprintf(m_report, "  %-19s: %6u packets, %u frames (SEQ %u to %u), %u CRC errors\n",
+            "lossless", packets, rx.frames, m_first_seq, m_end_seq - 1, rx.crc_errors);
+    ok &= battery_check();
+    ok &= time_check();
+
+    // Lossy transfer, lost blocks are requested again.
+    frames_reset(m_frames);
+    nus_receiver_init(&rx, frame_handler);
+    command(BDS_OP_TRANSFER, 0, 0);
+    packets = link_run(&rx, 0);
+    fprintf(m_report, "  %-19s: %6u packets, %u lost, %u frames\n",
+            "lossy", packets, rx.packets_lost, rx.frames);
+    packets += link_recover(&rounds);
+    ok &= check("lossy + retransmit", packets, rounds);
+
+    // Link dropped in the middle of a frame, the transfer resumes from the last byte received.
+    frames_reset(m_frames);
+    nus_receiver_init(&rx, frame_handler);
+    command(BDS_OP_TRANSFER, 0, 0);
+    packets = link_run(&rx, cut);
+    if (!nus_receiver_resume_get(&rx, &seq, &offset))
+    {
+        nus_receiver_missing_get(m_received, m_first_seq, m_end_seq, &seq, &offset);
+        offset = 0;                                                 //< From the first block not received
+    }
+    nus_receiver_restart(&rx);
+    command(BDS_OP_RESUME, seq, offset);
+    packets += link_run(&rx, 0);
+    packets += link_recover(&rounds);
+    ok &= check("resume + retransmit", packets, rounds);
+
+    // Recording goes on during the transfer, several blocks are preserved meanwhile.
+    frames_reset(m_frames);
+    nus_receiver_init(&rx, frame_handler);
+    command(BDS_OP_TRANSFER, 0, 0);
+    m_loss = 0;
+    m_samples_per_packet = 2;
+    packets = link_run(&rx, 0);
+    m_samples_per_packet = 0;
+    ok &= check("while recording", packets, 0);
+    fprintf(m_report, "  %-19s: SEQ %u to %u recorded meanwhile\n", "", m_end_seq, back_data_next_seq_get());
+
+    ok &= m_evt_errors == 0;
+    fprintf(m_report, "  %-19s: %u mismatch(es)\n", "end of transfer evt", m_evt_errors);
+
+    sim_flash_close();
+    fclose(m_report);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,110 @@
+/** @file
+ *
+ * @brief Reference central side of the NUS block transfer.
+ */
+
+#include <string.h>
+
+#include "app_util.h"
+#include "crc16.h"
+
+#include "nus_receiver.h"
+
+/**@brief Length of the frame being reassembled, 0 while its header is incomplete. */
+static uint32_t frame_length(const nus_receiver_t *p_rx)
+{
+    if (p_rx->frame_idx < BD_CONFIG_NUM_PER_BLOCK) return 0;
+
+    return BD_CONFIG_NUM_PER_BLOCK + p_rx->frame[BD_CONFIG1_OFFSET] + BD_FRAME_CRC_SIZE;
+}
+
+void nus_receiver_init(nus_receiver_t *p_rx, nus_receiver_frame_handler_t frame_handler)
+{
+    memset(p_rx, 0, sizeof(*p_rx));
+    p_rx->frame_handler = frame_handler;
+}
+
+void nus_receiver_restart(nus_receiver_t *p_rx)
+{
+    p_rx->packet_seq = 0;
+}
+
+void nus_receiver_packet(nus_receiver_t *p_rx, const uint8_t *p_data, uint32_t length)
+{
+    uint16_t    packet_seq;
+    uint32_t    offset;
+    uint32_t    size;
+    uint32_t    len;
+
+    if (length < BD_PACKET_HEADER_SIZE) return;     //< Not a data packet ("**START**", "**END**" are longer)
+
+    packet_seq = uint16_decode(&p_data[BD_PACKET_SEQ_OFFSET]);
+    offset     = p_data[BD_PACKET_FRAME_OFFSET];
+    size       = length - BD_PACKET_HEADER_SIZE;
+
+    p_rx->packets ++;
+    p_rx->packets_lost += (uint16_t)(packet_seq - p_rx->packet_seq);
+    p_rx->packet_seq = packet_seq + 1;
+
+    if (offset == 0)                                //< A new frame starts
+    {
+        p_rx->frame_idx = 0;
+        p_rx->frame_valid = true;
+    }
+    else if (!p_rx->frame_valid || offset != p_rx->frame_idx)
+    {
+        p_rx->frame_valid = false;                  //< Part of the frame is lost, wait for the next one
+        return;
+    }
+
+    if (p_rx->frame_idx + size > BD_FRAME_MAX_SIZE)
+    {
+        p_rx->frame_valid = false;
+        return;
+    }
+
+    memcpy(&p_rx->frame[p_rx->frame_idx], &p_data[BD_PACKET_HEADER_SIZE], size);
+    p_rx->frame_idx += size;
+
+    len = frame_length(p_rx);
+    if (len == 0 || p_rx->frame_idx < len) return;
+
+    p_rx->frame_valid = false;
+    len -= BD_FRAME_CRC_SIZE;
+
+    if (p_rx->frame_idx != len + BD_FRAME_CRC_SIZE
+        || crc16_compute(p_rx->frame, len, NULL) != uint16_decode(&p_rx->frame[len]))
+    {
+        p_rx->crc_errors ++;
+        return;
+    }
+
+    p_rx->frames ++;
+    p_rx->frame_handler(p_rx->frame, len);
+}
+
+bool nus_receiver_resume_get(const nus_receiver_t *p_rx, uint32_t *p_seq, uint32_t *p_offset)
+{
+    if (!p_rx->frame_valid || p_rx->frame_idx < BD_CONFIG_SEQ_OFFSET + sizeof(uint32_t)) return false;
+
+    *p_seq    = uint32_decode(&p_rx->frame[BD_CONFIG_SEQ_OFFSET]);
+    *p_offset = p_rx->frame_idx;
+
+    return true;
+}
+
+bool nus_receiver_missing_get(const uint8_t *p_received, uint32_t first_seq, uint32_t end_seq,
+                              uint32_t *p_first, uint32_t *p_last)
+{
+    uint32_t i = 0;
+    uint32_t n = end_seq - first_seq;
+
+    while (i < n && (p_received[i / 8] & (1 << (i % 8)))) i++;
+    if (i == n) return false;
+
+    *p_first = first_seq + i;
+    while (i < n && !(p_received[i / 8] & (1 << (i % 8)))) i++;
+    *p_last = first_seq + i - 1;
+
+    return true;
+}
@@ -0,0 +1,93 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_host_receiver NUS Transfer Receiver
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Reference central side of the NUS block transfer: packet reassembly, CRC16 check and
+ *        loss tracking (see BD_PACKET_* and BD_FRAME_* in back_dat.h).
+ *
+ * Packets are fed in arrival order. A frame is reported once all its packets arrived in sequence
+ * and its CRC16 matches; a frame with a missing packet is dropped. The central then asks for the
+ * blocks it did not get with 'B' (see nus_receiver_missing_get), or continues an interrupted
+ * transfer with 'R' (see nus_receiver_resume_get).
+ */
+
+#ifndef HOST_NUS_RECEIVER_H__
+#define HOST_NUS_RECEIVER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "back_dat.h"
+
+/**@brief Frame handler type: called for each frame received with a valid CRC16.
+ *
+ * @param[in] p_frame   Frame (header + data, without the CRC16).
+ * @param[in] length    Length of the frame.
+ */
+typedef void (*nus_receiver_frame_handler_t)(const uint8_t *p_frame, uint32_t length);
+
+/**@brief Receiver state. */
+typedef struct
+{
+    nus_receiver_frame_handler_t    frame_handler;              /**< Handler of the frames received. */
+    uint8_t                         frame[BD_FRAME_MAX_SIZE];   /**< Frame being reassembled. */
+    uint32_t                        frame_idx;                  /**< Bytes of the frame received in sequence. */
+    bool                            frame_valid;                /**< No packet of the frame has been lost. */
+    uint16_t                        packet_seq;                 /**< Sequence # of the next packet expected. */
+    uint32_t                        packets;                    /**< Packets received. */
+    uint32_t                        packets_lost;               /**< Packets lost (sequence # gaps). */
+    uint32_t                        frames;                     /**< Frames received with a valid CRC16. */
+    uint32_t                        crc_errors;                 /**< Frames dropped on a CRC16 mismatch. */
+} nus_receiver_t;
+
+/**@brief Initialize the receiver for a new transfer (packet sequence # restarts at 0).
+ *
+ * @param[out] p_rx             Receiver.
+ * @param[in]  frame_handler    Handler of the frames received.
+ */
+void nus_receiver_init(nus_receiver_t *p_rx, nus_receiver_frame_handler_t frame_handler);
+
+/**@brief Prepare the receiver for a transfer resumed with 'R' (packet sequence # restarts at 0).
+ *
+ * @details The part of the frame received before the link dropped is kept.
+ *
+ * @param[in] p_rx      Receiver.
+ */
+void nus_receiver_restart(nus_receiver_t *p_rx);
+
+/**@brief Process a packet received through the Nordic UART Service.
+ *
+ * @param[in] p_rx      Receiver.
+ * @param[in] p_data    Packet.
+ * @param[in] length    Length of the packet.
+ */
+void nus_receiver_packet(nus_receiver_t *p_rx, const uint8_t *p_data, uint32_t length);
+
+/**@brief Get the position an interrupted transfer should be resumed from ('R' command).
+ *
+ * @param[in]  p_rx     Receiver.
+ * @param[out] p_seq    Sequence # of the frame being reassembled.
+ * @param[out] p_offset Bytes of this frame received in sequence.
+ *
+ * @retval TRUE  A frame was being reassembled, FALSE if the transfer should resume from the
+ *               block after the last one received.
+ */
+bool nus_receiver_resume_get(const nus_receiver_t *p_rx, uint32_t *p_seq, uint32_t *p_offset);
+
+/**@brief Find the first range of blocks missing from a bitmap of received blocks.
+ *
+ * @param[in]  p_received   Bitmap of the blocks received, bit (seq - first_seq).
+ * @param[in]  first_seq    Sequence # of the first block expected.
+ * @param[in]  end_seq      Sequence # after the last block expected.
+ * @param[out] p_first      Sequence # of the first missing block.
+ * @param[out] p_last       Sequence # of the last missing block of the range.
+ *
+ * @retval TRUE  A range is missing ('B' command).
+ */
+bool nus_receiver_missing_get(const uint8_t *p_received, uint32_t first_seq, uint32_t end_seq,
+                              uint32_t *p_first, uint32_t *p_last);
+
+#endif
+
+/** @} */
@@ -0,0 +1,436 @@
+/** @file
+ *
+ * @brief Simulated nRF51 flash and pstorage backend for host builds.
+ *
+ * The region handed out to modules starts at the beginning of the mapping; the swap page sits
+ * right after it. The mapping is placed in the low 4 GB so that a flash address fits
+ * pstorage_block_t and can be dereferenced directly, as on target.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pstorage.h"
+#include "nordic_common.h"
+#include "nrf_error.h"
+#include "pstorage_sim.h"
+
+#define SIM_FLASH_WORD_SIZE     4                                               /**< Flash programming unit (in bytes). */
+#define SIM_FLASH_MAP_HINT      0x10000000UL                                    /**< Preferred mapping address when MAP_32BIT is unavailable. */
+
+/**@brief Registered module. */
+typedef struct
+{
+    pstorage_ntf_cb_t   cb;
+    uint32_t            base_addr;
+    pstorage_size_t     block_size;
+    pstorage_size_t     block_count;
+} sim_module_t;
+
+/**@brief Queued flash command. */
+typedef struct
+{
+    uint8_t             op_code;
+    pstorage_handle_t   handle;
+    uint8_t            *p_src;
+    uint32_t            size;
+    uint32_t            offset;
+} sim_cmd_t;
+
+sim_stats_t                 sim_stats;
+
+static uint8_t             *m_flash;                                            /**< Mapped flash image. */
+static uint32_t             m_flash_size;                                       /**< Size available to modules (in bytes). */
+static uint32_t             m_map_size;                                         /**< Size of the mapping, including the swap page. */
+static int                  m_image_fd = -1;                                    /**< Backing file, or -1. */
+static bool                 m_initialized;                                      /**< pstorage_init called since the last reboot. */
+static sim_module_t         m_modules[PSTORAGE_MAX_APPLICATIONS];               /**< Registered modules. */
+static uint32_t             m_module_count;                                     /**< Number of registered modules. */
+static uint32_t             m_next_addr;                                        /**< Next free page-aligned address. */
+static sim_cmd_t            m_cmd_queue[PSTORAGE_CMD_QUEUE_SIZE];               /**< Pending commands. */
+static uint32_t             m_cmd_head;                                         /**< Index of the oldest pending command. */
+static uint32_t             m_cmd_count;                                        /**< Number of pending commands. */
+
+/*****************************************************************************
+* Flash Primitives
+*****************************************************************************/
+
+/**@brief Convert a flash address into a pointer into the mapping. */
+static uint8_t * flash_ptr(uint32_t addr)
+{
+    return (uint8_t *)(uintptr_t) addr;
+}
+
+/**@brief Address of the first byte of the mapping. */
+static uint32_t flash_base(void)
+{
+    return (uint32_t)(uintptr_t) m_flash;
+}
+
+/**@brief Erase the page containing addr. */
+static void flash_page_erase(uint32_t addr)
+{
+    uint32_t page = addr - ((addr - flash_base()) % SIM_FLASH_PAGE_SIZE);
+
+    memset(flash_ptr(page), 0xFF, SIM_FLASH_PAGE_SIZE);
+    sim_stats.pages_erased ++;
+    sim_stats.flash_ns += SIM_FLASH_PAGE_ERASE_NS;
+}
+
+/**@brief Program words. Bits can only be cleared, as on NOR flash. */
+static void flash_program(uint32_t addr, const uint8_t *p_src, uint32_t size)
+{
+    uint32_t i;
+    uint32_t word_old, word_new;
+
+    for (i = 0; i < size; i += SIM_FLASH_WORD_SIZE)
+    {
+        memcpy(&word_old, flash_ptr(addr + i), SIM_FLASH_WORD_SIZE);
+        memcpy(&word_new, p_src + i, SIM_FLASH_WORD_SIZE);
+
+        if ((word_old & word_new) != word_new) sim_stats.dirty_writes ++;
+
+        word_old &= word_new;
+        memcpy(flash_ptr(addr + i), &word_old, SIM_FLASH_WORD_SIZE);
+
+        sim_stats.words_written ++;
+        sim_stats.flash_ns += SIM_FLASH_WORD_WRITE_NS;
+    }
+}
+
+/**@brief Replace part of one page through the swap page, the way the SDK handles update:
+ *        the page is copied to swap, erased, and written back around the new data.
+ */
+static void flash_page_rewrite(uint32_t addr, const uint8_t *p_src, uint32_t size)
+{
+    uint8_t     page_copy[SIM_FLASH_PAGE_SIZE];
+    uint32_t    page     = addr - ((addr - flash_base()) % SIM_FLASH_PAGE_SIZE);
+    uint32_t    swap     = flash_base() + m_flash_size;
+
+    memcpy(page_copy, flash_ptr(page), SIM_FLASH_PAGE_SIZE);
+    memcpy(page_copy + (addr - page), p_src, size);
+
+    flash_page_erase(swap);
+    flash_program(swap, page_copy, SIM_FLASH_PAGE_SIZE);
+    flash_page_erase(page);
+    flash_program(page, page_copy, SIM_FLASH_PAGE_SIZE);
+}
+
+/*****************************************************************************
+* Command Processing
+*****************************************************************************/
+
+/**@brief Execute one queued command. */
+static void cmd_execute(sim_cmd_t *p_cmd)
+{
+    uint32_t addr = p_cmd->handle.block_id + p_cmd->offset;
+    uint32_t end;
+    uint32_t chunk;
+
+    switch (p_cmd->op_code)
+    {
+        case PSTORAGE_STORE_OP_CODE:
+            flash_program(addr, p_cmd->p_src, p_cmd->size);
+            sim_stats.store_ops ++;
+            break;
+
+        case PSTORAGE_UPDATE_OP_CODE:
+            flash_page_rewrite(addr, p_cmd->p_src, p_cmd->size);
+            sim_stats.update_ops ++;
+            break;
+
+        case PSTORAGE_CLEAR_OP_CODE:
+            // Like the SDK, erase every page the range touches, whole.
+            end = addr + p_cmd->size;
+            while (addr < end)
+            {
+                chunk = SIM_FLASH_PAGE_SIZE - ((addr - flash_base()) % SIM_FLASH_PAGE_SIZE);
+                flash_page_erase(addr);
+                addr += chunk;
+            }
+            sim_stats.clear_ops ++;
+            break;
+    }
+
+    if (m_modules[p_cmd->handle.module_id].cb != NULL)
+    {
+        m_modules[p_cmd->handle.module_id].cb(&p_cmd->handle,
+                                              p_cmd->op_code,
+                                              NRF_SUCCESS,
+                                              p_cmd->p_src,
+                                              p_cmd->size);
+    }
+}
+
+/**@brief Queue a command for execution on the next scheduler run. */
+static uint32_t cmd_enqueue(uint8_t op_code, pstorage_handle_t *p_handle,
+                            uint8_t *p_src, uint32_t size, uint32_t offset)
+{
+    sim_cmd_t *p_cmd;
+
+    if (m_cmd_count == PSTORAGE_CMD_QUEUE_SIZE) return NRF_ERROR_NO_MEM;
+
+    p_cmd = &m_cmd_queue[(m_cmd_head + m_cmd_count) % PSTORAGE_CMD_QUEUE_SIZE];
+    p_cmd->op_code = op_code;
+    p_cmd->handle  = *p_handle;
+    p_cmd->p_src   = p_src;
+    p_cmd->size    = size;
+    p_cmd->offset  = offset;
+    m_cmd_count ++;
+
+    return NRF_SUCCESS;
+}
+
+/**@brief Common parameter checks for store and update. */
+static uint32_t write_check(pstorage_handle_t *p_dest, uint8_t *p_src,
+                            pstorage_size_t size, pstorage_size_t offset)
+{
+    if (!m_initialized) return NRF_ERROR_INVALID_STATE;
+    if (p_dest == NULL || p_src == NULL) return NRF_ERROR_NULL;
+    if (p_dest->module_id >= m_module_count) return NRF_ERROR_INVALID_PARAM;
+    if (size == 0 || offset + size > m_modules[p_dest->module_id].block_size) return NRF_ERROR_INVALID_PARAM;
+    if ((size % SIM_FLASH_WORD_SIZE) || (offset % SIM_FLASH_WORD_SIZE) ||
+        ((uintptr_t) p_src % SIM_FLASH_WORD_SIZE)) return NRF_ERROR_INVALID_ADDR;
+
+    return NRF_SUCCESS;
+}
+
+/*****************************************************************************
+* pstorage API
+*****************************************************************************/
+
+uint32_t pstorage_init(void)
+{
+    m_module_count = 0;
+    m_next_addr    = flash_base();
+    m_cmd_head     = 0;
+    m_cmd_count    = 0;
+    m_initialized  = true;
+
+    // The SDK erases the swap page on init.
+    flash_page_erase(flash_base() + m_flash_size);
+
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_register(pstorage_module_param_t *p_module_param, pstorage_handle_t *p_block_id)
+{
+    sim_module_t    *p_module;
+    uint32_t        size;
+
+    if (!m_initialized) return NRF_ERROR_INVALID_STATE;
+    if (p_module_param == NULL || p_block_id == NULL) return NRF_ERROR_NULL;
+    if (m_module_count == PSTORAGE_MAX_APPLICATIONS) return NRF_ERROR_NO_MEM;
+    if (p_module_param->block_size == 0 || p_module_param->block_count == 0 ||
+        (SIM_FLASH_PAGE_SIZE % p_module_param->block_size)) return NRF_ERROR_INVALID_PARAM;
+
+    size = p_module_param->block_size * p_module_param->block_count;
+    size = ((size + SIM_FLASH_PAGE_SIZE - 1) / SIM_FLASH_PAGE_SIZE) * SIM_FLASH_PAGE_SIZE;
+
+    if (m_next_addr + size > flash_base() + m_flash_size) return NRF_ERROR_NO_MEM;
+
+    p_module              = &m_modules[m_module_count];
+    p_module->cb          = p_module_param->cb;
+    p_module->base_addr   = m_next_addr;
+    p_module->block_size  = p_module_param->block_size;
+    p_module->block_count = p_module_param->block_count;
+
+    p_block_id->module_id = m_module_count;
+    p_block_id->block_id  = m_next_addr;
+
+    m_next_addr += size;
+    m_module_count ++;
+
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_block_identifier_get(pstorage_handle_t *p_base_id, pstorage_size_t block_num, pstorage_handle_t *p_block_id)
+{
+    sim_module_t *p_module;
+
+    if (!m_initialized) return NRF_ERROR_INVALID_STATE;
+    if (p_base_id == NULL || p_block_id == NULL) return NRF_ERROR_NULL;
+    if (p_base_id->module_id >= m_module_count) return NRF_ERROR_INVALID_PARAM;
+
+    p_module = &m_modules[p_base_id->module_id];
+    if (block_num >= p_module->block_count) return NRF_ERROR_INVALID_PARAM;
+
+    p_block_id->module_id = p_base_id->module_id;
+    p_block_id->block_id  = p_module->base_addr + block_num * p_module->block_size;
+
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_store(pstorage_handle_t *p_dest, uint8_t *p_src, pstorage_size_t size, pstorage_size_t offset)
+{
+    uint32_t err_code = write_check(p_dest, p_src, size, offset);
+
+    if (err_code != NRF_SUCCESS) return err_code;
+
+    return cmd_enqueue(PSTORAGE_STORE_OP_CODE, p_dest, p_src, size, offset);
+}
+
+uint32_t pstorage_update(pstorage_handle_t *p_dest, uint8_t *p_src, pstorage_size_t size, pstorage_size_t offset)
+{
+    uint32_t err_code = write_check(p_dest, p_src, size, offset);
+
+    if (err_code != NRF_SUCCESS) return err_code;
+
+    return cmd_enqueue(PSTORAGE_UPDATE_OP_CODE, p_dest, p_src, size, offset);
+}
+
+uint32_t pstorage_load(uint8_t *p_dest, pstorage_handle_t *p_src, pstorage_size_t size, pstorage_size_t offset)
+{
+    if (!m_initialized) return NRF_ERROR_INVALID_STATE;
+    if (p_dest == NULL || p_src == NULL) return NRF_ERROR_NULL;
+    if (p_src->module_id >= m_module_count) return NRF_ERROR_INVALID_PARAM;
+    if (size == 0 || offset + size > m_modules[p_src->module_id].block_size) return NRF_ERROR_INVALID_PARAM;
+
+    memcpy(p_dest, flash_ptr(p_src->block_id + offset), size);
+
+    sim_stats.load_ops ++;
+    sim_stats.load_ns += SIM_FLASH_LOAD_CALL_NS + (uint64_t) size * SIM_FLASH_LOAD_BYTE_NS;
+
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_clear(pstorage_handle_t *p_base_id, pstorage_size_t size)
+{
+    if (!m_initialized) return NRF_ERROR_INVALID_STATE;
+    if (p_base_id == NULL) return NRF_ERROR_NULL;
+    if (p_base_id->module_id >= m_module_count) return NRF_ERROR_INVALID_PARAM;
+    if (size == 0 || (size % m_modules[p_base_id->module_id].block_size)) return NRF_ERROR_INVALID_PARAM;
+
+    return cmd_enqueue(PSTORAGE_CLEAR_OP_CODE, p_base_id, NULL, size, 0);
+}
+
+uint32_t pstorage_access_status_get(uint32_t *p_count)
+{
+    if (!m_initialized) return NRF_ERROR_INVALID_STATE;
+    if (p_count == NULL) return NRF_ERROR_NULL;
+
+    *p_count = m_cmd_count;
+
+    return NRF_SUCCESS;
+}
+
+void pstorage_sys_event_handler(uint32_t sys_evt)
+{
+    UNUSED_PARAMETER(sys_evt);
+    sim_flash_process();
+}
+
+/*****************************************************************************
+* Simulation Control
+*****************************************************************************/
+
+void sim_flash_process(void)
+{
+    sim_cmd_t cmd;
+
+    while (m_cmd_count)
+    {
+        cmd = m_cmd_queue[m_cmd_head];
+        m_cmd_head = (m_cmd_head + 1) % PSTORAGE_CMD_QUEUE_SIZE;
+        m_cmd_count --;
+
+        cmd_execute(&cmd);
+    }
+}
+
+void sim_flash_open(const char *p_image, uint32_t size)
+{
+    struct stat st;
+    bool        fresh = true;
+    int         flags = MAP_SHARED;
+
+    m_flash_size = ((size + SIM_FLASH_PAGE_SIZE - 1) / SIM_FLASH_PAGE_SIZE) * SIM_FLASH_PAGE_SIZE;
+    m_map_size   = m_flash_size + SIM_FLASH_PAGE_SIZE;
+
+#ifdef MAP_32BIT
+    flags |= MAP_32BIT;
+#endif
+
+    if (p_image != NULL)
+    {
+        m_image_fd = open(p_image, O_RDWR | O_CREAT, 0644);
+        if (m_image_fd < 0 || fstat(m_image_fd, &st) != 0)
+        {
+            perror(p_image);
+            exit(EXIT_FAILURE);
+        }
+        fresh = (st.st_size == 0);
+        if (ftruncate(m_image_fd, m_map_size) != 0)
+        {
+            perror(p_image);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        flags = (flags & ~MAP_SHARED) | MAP_PRIVATE | MAP_ANONYMOUS;
+    }
+
+    m_flash = mmap((void *) SIM_FLASH_MAP_HINT, m_map_size, PROT_READ | PROT_WRITE, flags, m_image_fd, 0);
+    if (m_flash == MAP_FAILED || (uintptr_t) m_flash + m_map_size > UINT32_MAX)
+    {
+        fprintf(stderr, "sim: cannot map flash image below 4 GB\r\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fresh) memset(m_flash, 0xFF, m_map_size);
+
+    sim_reboot();
+}
+
+void sim_flash_close(void)
+{
+    if (m_flash == NULL) return;
+
+    munmap(m_flash, m_map_size);
+    if (m_image_fd >= 0) close(m_image_fd);
+
+    m_flash       = NULL;
+    m_image_fd    = -1;
+    m_initialized = false;
+}
+
+void sim_flash_erase_all(void)
+{
+    memset(m_flash, 0xFF, m_map_size);
+}
+
+void sim_reboot(void)
+{
+    m_module_count = 0;
+    m_next_addr    = flash_base();
+    m_cmd_head     = 0;
+    m_cmd_count    = 0;
+    m_initialized  = false;
+}
+
+void sim_stats_reset(void)
+{
+    memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+uint64_t sim_time_ns(void)
+{
+    return sim_stats.flash_ns + sim_stats.load_ns + sim_stats.uart_ns + sim_stats.delay_ns;
+}
+
+void sim_uart_account(uint32_t count)
+{
+    sim_stats.uart_bytes += count;
+    sim_stats.uart_ns    += (uint64_t) count * SIM_UART_PUT_NS;
+}
+
+void sim_uart_wait(uint32_t count)
+{
+    sim_stats.uart_ns    += (uint64_t) count * SIM_UART_BYTE_NS;
+}
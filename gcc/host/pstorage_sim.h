@@ -0,0 +1,84 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_host_sim Host Flash Simulation
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Simulated nRF51 flash and pstorage backend for host builds.
+ *
+ * The flash image behaves like NOR flash: erase sets a whole page to 0xFF, programming can only
+ * clear bits. Operations are queued like the SDK module does and only executed when the
+ * scheduler runs, so source buffers must stay untouched until completion exactly as on target.
+ * Every operation is charged to a simulated clock using nRF51822 datasheet timings.
+ */
+
+#ifndef HOST_PSTORAGE_SIM_H__
+#define HOST_PSTORAGE_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_FLASH_PAGE_SIZE         1024                                        /**< nRF51822 code page size (in bytes). */
+#define SIM_FLASH_WORD_WRITE_NS     41000                                       /**< Word write time, typ. (nRF51822 PS v3.1, t_WRITE). */
+#define SIM_FLASH_PAGE_ERASE_NS     21060000                                    /**< Page erase time, typ. (nRF51822 PS v3.1, t_ERASEPAGE). */
+#define SIM_FLASH_LOAD_CALL_NS      10000                                       /**< pstorage_load call overhead at 16 MHz (estimate). */
+#define SIM_FLASH_LOAD_BYTE_NS      250                                         /**< memcpy from flash, 4 cycles per byte at 16 MHz (estimate). */
+#define SIM_UART_BYTE_NS            86806                                       /**< One 8N1 character at 115200 baud (wire time, drains the TX ring buffer of uart.c). */
+#define SIM_UART_PUT_NS             4000                                        /**< Queuing a character and its TXDRDY interrupt, about 64 cycles at 16 MHz (estimate). */
+
+/**@brief Counters accumulated by the simulation. */
+typedef struct
+{
+    uint32_t    store_ops;          /**< pstorage_store calls completed. */
+    uint32_t    update_ops;         /**< pstorage_update calls completed. */
+    uint32_t    clear_ops;          /**< pstorage_clear calls completed. */
+    uint32_t    load_ops;           /**< pstorage_load calls. */
+    uint32_t    words_written;      /**< Flash words programmed. */
+    uint32_t    dirty_writes;       /**< Words programmed over non-erased content (data corruption on target). */
+    uint32_t    pages_erased;       /**< Flash pages erased. */
+    uint32_t    uart_bytes;         /**< Characters queued for the debug UART. */
+    uint64_t    flash_ns;           /**< Time the CPU is halted by flash program/erase. */
+    uint64_t    load_ns;            /**< Time spent copying out of flash. */
+    uint64_t    uart_ns;            /**< Time spent queuing characters for the debug UART, or waiting for room. */
+    uint64_t    delay_ns;           /**< Time spent in nrf_delay_ms. */
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;       /**< Global simulation counters. */
+
+/**@brief Map the simulated flash.
+ *
+ * @param[in] p_image   Path of a file backing the flash, or NULL for RAM only. A new file is
+ *                      created erased; an existing one keeps its content across runs.
+ * @param[in] size      Flash size available to pstorage (in bytes, rounded up to pages). One
+ *                      extra page is reserved as swap area.
+ */
+void sim_flash_open(const char *p_image, uint32_t size);
+
+/**@brief Unmap the simulated flash (and flush the backing file). */
+void sim_flash_close(void);
+
+/**@brief Erase the whole simulated flash without charging the clock. */
+void sim_flash_erase_all(void);
+
+/**@brief Simulate a reset: pending operations are lost and registrations are dropped,
+ *        flash content is preserved.
+ */
+void sim_reboot(void);
+
+/**@brief Execute all queued flash operations and deliver their callbacks. */
+void sim_flash_process(void);
+
+/**@brief Clear all counters. */
+void sim_stats_reset(void);
+
+/**@brief Total simulated CPU time in ns (flash + load + UART + delays). */
+uint64_t sim_time_ns(void);
+
+/**@brief Charge UART characters queued in the TX ring buffer to the simulated clock. */
+void sim_uart_account(uint32_t count);
+
+/**@brief Charge the wire time of UART characters waited for (TX ring buffer full) to the simulated clock. */
+void sim_uart_wait(uint32_t count);
+
+#endif
+
+/** @} */
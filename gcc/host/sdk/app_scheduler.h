@@ -0,0 +1,17 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_APP_SCHEDULER_H__
+#define HOST_APP_SCHEDULER_H__
+
+#include <stdint.h>
+#include "app_error.h"
+
+typedef void (*app_sched_event_handler_t)(void *p_event_data, uint16_t event_size);
+
+/**@brief Run queued events. On the host this also completes pending flash operations. */
+void app_sched_execute(void);
+
+uint32_t app_sched_event_put(void *p_event_data, uint16_t event_size, app_sched_event_handler_t handler);
+
+#endif
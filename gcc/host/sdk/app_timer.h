@@ -0,0 +1,16 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_APP_TIMER_H__
+#define HOST_APP_TIMER_H__
+
+#include <stdint.h>
+
+#define APP_TIMER_CLOCK_FREQ    32768
+
+#define APP_TIMER_TICKS(MS, PRESCALER)\
+            ((uint32_t)(((MS) * (uint64_t)APP_TIMER_CLOCK_FREQ) / (((PRESCALER) + 1) * 1000)))
+
+typedef uint32_t app_timer_id_t;
+
+#endif
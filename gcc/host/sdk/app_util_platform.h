@@ -0,0 +1,12 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ *
+ * The host runs interrupt handlers synchronously, critical regions are empty.
+ */
+#ifndef HOST_APP_UTIL_PLATFORM_H__
+#define HOST_APP_UTIL_PLATFORM_H__
+
+#define CRITICAL_REGION_ENTER()     do {
+#define CRITICAL_REGION_EXIT()      } while (0)
+
+#endif
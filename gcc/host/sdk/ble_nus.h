@@ -0,0 +1,11 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_BLE_NUS_H__
+#define HOST_BLE_NUS_H__
+
+#include <stdint.h>
+
+#define BLE_NUS_MAX_DATA_LEN    (23 - 3)    /**< GATT_MTU_SIZE_DEFAULT - 3 */
+
+#endif
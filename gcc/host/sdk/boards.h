@@ -0,0 +1,15 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name (PCA10001 pin map).
+ */
+#ifndef HOST_BOARDS_H__
+#define HOST_BOARDS_H__
+
+#include "nrf_gpio.h"
+
+#define LED_0           18
+#define LED_1           19
+#define BUTTON_0        16
+#define BUTTON_1        17
+#define BUTTON_PULL     0
+
+#endif
@@ -0,0 +1,16 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_NORDIC_COMMON_H__
+#define HOST_NORDIC_COMMON_H__
+
+#define UNUSED_PARAMETER(X)     ((void)(X))
+#define UNUSED_VARIABLE(X)      ((void)(X))
+
+#define MAX(a, b)               ((a) < (b) ? (b) : (a))
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
+
+#define MSB(a)                  (((a) & 0xFF00) >> 8)
+#define LSB(a)                  ((a) & 0x00FF)
+
+#endif
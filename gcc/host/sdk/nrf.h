@@ -0,0 +1,4 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#include "nrf51.h"
@@ -0,0 +1,55 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ *
+ * Only the TWI1 register block and the RTC1 counter are modelled, by host/twi_mock.c. Code
+ * touching other peripherals is kept out of the host build.
+ */
+#ifndef HOST_NRF51_H__
+#define HOST_NRF51_H__
+
+#include <stdint.h>
+
+typedef enum
+{
+    SPI1_TWI1_IRQn = 4                                                          /**< SPI1 / TWI1 interrupt. */
+} IRQn_Type;
+
+/**@brief TWI registers used by the drivers (reserved areas left out). */
+typedef struct
+{
+    volatile uint32_t   TASKS_STARTRX;
+    volatile uint32_t   TASKS_STARTTX;
+    volatile uint32_t   TASKS_STOP;
+    volatile uint32_t   TASKS_SUSPEND;
+    volatile uint32_t   TASKS_RESUME;
+    volatile uint32_t   EVENTS_STOPPED;
+    volatile uint32_t   EVENTS_RXDREADY;
+    volatile uint32_t   EVENTS_TXDSENT;
+    volatile uint32_t   EVENTS_ERROR;
+    volatile uint32_t   EVENTS_BB;
+    volatile uint32_t   INTENSET;
+    volatile uint32_t   INTENCLR;
+    volatile uint32_t   ERRORSRC;
+    volatile uint32_t   ENABLE;
+    volatile uint32_t   PSELSCL;
+    volatile uint32_t   PSELSDA;
+    volatile uint32_t   RXD;
+    volatile uint32_t   TXD;
+    volatile uint32_t   FREQUENCY;
+    volatile uint32_t   ADDRESS;
+} NRF_TWI_Type;
+
+/**@brief RTC registers used by the drivers (the counter only). */
+typedef struct
+{
+    volatile uint32_t   COUNTER;
+} NRF_RTC_Type;
+
+extern NRF_TWI_Type     sim_twi1;                                               /**< Simulated TWI1 registers (host/twi_mock.c). */
+
+extern NRF_RTC_Type     sim_rtc1;                                               /**< Simulated RTC1 counter (host/twi_mock.c). */
+
+#define NRF_TWI1        (&sim_twi1)
+#define NRF_RTC1        (&sim_rtc1)
+
+#endif
@@ -0,0 +1,25 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_NRF51_BITFIELDS_H__
+#define HOST_NRF51_BITFIELDS_H__
+
+#include "nrf51.h"
+
+#define TWI_INTENSET_STOPPED_Msk        (1UL << 1)
+#define TWI_INTENSET_RXDREADY_Msk       (1UL << 2)
+#define TWI_INTENSET_TXDSENT_Msk        (1UL << 7)
+#define TWI_INTENSET_ERROR_Msk          (1UL << 9)
+#define TWI_INTENSET_BB_Msk             (1UL << 14)
+
+#define TWI_ERRORSRC_OVERRUN_Msk        (1UL << 0)
+#define TWI_ERRORSRC_ANACK_Msk          (1UL << 1)
+#define TWI_ERRORSRC_DNACK_Msk          (1UL << 2)
+
+#define RTC_COUNTER_COUNTER_Msk         (0xFFFFFFUL)
+
+#define TWI_ENABLE_ENABLE_Pos           (0UL)
+#define TWI_ENABLE_ENABLE_Disabled      (0x00UL)
+#define TWI_ENABLE_ENABLE_Enabled       (0x05UL)
+
+#endif
@@ -0,0 +1,12 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_NRF_DELAY_H__
+#define HOST_NRF_DELAY_H__
+
+#include <stdint.h>
+
+/**@brief Busy-wait, charged to the simulated clock. */
+void nrf_delay_ms(uint32_t volatile number_of_ms);
+
+#endif
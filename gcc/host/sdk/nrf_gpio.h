@@ -0,0 +1,26 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_NRF_GPIO_H__
+#define HOST_NRF_GPIO_H__
+
+#include <stdint.h>
+
+extern uint32_t sim_gpio_out;   /**< Simulated OUT register. */
+
+static __inline void nrf_gpio_pin_set(uint32_t pin_number)
+{
+    sim_gpio_out |= (1UL << pin_number);
+}
+
+static __inline void nrf_gpio_pin_clear(uint32_t pin_number)
+{
+    sim_gpio_out &= ~(1UL << pin_number);
+}
+
+static __inline void nrf_gpio_pin_write(uint32_t pin_number, uint32_t value)
+{
+    if (value) nrf_gpio_pin_set(pin_number); else nrf_gpio_pin_clear(pin_number);
+}
+
+#endif
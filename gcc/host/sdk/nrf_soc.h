@@ -0,0 +1,23 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ *
+ * The SoftDevice calls are implemented by host/twi_mock.c.
+ */
+#ifndef HOST_NRF_SOC_H__
+#define HOST_NRF_SOC_H__
+
+#include <stdint.h>
+#include "nrf_error.h"
+#include "nrf51.h"
+
+#define NRF_APP_PRIORITY_LOW        3
+
+uint32_t sd_app_evt_wait(void);
+uint32_t sd_nvic_ClearPendingIRQ(IRQn_Type IRQn);
+uint32_t sd_nvic_SetPriority(IRQn_Type IRQn, uint32_t priority);
+uint32_t sd_nvic_EnableIRQ(IRQn_Type IRQn);
+uint32_t sd_ppi_channel_assign(uint8_t channel_num, const volatile void * evt_endpoint, const volatile void * task_endpoint);
+uint32_t sd_ppi_channel_enable_set(uint32_t channel_enable_set_msk);
+uint32_t sd_ppi_channel_enable_clr(uint32_t channel_enable_clr_msk);
+
+#endif
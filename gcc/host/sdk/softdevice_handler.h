@@ -0,0 +1,11 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_SOFTDEVICE_HANDLER_H__
+#define HOST_SOFTDEVICE_HANDLER_H__
+
+#include <stdint.h>
+#include "app_error.h"
+#include "nrf_soc.h"
+
+#endif
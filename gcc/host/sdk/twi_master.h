@@ -0,0 +1,16 @@
+/** @file
+ * @brief Host stand-in for the nRF51 SDK header of the same name.
+ */
+#ifndef HOST_TWI_MASTER_H__
+#define HOST_TWI_MASTER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TWI_READ_BIT                (0x01)
+#define TWI_ISSUE_STOP              ((bool)true)
+#define TWI_DONT_ISSUE_STOP         ((bool)false)
+
+bool twi_master_init(void);
+
+#endif
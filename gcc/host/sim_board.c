@@ -0,0 +1,393 @@
+/** @file
+ *
+ * @brief Stand-ins for the board, sensor, timers, BLE and UART used by the recording engine.
+ *
+ * Each DS1621 channel produces an indoor-like trace: a bounded random walk in half-degree steps
+ * that stays flat most of the time, or replays a recorded trace (one reading later per channel).
+ * Below 0.5 degC, the DS1624 bits follow a random walk of their own that moves more often.
+ * The battery discharges linearly, from SIM_BATTERY_MV at boot. The debug UART is modelled as
+ * the TX ring buffer of uart.c, drained at the wire rate over the simulated time. The time of
+ * timers_time_get() is kept as timers.c does: from the newest block at timers_init(), until set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nordic_common.h"
+#include "nrf_delay.h"
+#include "nrf_gpio.h"
+#include "app_error.h"
+#include "app_scheduler.h"
+
+#include "uart.h"
+#include "timers.h"
+#include "bluetooth.h"
+#include "adc.h"
+#include "i2c_ds1621.h"
+#include "back_dat.h"
+#include "settings.h"
+
+#include "pstorage_sim.h"
+#include "sim_board.h"
+
+#define SIM_SCHED_QUEUE_SIZE    18                                              /**< Same as SCHED_QUEUE_SIZE in main.c. */
+#define SIM_SENSOR_MIN          (15 * 2)                                        /**< Lower bound of the trace (in 0.5 degC). */
+#define SIM_SENSOR_MAX          (30 * 2)                                        /**< Upper bound of the trace (in 0.5 degC). */
+#define SIM_BATTERY_MV          3000                                            /**< Battery voltage at time 0 (in mV). */
+#define SIM_BATTERY_MV_PER_HOUR 1                                               /**< Battery discharge (in mV per hour). */
+
+/**@brief Queued scheduler event (no payload is used by the recording engine). */
+typedef struct
+{
+    app_sched_event_handler_t   handler;
+} sim_sched_evt_t;
+
+uint32_t                    sim_gpio_out;
+
+static sim_sched_evt_t      m_sched_queue[SIM_SCHED_QUEUE_SIZE];                /**< Pending scheduler events. */
+static uint32_t             m_sched_count;                                      /**< Number of pending events. */
+static uint32_t             m_sensor_state;                                     /**< LCG state of the synthetic trace. */
+static int32_t              m_sensor_value[DS1621_CHANNEL_MAX];                 /**< Current reading of each channel (in 0.5 degC). */
+static int32_t              m_sensor_fine[DS1621_CHANNEL_MAX];                  /**< DS1624 bits below 0.5 degC of each channel (in 1/32 degC, 0 to 15). */
+static uint8_t              m_channel_mask = 0x01;                              /**< Channels on the bus. */
+static uint32_t             m_clock;                                            /**< Simulated time (in seconds). */
+static uint32_t             m_boot_clock;                                       /**< m_clock at the last timers_init(). */
+static uint32_t             m_epoch_offset;                                     /**< Time at boot, as timers.c. */
+static bool                 m_time_set;                                         /**< The time was set since timers_init(). */
+static uint32_t             m_battery_time;                                     /**< Time of the last battery measurement (0 at boot, see adc_init). */
+static bool                 m_uart_echo;                                        /**< Echo UART output on stderr. */
+static bool                 m_uart_wait;                                        /**< Wait for room instead of dropping characters. */
+static bool                 m_uart_dropping;                                    /**< The last character was dropped. */
+static uint32_t             m_uart_used;                                        /**< Characters waiting in the TX ring buffer. */
+static uint32_t             m_uart_clock;                                       /**< m_clock at the last update of m_uart_used. */
+static uint64_t             m_uart_cpu_ns;                                      /**< sim_time_ns() at the last update of m_uart_used. */
+static uart_tx_stats_t      m_uart_stats;                                       /**< TX ring buffer counters. */
+static int32_t *            m_trace;                                            /**< Recorded trace (in 1/32 degC), NULL for the random walk. */
+static uint32_t             m_trace_len;                                        /**< Number of readings in m_trace. */
+static uint32_t             m_trace_idx;                                        /**< Next reading of m_trace. */
+
+/*****************************************************************************
+* SDK Stand-ins
+*****************************************************************************/
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t *p_file_name)
+{
+    fprintf(stderr, "Error Code: %u\r\nError Line #: %u\r\nError File: %s\r\n",
+            error_code, line_num, p_file_name);
+    abort();
+}
+
+void app_sched_execute(void)
+{
+    uint32_t i;
+
+    sim_flash_process();
+
+    for (i = 0; i < m_sched_count; i++)
+    {
+        m_sched_queue[i].handler(NULL, 0);
+    }
+    m_sched_count = 0;
+}
+
+uint32_t app_sched_event_put(void *p_event_data, uint16_t event_size, app_sched_event_handler_t handler)
+{
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    if (m_sched_count == SIM_SCHED_QUEUE_SIZE) return NRF_ERROR_NO_MEM;
+
+    m_sched_queue[m_sched_count++].handler = handler;
+    return NRF_SUCCESS;
+}
+
+void nrf_delay_ms(uint32_t volatile number_of_ms)
+{
+    sim_stats.delay_ns += (uint64_t) number_of_ms * 1000000;
+}
+
+/*****************************************************************************
+* Application Stand-ins
+*****************************************************************************/
+
+void glb_timers_start(void)
+{
+}
+
+void glb_timers_stop(void)
+{
+}
+
+void timers_init(void)
+{
+    m_boot_clock   = m_clock;
+    m_time_set     = false;
+    m_epoch_offset = back_data_newest_time_get();
+    if (m_epoch_offset != 0) m_epoch_offset ++;
+}
+
+uint32_t timers_time_get(void)
+{
+    return m_epoch_offset + (m_clock - m_boot_clock);
+}
+
+void timers_time_set(uint32_t time)
+{
+    m_epoch_offset = time - (m_clock - m_boot_clock);
+    m_time_set     = true;
+}
+
+bool timers_time_is_set(void)
+{
+    return m_time_set;
+}
+
+void sim_clock_advance(uint32_t seconds)
+{
+    m_clock += seconds;
+}
+
+void ble_dts_update_handler(int8_t sample)
+{
+    UNUSED_PARAMETER(sample);
+}
+
+void conn_params_mode_set(uint32_t state)
+{
+    UNUSED_PARAMETER(state);
+}
+
+void settings_storage_generation_bump(void)
+{
+}
+
+void ds1624_start_temp_conversion(void)
+{
+}
+
+bool ds1621_mode_set(bool continuous)
+{
+    UNUSED_PARAMETER(continuous);
+    return true;
+}
+
+void timers_sample_period_set(uint32_t period_ms)
+{
+    UNUSED_PARAMETER(period_ms);
+}
+
+void timers_conversion_start(uint32_t conversion_ms)
+{
+    UNUSED_PARAMETER(conversion_ms);
+}
+
+void timers_conversion_stop(void)
+{
+}
+
+void battery_level_meas_once(void)
+{
+    m_battery_time = m_clock;
+}
+
+uint16_t battery_voltage_get(void)
+{
+    return SIM_BATTERY_MV - MIN(m_battery_time / 3600 * SIM_BATTERY_MV_PER_HOUR, SIM_BATTERY_MV / 2);
+}
+
+uint8_t ds1621_channel_mask_get(void)
+{
+    return m_channel_mask;
+}
+
+void ds1621_temp_read(ds1621_temp_handler_t handler)
+{
+    ds1621_temp_t   temps[DS1621_CHANNEL_MAX];
+    uint32_t        channel;
+    uint32_t        r;
+    int32_t         reading;                                                    /**< Temperature register (in 1/32 degC). */
+
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
+    {
+        if (!(m_channel_mask & (1 << channel))) continue;
+
+        if (m_trace != NULL)
+        {
+            reading = m_trace[(m_trace_idx + channel) % m_trace_len];
+        }
+        else
+        {
+            m_sensor_state = m_sensor_state * 1103515245 + 12345;
+            r = (m_sensor_state >> 16) % 100;
+
+            if (r < 5 && m_sensor_value[channel] > SIM_SENSOR_MIN) m_sensor_value[channel] --;
+            else if (r >= 95 && m_sensor_value[channel] < SIM_SENSOR_MAX) m_sensor_value[channel] ++;
+
+            m_sensor_state = m_sensor_state * 1103515245 + 12345;
+            r = (m_sensor_state >> 16) % 100;
+
+            if (r < 15 && m_sensor_fine[channel] > 0) m_sensor_fine[channel] --;
+            else if (r >= 85 && m_sensor_fine[channel] < 15) m_sensor_fine[channel] ++;
+
+            reading = m_sensor_value[channel] * 16 + m_sensor_fine[channel];
+        }
+
+        temps[channel].temp      = (int8_t)(reading >> 5);
+        temps[channel].temp_frac = (int8_t)((reading & 0x1F) << 3);
+    }
+    if (m_trace != NULL) m_trace_idx = (m_trace_idx + 1) % m_trace_len;
+
+    handler(m_channel_mask, temps);
+}
+
+void sim_sensor_seed(uint32_t seed)
+{
+    uint32_t channel;
+
+    m_sensor_state = seed;
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
+    {
+        m_sensor_value[channel] = 21 * 2 + channel;
+        m_sensor_fine[channel]  = 8;
+    }
+    m_trace_idx = 0;
+}
+
+void sim_sensor_channels_set(uint8_t channel_mask)
+{
+    m_channel_mask = channel_mask;
+}
+
+bool sim_sensor_trace(const char *p_path)
+{
+    FILE *      p_file = fopen(p_path, "r");
+    char        line[64];
+    double      reading;
+    uint32_t    size = 0;
+
+    if (p_file == NULL) return false;
+
+    m_trace_len = 0;
+    while (fgets(line, sizeof(line), p_file) != NULL)
+    {
+        if (sscanf(line, "%lf", &reading) != 1) continue;       // Header or comment
+
+        if (m_trace_len == size)
+        {
+            size = size ? 2 * size : 1024;
+            m_trace = realloc(m_trace, size * sizeof(*m_trace));
+            if (m_trace == NULL) abort();
+        }
+        m_trace[m_trace_len++] = (int32_t)(reading * 32 + (reading < 0 ? -0.5 : 0.5));
+    }
+    fclose(p_file);
+
+    if (m_trace_len == 0)
+    {
+        free(m_trace);
+        m_trace = NULL;
+        return false;
+    }
+
+    m_trace_idx = 0;
+    return true;
+}
+
+/*****************************************************************************
+* UART
+*****************************************************************************/
+
+/**@brief Drain the TX ring buffer at the wire rate, since its last update. */
+static void uart_drain(void)
+{
+    uint64_t cpu_ns  = sim_time_ns();
+    uint64_t elapsed = (uint64_t)(m_clock - m_uart_clock) * 1000000000ULL +
+                       ((cpu_ns >= m_uart_cpu_ns) ? cpu_ns - m_uart_cpu_ns : cpu_ns);   //< The counters may have been reset
+
+    m_uart_used  -= (uint32_t) MIN(m_uart_used, elapsed / SIM_UART_BYTE_NS);
+    m_uart_clock  = m_clock;
+    m_uart_cpu_ns = cpu_ns;
+}
+
+/**@brief Queue characters in the TX ring buffer, dropping or waiting for those that do not fit.
+ *
+ * @retval Number of characters queued, from the first one.
+ */
+static size_t uart_queue(const char *buf, size_t size)
+{
+    size_t room;
+    size_t queued = size;
+
+    uart_drain();
+    room = UART_TX_BUFFER_SIZE - m_uart_used;
+
+    if (size > room && m_uart_wait)
+    {
+        sim_uart_wait(size - room);
+        m_uart_used = UART_TX_BUFFER_SIZE;
+    }
+    else if (size > room)
+    {
+        queued = room;
+        if (!m_uart_dropping) m_uart_stats.overflows ++;
+        m_uart_dropping = true;
+        m_uart_stats.dropped += size - room;
+        m_uart_used = UART_TX_BUFFER_SIZE;
+    }
+    else
+    {
+        if (size) m_uart_dropping = false;
+        m_uart_used += size;
+    }
+    m_uart_stats.max_used = MAX(m_uart_stats.max_used, m_uart_used);
+
+    sim_uart_account(queued);
+    m_uart_cpu_ns = sim_time_ns();
+    if (m_uart_echo) fwrite(buf, 1, queued, stderr);
+
+    return queued;
+}
+
+void uart_putstr(const uint8_t *str)
+{
+    uart_queue((const char *) str, strlen((const char *) str));
+}
+
+void uart_flush(void)
+{
+    uart_drain();
+    sim_uart_wait(m_uart_used);
+    m_uart_used   = 0;
+    m_uart_cpu_ns = sim_time_ns();
+}
+
+void uart_tx_wait_set(bool wait)
+{
+    m_uart_wait = wait;
+}
+
+void uart_tx_stats_get(uart_tx_stats_t *p_stats)
+{
+    *p_stats = m_uart_stats;
+}
+
+/**@brief Write hook of the stdout replacement. */
+static ssize_t uart_cookie_write(void *cookie, const char *buf, size_t size)
+{
+    UNUSED_PARAMETER(cookie);
+
+    uart_queue(buf, size);
+
+    return size;
+}
+
+void sim_uart_attach(bool echo)
+{
+    static const cookie_io_functions_t uart_io = { NULL, uart_cookie_write, NULL, NULL };
+
+    m_uart_echo = echo;
+
+    stdout = fopencookie(NULL, "w", uart_io);
+    setvbuf(stdout, NULL, _IONBF, 0);
+}
@@ -0,0 +1,41 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_host_board Host Board Simulation
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Stand-ins for the board, sensor, timers, BLE and UART used by the recording engine.
+ */
+
+#ifndef HOST_SIM_BOARD_H__
+#define HOST_SIM_BOARD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**@brief Route stdout through the simulated UART.
+ *
+ * @param[in] echo  Forward the text to stderr as well.
+ */
+void sim_uart_attach(bool echo);
+
+/**@brief Advance the time returned by timers_time_get(). */
+void sim_clock_advance(uint32_t seconds);
+
+/**@brief Restart the synthetic temperature trace (or the recorded one from its start). */
+void sim_sensor_seed(uint32_t seed);
+
+/**@brief Set the DS1621 channels on the bus (0x01 by default), each with its own trace. */
+void sim_sensor_channels_set(uint8_t channel_mask);
+
+/**@brief Replay a recorded temperature trace instead of the synthetic one.
+ *
+ * @param[in] p_path    Text file, one reading (in degC) per line. Lines that do not start with
+ *                      a number are skipped. The trace is replayed in a loop.
+ *
+ * @retval TRUE  At least one reading was loaded.
+ */
+bool sim_sensor_trace(const char *p_path);
+
+#endif
+
+/** @} */
@@ -0,0 +1,486 @@
+/** @file
+ *
+ * @brief Test of the interrupt-driven TWI driver against the TWI register mock.
+ *
+ * The driver (peri/twi_async.c) and the DS1621 driver (i2c/i2c_ds1621.c) run unchanged on top of
+ * host/twi_mock.c. The tests check the transfer state machine (repeated start, stop, NACK, queue
+ * full, completion through the scheduler, power down), transaction lists (one completion, failure
+ * skipping the rest), the timeout of a hung bus, then the DS1621 sampling sequence on one and on
+ * several sensors, and print the bus activity of one sample.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nordic_common.h"
+#include "nrf_delay.h"
+#include "nrf_soc.h"
+#include "app_error.h"
+#include "app_scheduler.h"
+
+#include "uart.h"
+#include "twi_async.h"
+#include "i2c_ds1621.h"
+
+#include "twi_mock.h"
+
+#define TEST_SCHED_QUEUE_SIZE   16                                              /**< Scheduler events kept. */
+#define TEST_SCHED_DATA_SIZE    sizeof(twi_async_evt_t)                         /**< Largest scheduler event, as in main.c. */
+#define TEST_DS1621_CHANNEL     5                                               /**< DS1621 of the single sensor tests (A2..A0 = 101). */
+#define TEST_DS1621_ADDRESS     0x9A                                            /**< Its address, as used by i2c_ds1621.c. */
+#define TEST_ARRAY_MASK         0x25                                            /**< Channels of the sensor array test. */
+
+/**@brief Queued scheduler event, with its data. */
+typedef struct
+{
+    app_sched_event_handler_t   handler;
+    uint16_t                    size;
+    uint8_t                     data[TEST_SCHED_DATA_SIZE];
+} test_sched_evt_t;
+
+static FILE *               m_report;                                           /**< Real stdout (stdout itself is discarded). */
+static test_sched_evt_t     m_sched_queue[TEST_SCHED_QUEUE_SIZE];               /**< Pending scheduler events. */
+static uint32_t             m_sched_count;                                      /**< Number of pending events. */
+static uint32_t             m_sched_total;                                      /**< Events queued since the last reset. */
+static uint32_t             m_failures;                                         /**< Failed checks. */
+
+static uint32_t             m_done_count;                                       /**< Completion handlers run. */
+static uint32_t             m_done_order[TEST_SCHED_QUEUE_SIZE];                /**< Contexts, in completion order. */
+static bool                 m_done_success[TEST_SCHED_QUEUE_SIZE];              /**< Results, in completion order. */
+
+static bool                 m_temp_done;                                        /**< Temperature handler run. */
+static uint8_t              m_temp_mask;                                        /**< Channels read by the last read. */
+static ds1621_temp_t        m_temps[DS1621_CHANNEL_MAX];                        /**< Temperatures of the last read. */
+
+/*****************************************************************************
+* SDK Stand-ins
+*****************************************************************************/
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t *p_file_name)
+{
+    fprintf(stderr, "Error Code: %u\r\nError Line #: %u\r\nError File: %s\r\n",
+            error_code, line_num, p_file_name);
+    abort();
+}
+
+void app_sched_execute(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < m_sched_count; i++)
+    {
+        m_sched_queue[i].handler(m_sched_queue[i].data, m_sched_queue[i].size);
+    }
+    m_sched_count = 0;
+}
+
+uint32_t app_sched_event_put(void *p_event_data, uint16_t event_size, app_sched_event_handler_t handler)
+{
+    if (m_sched_count == TEST_SCHED_QUEUE_SIZE) return NRF_ERROR_NO_MEM;
+    if (event_size > TEST_SCHED_DATA_SIZE) return NRF_ERROR_INVALID_LENGTH;
+
+    m_sched_queue[m_sched_count].handler = handler;
+    m_sched_queue[m_sched_count].size    = event_size;
+    memcpy(m_sched_queue[m_sched_count].data, p_event_data, event_size);
+    m_sched_count++;
+    m_sched_total++;
+    return NRF_SUCCESS;
+}
+
+void nrf_delay_ms(uint32_t volatile number_of_ms)
+{
+    UNUSED_PARAMETER(number_of_ms);
+}
+
+void uart_putstr(const uint8_t *str)
+{
+    fputs((const char *) str, stdout);
+}
+
+/*****************************************************************************
+* Helpers
+*****************************************************************************/
+
+/**@brief Record a check. */
+static void check(bool ok, const char *p_label)
+{
+    if (!ok)
+    {
+        fprintf(m_report, "  FAILED: %s\n", p_label);
+        m_failures++;
+    }
+}
+
+/**@brief Power on: fresh registers and DS1621 sensors, driver initialized. */
+static void boot(uint8_t channel_mask)
+{
+    twi_mock_reset(channel_mask);
+    m_sched_count = 0;
+    twi_async_init();
+}
+
+/**@brief Sleep until the queue is done, then run the scheduler. */
+static void drain(void)
+{
+    while (twi_async_is_busy())
+    {
+        sd_app_evt_wait();
+    }
+    app_sched_execute();
+}
+
+/**@brief Record a transfer completion, the context is its number. */
+static void done_handler(bool success, void *p_context)
+{
+    m_done_success[m_done_count] = success;
+    m_done_order[m_done_count++] = (uint32_t)(uintptr_t) p_context;
+}
+
+/**@brief Record a temperature read. */
+static void temp_handler(uint8_t read_mask, const ds1621_temp_t *p_temps)
+{
+    m_temp_done = true;
+    m_temp_mask = read_mask;
+    memcpy(m_temps, p_temps, sizeof(m_temps));
+}
+
+/**@brief Check the temperature read on a channel.
+ *
+ * @param[in] half_degrees  Temperature expected (in 0.5 degC).
+ */
+static bool temp_is(uint8_t channel, int32_t half_degrees)
+{
+    return (m_temp_mask & (1 << channel))
+        && m_temps[channel].temp == (int8_t)(half_degrees >> 1)
+        && m_temps[channel].temp_frac == ((half_degrees & 0x1) ? (int8_t) 0x80 : 0);
+}
+
+/*****************************************************************************
+* Tests
+*****************************************************************************/
+
+/**@brief Transfer state machine. */
+static void test_transfers(void)
+{
+    static uint8_t  config_write[] = { 0xAC, 0x01 };
+    static uint8_t  config_cmd[]   = { 0xAC };
+    static uint8_t  start_cmd[]    = { 0xEE };
+    uint8_t         config = 0;
+    uint32_t        err_code;
+    uint32_t        i;
+
+    boot(1 << TEST_DS1621_CHANNEL);
+    check(!twi_mock_powered(), "TWI1 powered down after init");
+
+    // Write with stop, handler only run by the scheduler
+    m_done_count = 0;
+    err_code = twi_async_transfer(TEST_DS1621_ADDRESS, config_write, 2, TWI_ISSUE_STOP, done_handler, (void *) 1);
+    check(err_code == NRF_SUCCESS, "write queued");
+    while (twi_async_is_busy()) sd_app_evt_wait();
+    check(m_done_count == 0, "handler deferred to the scheduler");
+    app_sched_execute();
+    check(m_done_count == 1 && m_done_success[0], "write completed");
+    check((twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL) & 0x01) != 0, "config register written");
+    check(!twi_mock_powered(), "TWI1 powered down after the stop condition");
+
+    // Command then read with a repeated start
+    memset(&twi_mock_stats, 0, sizeof(twi_mock_stats));
+    twi_async_transfer(TEST_DS1621_ADDRESS, config_cmd, 1, TWI_DONT_ISSUE_STOP, NULL, NULL);
+    twi_async_transfer(TEST_DS1621_ADDRESS | TWI_READ_BIT, &config, 1, TWI_ISSUE_STOP, done_handler, (void *) 2);
+    drain();
+    check(config == twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL), "config register read");
+    check(twi_mock_stats.starts == 1 && twi_mock_stats.repeated_starts == 1 && twi_mock_stats.stops == 1,
+          "one start, one repeated start, one stop");
+    check(twi_mock_stats.power_ups == 1, "powered once for both transfers");
+
+    // Address not acknowledged, the queue goes on
+    m_done_count = 0;
+    twi_mock_ds1621_present_set(TEST_DS1621_CHANNEL, false);
+    twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP, done_handler, (void *) 3);
+    drain();
+    twi_mock_ds1621_present_set(TEST_DS1621_CHANNEL, true);
+    twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP, done_handler, (void *) 4);
+    drain();
+    check(m_done_count == 2 && !m_done_success[0] && m_done_success[1], "NACK reported, next transfer done");
+    check(!twi_mock_powered(), "TWI1 powered down after the NACK");
+
+    // Full queue, completion order
+    m_done_count = 0;
+    for (i = 0; i < TWI_ASYNC_QUEUE_SIZE; i++)
+    {
+        err_code = twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP, done_handler, (void *)(uintptr_t) i);
+        check(err_code == NRF_SUCCESS, "queued");
+    }
+    err_code = twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP, done_handler, NULL);
+    check(err_code == NRF_ERROR_NO_MEM, "full queue refused");
+    err_code = twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 0, TWI_ISSUE_STOP, done_handler, NULL);
+    check(err_code == NRF_ERROR_INVALID_PARAM, "empty transfer refused");
+    drain();
+    check(m_done_count == TWI_ASYNC_QUEUE_SIZE, "all queued transfers completed");
+    for (i = 0; i < m_done_count; i++)
+    {
+        check(m_done_order[i] == i && m_done_success[i], "completed in order");
+    }
+
+    // Blocking transfer
+    check(twi_async_transfer_wait(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP), "blocking transfer");
+    twi_mock_ds1621_present_set(TEST_DS1621_CHANNEL, false);
+    check(!twi_async_transfer_wait(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP), "blocking transfer NACK");
+    twi_mock_ds1621_present_set(TEST_DS1621_CHANNEL, true);
+
+    fprintf(m_report, "  %-19s: %s\n", "transfer queue", m_failures ? "FAILED" : "OK");
+}
+
+/**@brief Transaction lists. */
+static void test_transactions(void)
+{
+    static uint8_t  config_cmd[]    = { 0xAC };
+    static uint8_t  bad_cmd[]       = { 0x00 };
+    static uint8_t  config_write[]  = { 0xAC, 0x00 };
+    static uint8_t  config;
+    static const twi_async_xfer_t read_back[] =
+    {
+        TWI_ASYNC_WRITE_STOP(TEST_DS1621_ADDRESS, config_write, 2),
+        TWI_ASYNC_WRITE     (TEST_DS1621_ADDRESS, config_cmd, 1),
+        TWI_ASYNC_READ      (TEST_DS1621_ADDRESS, &config, 1)
+    };
+    static const twi_async_xfer_t aborted[] =
+    {
+        TWI_ASYNC_WRITE     (TEST_DS1621_ADDRESS, config_cmd, 1),
+        TWI_ASYNC_READ      (TEST_DS1621_ADDRESS, &config, 1),
+        TWI_ASYNC_WRITE_STOP(TEST_DS1621_ADDRESS, bad_cmd, 1),
+        TWI_ASYNC_WRITE_STOP(TEST_DS1621_ADDRESS, config_write, 2)
+    };
+    const twi_async_xfer_t empty[] =
+    {
+        TWI_ASYNC_WRITE_STOP(TEST_DS1621_ADDRESS, config_cmd, 1),
+        TWI_ASYNC_READ      (TEST_DS1621_ADDRESS, &config, 0)
+    };
+    uint32_t        failures = m_failures;
+
+    boot(1 << TEST_DS1621_CHANNEL);
+
+    // Write, then read back with a repeated start: one handler, one power-up
+    memset(&twi_mock_stats, 0, sizeof(twi_mock_stats));
+    m_sched_total = 0;
+    m_done_count  = 0;
+    config        = 0xFF;
+    check(twi_async_transaction(read_back, 3, done_handler, (void *) 5) == NRF_SUCCESS, "transaction queued");
+    drain();
+    check(m_done_count == 1 && m_done_success[0] && m_done_order[0] == 5, "transaction completed once");
+    check(m_sched_total == 1, "one scheduler event per transaction");
+    check((config & 0x01) == 0 && config == twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL), "written config read back");
+    check(twi_mock_stats.power_ups == 1 && twi_mock_stats.repeated_starts == 1 && twi_mock_stats.stops == 2,
+          "stop, start, repeated start, stop");
+    check(!twi_mock_powered(), "TWI1 powered down after the transaction");
+
+    // A failed transfer skips the rest
+    memset(&twi_mock_stats, 0, sizeof(twi_mock_stats));
+    m_done_count = 0;
+    config_write[1] = 0x01;
+    twi_async_transaction(aborted, 4, done_handler, (void *) 6);
+    drain();
+    check(m_done_count == 1 && !m_done_success[0], "failed transaction reported once");
+    check((twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL) & 0x01) == 0, "transfers after the failure skipped");
+    check(twi_mock_stats.starts + twi_mock_stats.repeated_starts == 3, "three transfers on the bus");
+
+    // Refused lists
+    check(twi_async_transaction(read_back, 0, done_handler, NULL) == NRF_ERROR_INVALID_PARAM, "no transfer refused");
+    check(twi_async_transaction(empty, 2, done_handler, NULL) == NRF_ERROR_INVALID_PARAM, "empty transfer refused");
+    check(!twi_async_is_busy(), "nothing queued");
+
+    // Blocking transaction
+    config = 0xFF;
+    check(twi_async_transaction_wait(&read_back[1], 2) && config == twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL), "blocking transaction");
+
+    fprintf(m_report, "  %-19s: %s\n", "transaction lists", (m_failures != failures) ? "FAILED" : "OK");
+}
+
+/**@brief Timeout of a hung bus. */
+static void test_timeout(void)
+{
+    static uint8_t  start_cmd[] = { 0xEE };
+    uint32_t        failures = m_failures;
+    uint32_t        clears;
+
+    boot(1 << TEST_DS1621_CHANNEL);
+
+    // Blocking transfer: failed once the timeout has passed, the bus is cleared
+    clears = twi_mock_stats.bus_clears;
+    twi_mock_hang_set(true);
+    check(!twi_async_transfer_wait(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP), "blocking transfer timed out");
+    check(twi_mock_stats.bus_clears == clears + 1, "bus cleared once");
+    check(!twi_async_is_busy() && !twi_mock_powered(), "queue empty, TWI1 powered down");
+
+    // Queued transfer: failed by the next one queued, which goes on the bus
+    m_done_count = 0;
+    twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP, done_handler, (void *) 7);
+    sd_app_evt_wait();
+    twi_mock_hang_set(false);
+    check(twi_async_transfer(TEST_DS1621_ADDRESS, start_cmd, 1, TWI_ISSUE_STOP, done_handler, (void *) 8) == NRF_SUCCESS,
+          "queued behind a hung transfer");
+    drain();
+    check(m_done_count == 2 && m_done_order[0] == 7 && !m_done_success[0] && m_done_order[1] == 8 && m_done_success[1],
+          "hung transfer failed, next one done");
+    check(!twi_mock_powered(), "TWI1 powered down after the recovery");
+
+    // Sensors not found on a hung bus, init does not hang
+    boot(1 << TEST_DS1621_CHANNEL);
+    twi_mock_hang_set(true);
+    ds1621_init();
+    check(ds1621_channel_mask_get() == 0 && !twi_async_is_busy(), "init done on a hung bus");
+    twi_mock_hang_set(false);
+
+    fprintf(m_report, "  %-19s: %s\n", "hung bus timeout", (m_failures != failures) ? "FAILED" : "OK");
+}
+
+/**@brief DS1621 sampling sequence. */
+static void test_ds1621(void)
+{
+    uint32_t failures = m_failures;
+
+    boot(1 << TEST_DS1621_CHANNEL);
+    ds1621_init();
+    check(ds1621_channel_mask_get() == (1 << TEST_DS1621_CHANNEL), "DS1621 found");
+    check((twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL) & 0x01) != 0, "DS1621 set to one-shot mode");
+
+    // One-shot sample: conversion start, conversion, read
+    ds1624_start_temp_conversion();
+    drain();
+    twi_mock_ds1621_convert(TEST_DS1621_CHANNEL, 47);
+
+    memset(&twi_mock_stats, 0, sizeof(twi_mock_stats));
+    m_sched_total = 0;
+    m_temp_done   = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && m_temp_mask == (1 << TEST_DS1621_CHANNEL) && temp_is(TEST_DS1621_CHANNEL, 47), "one-shot sample read");
+
+    fprintf(m_report, "  %-19s: %u interrupts, %u scheduler event(s), %u power-up(s), %u starts, %u bytes\n",
+            "read, one sample", twi_mock_stats.interrupts, m_sched_total, twi_mock_stats.power_ups,
+            twi_mock_stats.starts + twi_mock_stats.repeated_starts, twi_mock_stats.bytes);
+
+    // Read before the conversion is done
+    ds1624_start_temp_conversion();
+    drain();
+    m_temp_done = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && m_temp_mask == 0, "conversion not done reported");
+
+    // Continuous mode: no start, DONE not needed
+    check(ds1621_mode_set(true), "continuous mode set");
+    check((twi_mock_ds1621_config_get(TEST_DS1621_CHANNEL) & 0x01) == 0, "DS1621 set to continuous mode");
+    twi_mock_ds1621_convert(TEST_DS1621_CHANNEL, -3);
+    m_temp_done = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && temp_is(TEST_DS1621_CHANNEL, -3), "continuous sample read");
+    check(ds1621_mode_set(true), "same mode set again");
+    check(ds1621_mode_set(false), "one-shot mode set");
+
+    // Sensor gone
+    twi_mock_ds1621_present_set(TEST_DS1621_CHANNEL, false);
+    check(!ds1621_mode_set(true), "failed mode change reported");
+    check(ds1621_mode_set(false), "previous mode still in use");
+    m_temp_done = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && m_temp_mask == 0, "missing sensor reported");
+    check(!twi_mock_powered(), "TWI1 powered down after the sample");
+
+    fprintf(m_report, "  %-19s: %s\n", "DS1621 sampling", (m_failures != failures) ? "FAILED" : "OK");
+}
+
+/**@brief Sampling of a sensor array. */
+static void test_ds1621_array(void)
+{
+    uint32_t failures = m_failures;
+    uint32_t channel;
+
+    boot(TEST_ARRAY_MASK);
+    ds1621_init();
+    check(ds1621_channel_mask_get() == TEST_ARRAY_MASK, "sensors enumerated");
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
+    {
+        if (TEST_ARRAY_MASK & (1 << channel))
+        {
+            check((twi_mock_ds1621_config_get(channel) & 0x01) != 0, "sensor set to one-shot mode");
+        }
+    }
+
+    // One-shot sample on all sensors
+    ds1624_start_temp_conversion();
+    drain();
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++) twi_mock_ds1621_convert(channel, 40 + channel);
+
+    memset(&twi_mock_stats, 0, sizeof(twi_mock_stats));
+    m_sched_total = 0;
+    m_temp_done   = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && m_temp_mask == TEST_ARRAY_MASK && temp_is(0, 40) && temp_is(2, 42) && temp_is(5, 45),
+          "all sensors read");
+
+    fprintf(m_report, "  %-19s: %u interrupts, %u scheduler event(s), %u power-up(s), %u starts, %u bytes\n",
+            "read, 3 sensors", twi_mock_stats.interrupts, m_sched_total, twi_mock_stats.power_ups,
+            twi_mock_stats.starts + twi_mock_stats.repeated_starts, twi_mock_stats.bytes);
+
+    // A sensor gone does not hold the others back
+    twi_mock_ds1621_present_set(2, false);
+    ds1624_start_temp_conversion();
+    drain();
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++) twi_mock_ds1621_convert(channel, -channel);
+    m_temp_done = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && m_temp_mask == (TEST_ARRAY_MASK & ~(1 << 2)) && temp_is(0, 0) && temp_is(5, -5),
+          "missing sensor skipped");
+    twi_mock_ds1621_present_set(2, true);
+
+    // Continuous mode on all sensors
+    ds1621_mode_set(true);
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
+    {
+        if (TEST_ARRAY_MASK & (1 << channel))
+        {
+            check((twi_mock_ds1621_config_get(channel) & 0x01) == 0, "sensor set to continuous mode");
+        }
+        twi_mock_ds1621_convert(channel, 50 - channel);
+    }
+    m_temp_done = false;
+    ds1621_temp_read(temp_handler);
+    drain();
+    check(m_temp_done && m_temp_mask == TEST_ARRAY_MASK && temp_is(0, 50) && temp_is(2, 48) && temp_is(5, 45),
+          "continuous samples read");
+    ds1621_mode_set(false);
+    check(!twi_mock_powered(), "TWI1 powered down after the samples");
+
+    // No sensor at all
+    boot(0);
+    ds1621_init();
+    m_temp_done = false;
+    ds1621_temp_read(temp_handler);
+    check(ds1621_channel_mask_get() == 0 && m_temp_done && m_temp_mask == 0, "no sensor found");
+
+    fprintf(m_report, "  %-19s: %s\n", "DS1621 array", (m_failures != failures) ? "FAILED" : "OK");
+}
+
+int main(void)
+{
+    m_report = fdopen(dup(STDOUT_FILENO), "w");
+    if (freopen("/dev/null", "w", stdout) == NULL) return 1;   //< Driver debug output
+
+    fprintf(m_report, "TWI driver, %u-transaction queue\n", TWI_ASYNC_QUEUE_SIZE);
+
+    test_transfers();
+    test_transactions();
+    test_timeout();
+    test_ds1621();
+    test_ds1621_array();
+
+    fclose(m_report);
+    return m_failures ? 1 : 0;
+}
@@ -0,0 +1,418 @@
+/** @file
+ *
+ * @brief Simulated TWI1 registers with DS1621 sensors on the bus.
+ *
+ * Also stands in for twi_master_init() and the SoftDevice NVIC, PPI and sleep calls used by the
+ * TWI driver: sd_app_evt_wait() runs the bus until the next interrupt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nordic_common.h"
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+#include "nrf_soc.h"
+#include "twi_master.h"
+
+#include "twi_async.h"
+#include "twi_mock.h"
+
+#define TXD_EMPTY               0xFFFFFFFFUL                                    /**< TXD after a byte is sent, until the driver writes the next one. */
+
+#define DS1621_DONE             0x80                                            /**< Conversion done. */
+#define DS1621_WRITABLE         0x03                                            /**< POL and 1SHOT bits. */
+#define DS1621_POWER_ON_CONFIG  (DS1621_DONE | 0x08)                            /**< Bit 3 always reads as 1, so the register is never 0. */
+#define DS1621_BASE_ADDRESS     0x48                                            /**< 7-bit address of channel 0 (A2..A0 = 000). */
+#define DS1621_CHANNELS         8                                               /**< Addresses set by A2..A0. */
+
+/**@brief Bus state seen by the slave. */
+typedef enum
+{
+    BUS_IDLE,                                                                   /**< After a stop condition. */
+    BUS_TX,                                                                     /**< Master writing, or holding the bus after a write. */
+    BUS_RX,                                                                     /**< Master reading. */
+    BUS_RX_SUSPENDED,                                                           /**< Master reading, suspended on the byte boundary. */
+    BUS_ERROR                                                                   /**< Not acknowledged, waiting for the stop condition. */
+} bus_state_t;
+
+/**@brief DS1621 model. */
+typedef struct
+{
+    bool        present;                                                        /**< Acknowledges its address. */
+    uint8_t     config;                                                         /**< Configuration register. */
+    uint8_t     temp[2];                                                        /**< Temperature register (integer, fraction). */
+    bool        converting;                                                     /**< A conversion is running. */
+    uint8_t     command;                                                        /**< Last command byte. */
+    uint8_t     write_idx;                                                      /**< Bytes written since the start condition. */
+    uint8_t     read_idx;                                                       /**< Bytes read since the start condition. */
+} sim_ds1621_t;
+
+NRF_TWI_Type                sim_twi1;
+NRF_RTC_Type                sim_rtc1;
+twi_mock_stats_t            twi_mock_stats;
+
+static bus_state_t          m_state;                                            /**< Bus state. */
+static bool                 m_rx_pending;                                       /**< The slave sends a byte on the next step. */
+static bool                 m_powered;                                          /**< TWI1 was enabled on the last transfer. */
+static bool                 m_irq_enabled;                                      /**< sd_nvic_EnableIRQ() was called. */
+static bool                 m_hung;                                             /**< A slave holds SCL, nothing happens on the bus. */
+static uint32_t             m_ppi_enabled;                                      /**< Enabled PPI channels. */
+static const volatile void *m_ppi_task;                                         /**< Task of TWI_ASYNC_PPI_CHANNEL. */
+static sim_ds1621_t         m_ds1621[DS1621_CHANNELS];                          /**< Sensors, by channel. */
+static sim_ds1621_t *       m_p_slave;                                          /**< Sensor addressed by the last start condition. */
+
+/*****************************************************************************
+* DS1621 Model
+*****************************************************************************/
+
+/**@brief Address a DS1621.
+ *
+ * @retval TRUE  Acknowledged.
+ */
+static bool ds1621_start(uint8_t address, bool read)
+{
+    if ((address & ~(DS1621_CHANNELS - 1)) != DS1621_BASE_ADDRESS) return false;
+
+    m_p_slave = &m_ds1621[address & (DS1621_CHANNELS - 1)];
+    if (!m_p_slave->present) return false;
+
+    if (read) m_p_slave->read_idx = 0; else m_p_slave->write_idx = 0;
+    return true;
+}
+
+/**@brief Write a byte to the DS1621: a command, then its parameter.
+ *
+ * @retval TRUE  Acknowledged.
+ */
+static bool ds1621_write(uint8_t byte)
+{
+    if (m_p_slave->write_idx++ == 0)
+    {
+        m_p_slave->command = byte;
+
+        switch (byte)
+        {
+            case 0xEE:                  // Start convert T
+                m_p_slave->converting = true;
+                m_p_slave->config    &= ~DS1621_DONE;
+                break;
+            case 0x22:                  // Stop convert T
+                m_p_slave->converting = false;
+                break;
+            case 0xAC:                  // Access config
+            case 0xAA:                  // Read temperature
+                break;
+            default:
+                return false;
+        }
+    }
+    else if (m_p_slave->command == 0xAC && m_p_slave->write_idx == 2)
+    {
+        m_p_slave->config = (m_p_slave->config & ~DS1621_WRITABLE) | (byte & DS1621_WRITABLE);
+    }
+    else return false;
+
+    return true;
+}
+
+/**@brief Read a byte from the DS1621, from the register of the last command. */
+static uint8_t ds1621_read(void)
+{
+    uint8_t idx = m_p_slave->read_idx++;
+
+    if (m_p_slave->command == 0xAC) return m_p_slave->config;
+    if (m_p_slave->command == 0xAA && idx < 2) return m_p_slave->temp[idx];
+    return 0xFF;
+}
+
+/*****************************************************************************
+* Bus
+*****************************************************************************/
+
+/**@brief Raise an event, run the interrupt handler if it is enabled. */
+static void event_raise(volatile uint32_t *p_event, uint32_t int_mask)
+{
+    *p_event = 1;
+
+    if (m_irq_enabled && (NRF_TWI1->INTENSET & int_mask))
+    {
+        twi_mock_stats.interrupts++;
+        SPI1_TWI1_IRQHandler();
+
+        if (*p_event != 0)
+        {
+            fprintf(stderr, "TWI mock: event 0x%x not cleared by the interrupt handler\n", int_mask);
+            abort();
+        }
+        if (!twi_mock_powered()) m_powered = false;
+    }
+}
+
+/**@brief Follow the byte boundary through the PPI channel. */
+static void byte_boundary(void)
+{
+    if ((m_ppi_enabled & (1 << TWI_ASYNC_PPI_CHANNEL)) == 0) return;
+
+    if (m_ppi_task == &(NRF_TWI1->TASKS_SUSPEND))
+    {
+        m_state = BUS_RX_SUSPENDED;
+    }
+    else if (m_ppi_task == &(NRF_TWI1->TASKS_STOP))
+    {
+        NRF_TWI1->TASKS_STOP = 1;
+    }
+}
+
+/**@brief Address the slave after a start condition. */
+static void bus_start(bool read)
+{
+    if (!m_powered) twi_mock_stats.power_ups++;
+    m_powered = true;
+
+    if (m_state == BUS_IDLE) twi_mock_stats.starts++; else twi_mock_stats.repeated_starts++;
+    twi_mock_stats.bytes++;
+
+    if (!ds1621_start(NRF_TWI1->ADDRESS, read))
+    {
+        m_state = BUS_ERROR;
+        NRF_TWI1->ERRORSRC |= TWI_ERRORSRC_ANACK_Msk;
+        event_raise(&(NRF_TWI1->EVENTS_ERROR), TWI_INTENSET_ERROR_Msk);
+        return;
+    }
+
+    m_state      = read ? BUS_RX : BUS_TX;
+    m_rx_pending = read;
+}
+
+/**@brief Run the task triggered or the byte due.
+ *
+ * @retval TRUE  Something happened on the bus.
+ */
+static bool bus_step(void)
+{
+    NRF_TWI_Type *  p_twi = NRF_TWI1;
+    uint8_t         byte;
+
+    if (p_twi->ENABLE != (TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos))
+    {
+        m_powered = false;
+        return false;
+    }
+
+    if (m_hung) return false;
+
+    if (p_twi->TASKS_STOP)
+    {
+        p_twi->TASKS_STOP = 0;
+        if (m_state != BUS_IDLE) twi_mock_stats.stops++;
+        m_state = BUS_IDLE;
+        event_raise(&(p_twi->EVENTS_STOPPED), TWI_INTENSET_STOPPED_Msk);
+        return true;
+    }
+
+    if (p_twi->TASKS_STARTTX || p_twi->TASKS_STARTRX)
+    {
+        bool read = (p_twi->TASKS_STARTRX != 0);
+
+        p_twi->TASKS_STARTTX = 0;
+        p_twi->TASKS_STARTRX = 0;
+        bus_start(read);
+        return true;
+    }
+
+    if (p_twi->TASKS_RESUME)
+    {
+        p_twi->TASKS_RESUME = 0;
+        if (m_state == BUS_RX_SUSPENDED)
+        {
+            m_state      = BUS_RX;
+            m_rx_pending = true;
+        }
+        return true;
+    }
+
+    if (m_state == BUS_TX && p_twi->TXD != TXD_EMPTY)
+    {
+        byte       = (uint8_t) p_twi->TXD;
+        p_twi->TXD = TXD_EMPTY;
+        twi_mock_stats.bytes++;
+        byte_boundary();
+
+        if (!ds1621_write(byte))
+        {
+            m_state = BUS_ERROR;
+            p_twi->ERRORSRC |= TWI_ERRORSRC_DNACK_Msk;
+            event_raise(&(p_twi->EVENTS_ERROR), TWI_INTENSET_ERROR_Msk);
+            return true;
+        }
+        event_raise(&(p_twi->EVENTS_TXDSENT), TWI_INTENSET_TXDSENT_Msk);
+        return true;
+    }
+
+    if (m_state == BUS_RX && m_rx_pending)
+    {
+        m_rx_pending = false;
+        p_twi->RXD   = ds1621_read();
+        twi_mock_stats.bytes++;
+        byte_boundary();
+        if (m_state == BUS_RX && !p_twi->TASKS_STOP) m_rx_pending = true;   //< Not suspended: the next byte follows
+        event_raise(&(p_twi->EVENTS_RXDREADY), TWI_INTENSET_RXDREADY_Msk);
+        return true;
+    }
+
+    return false;
+}
+
+/*****************************************************************************
+* Interface Functions
+*****************************************************************************/
+
+void twi_mock_reset(uint8_t channel_mask)
+{
+    uint32_t channel;
+
+    memset(&sim_twi1, 0, sizeof(sim_twi1));
+    memset(&twi_mock_stats, 0, sizeof(twi_mock_stats));
+    memset(&m_ds1621, 0, sizeof(m_ds1621));
+
+    sim_twi1.TXD       = TXD_EMPTY;
+    m_state            = BUS_IDLE;
+    m_rx_pending       = false;
+    m_powered          = false;
+    m_irq_enabled      = false;
+    m_hung             = false;
+    m_ppi_enabled      = 0;
+    m_ppi_task         = NULL;
+    m_p_slave          = &m_ds1621[0];
+
+    for (channel = 0; channel < DS1621_CHANNELS; channel++)
+    {
+        m_ds1621[channel].present = (channel_mask >> channel) & 0x1;
+        m_ds1621[channel].config  = DS1621_POWER_ON_CONFIG;
+    }
+}
+
+void twi_mock_ds1621_present_set(uint8_t channel, bool present)
+{
+    m_ds1621[channel].present = present;
+}
+
+void twi_mock_hang_set(bool hung)
+{
+    m_hung = hung;
+}
+
+void twi_mock_ds1621_convert(uint8_t channel, int32_t half_degrees)
+{
+    sim_ds1621_t *p_ds1621 = &m_ds1621[channel];
+
+    if (!p_ds1621->converting) return;
+
+    p_ds1621->temp[0] = (uint8_t)(int8_t)(half_degrees >> 1);
+    p_ds1621->temp[1] = (half_degrees & 0x1) ? 0x80 : 0;
+
+    if (p_ds1621->config & 0x01)                // One-shot: done until the next start
+    {
+        p_ds1621->converting = false;
+        p_ds1621->config    |= DS1621_DONE;
+    }
+}
+
+uint8_t twi_mock_ds1621_config_get(uint8_t channel)
+{
+    return m_ds1621[channel].config;
+}
+
+bool twi_mock_powered(void)
+{
+    return (sim_twi1.ENABLE == (TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos));
+}
+
+void twi_mock_run(void)
+{
+    uint32_t interrupts = twi_mock_stats.interrupts;
+
+    while (twi_mock_stats.interrupts == interrupts)
+    {
+        if (!bus_step())
+        {
+            if (m_hung)
+            {
+                sim_rtc1.COUNTER = (sim_rtc1.COUNTER + TWI_MOCK_WAKEUP_TICKS) & RTC_COUNTER_COUNTER_Msk;
+                return;
+            }
+            fprintf(stderr, "TWI mock: bus stalled waiting for an interrupt\n");
+            abort();
+        }
+    }
+}
+
+/*****************************************************************************
+* SDK Stand-ins
+*****************************************************************************/
+
+bool twi_master_init(void)
+{
+    // TWI1 restarts from an idle bus, the tasks of a dropped transfer are lost
+    NRF_TWI1->TASKS_STARTRX = 0;
+    NRF_TWI1->TASKS_STARTTX = 0;
+    NRF_TWI1->TASKS_STOP    = 0;
+    NRF_TWI1->TASKS_RESUME  = 0;
+    NRF_TWI1->TXD           = TXD_EMPTY;
+    m_state                 = BUS_IDLE;
+    m_rx_pending            = false;
+    twi_mock_stats.bus_clears++;
+
+    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos;
+    return !m_hung;
+}
+
+uint32_t sd_app_evt_wait(void)
+{
+    twi_mock_run();
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_nvic_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    UNUSED_PARAMETER(IRQn);
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_nvic_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    UNUSED_PARAMETER(IRQn);
+    UNUSED_PARAMETER(priority);
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_nvic_EnableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == SPI1_TWI1_IRQn) m_irq_enabled = true;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ppi_channel_assign(uint8_t channel_num, const volatile void * evt_endpoint, const volatile void * task_endpoint)
+{
+    if (channel_num != TWI_ASYNC_PPI_CHANNEL || evt_endpoint != &(NRF_TWI1->EVENTS_BB))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    m_ppi_task = task_endpoint;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ppi_channel_enable_set(uint32_t channel_enable_set_msk)
+{
+    m_ppi_enabled |= channel_enable_set_msk;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ppi_channel_enable_clr(uint32_t channel_enable_clr_msk)
+{
+    m_ppi_enabled &= ~channel_enable_clr_msk;
+    return NRF_SUCCESS;
+}
@@ -0,0 +1,74 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_host_twi TWI Register Mock
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Simulated TWI1 registers with DS1621 sensors on the bus.
+ *
+ * The registers are plain memory on the host: the mock acts on the tasks triggered since its
+ * last step, raises the resulting events and runs SPI1_TWI1_IRQHandler() for those enabled in
+ * INTENSET. The EVENTS_BB to TASKS_SUSPEND / TASKS_STOP PPI channel is followed. A byte written
+ * to TXD is noticed because the mock leaves TXD at an out-of-range value once it has sent a byte.
+ *
+ * A slave holding SCL hangs the bus: nothing happens on it, and sleeping moves the RTC1 counter
+ * on to the next app_timer wake-up instead.
+ */
+
+#ifndef HOST_TWI_MOCK_H__
+#define HOST_TWI_MOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TWI_MOCK_WAKEUP_TICKS   3277                                            /**< RTC1 ticks between two wake-ups on a hung bus (the 100 ms blinky timer). */
+
+/**@brief Bus activity counters. */
+typedef struct
+{
+    uint32_t    interrupts;                                                     /**< SPI1_TWI1_IRQHandler() runs. */
+    uint32_t    power_ups;                                                      /**< Transfers started with TWI1 disabled before. */
+    uint32_t    starts;                                                         /**< Start conditions, after a stop or idle bus. */
+    uint32_t    repeated_starts;                                                /**< Start conditions without a stop before. */
+    uint32_t    stops;                                                          /**< Stop conditions. */
+    uint32_t    bytes;                                                          /**< Address and data bytes on the bus. */
+    uint32_t    bus_clears;                                                     /**< twi_master_init() calls. */
+} twi_mock_stats_t;
+
+extern twi_mock_stats_t twi_mock_stats;
+
+/**@brief Reset the registers, the counters and the DS1621 sensors (power-on state).
+ *
+ * @param[in] channel_mask  Sensors on the bus, bit # is the channel # (A2..A0, 7-bit address 0x48 + channel #).
+ */
+void twi_mock_reset(uint8_t channel_mask);
+
+/**@brief Take a DS1621 off the bus (address not acknowledged) or put it back. */
+void twi_mock_ds1621_present_set(uint8_t channel, bool present);
+
+/**@brief Hang the bus (a slave holding SCL) or release it. */
+void twi_mock_hang_set(bool hung);
+
+/**@brief Complete a DS1621 conversion, if one is running.
+ *
+ * @param[in] channel       Channel # of the sensor.
+ * @param[in] half_degrees  Temperature (in 0.5 degC).
+ */
+void twi_mock_ds1621_convert(uint8_t channel, int32_t half_degrees);
+
+/**@brief Get the configuration register of a DS1621. */
+uint8_t twi_mock_ds1621_config_get(uint8_t channel);
+
+/**@brief Check whether TWI1 is enabled. */
+bool twi_mock_powered(void);
+
+/**@brief Run the bus until an interrupt has been handled.
+ *
+ * @details On a hung bus, moves the RTC1 counter on by TWI_MOCK_WAKEUP_TICKS instead.
+ *
+ * @note  Aborts if the bus stalls: nothing to do while the caller waits for an interrupt.
+ */
+void twi_mock_run(void);
+
+#endif
+
+/** @} */
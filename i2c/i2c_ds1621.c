@@ -6,14 +6,19 @@
 #include "softdevice_handler.h"
 #include "app_scheduler.h"
 
-#include "twi_master.h"
+#include "twi_async.h"
 #include "uart.h"
 #include "nrf_delay.h"
 
 #include "i2c_ds1621.h"
 
+#if TWI_ASYNC_QUEUE_SIZE < DS1621_CHANNEL_MAX
+#error "TWI_ASYNC_QUEUE_SIZE must hold the temperature reads of all channels."
+#endif
+
 /* DS1621 Addresses & Commands */
-#define DS1621_ADDRESS          0x9A //!< DS1621 TWI address 1010_{A2,A1,A0}_0
+#define DS1621_BASE_ADDRESS     0x90 //!< DS1621 TWI address 1001_{A2,A1,A0}_0, for A2..A0 = 000
+#define DS1621_ADDRESS(CHANNEL) (DS1621_BASE_ADDRESS | ((CHANNEL) << 1)) //!< DS1621 TWI address of a channel
 #define DS1621_ONESHOT_MODE     0x01 //!< Bit in configuration register for 1-shot mode 
 #define DS1621_CONVERSION_DONE  0x80 //!< Bit in configuration register to indicate completed temperature conversion
 
@@ -22,44 +27,83 @@ const uint8_t command_read_temp          = 0xAA; //!< Reads last converted tempe
 const uint8_t command_start_convert_temp = 0xEE; //!< Initiates temperature conversion.
 const uint8_t command_stop_convert_temp  = 0x22; //!< Halts temperature conversion.
 
+static uint8_t m_channel_mask;                      //!< Channels found by ds1621_init()
+static bool m_continuous = false;                   //!< Continuous conversion mode (1SHOT bit cleared)
+
+static ds1621_temp_handler_t m_temp_handler;        //!< Handler of the temperature read in progress
+static uint8_t m_read_pending;                      //!< Channels whose transaction is not done yet
+static uint8_t m_read_mask;                         //!< Channels read successfully
+static ds1621_temp_t m_temps[DS1621_CHANNEL_MAX];   //!< Temperatures read, by channel
+static uint8_t m_temp_config[DS1621_CHANNEL_MAX];   //!< Configuration register read with the temperature
+static uint8_t m_temp_data[DS1621_CHANNEL_MAX][2];  //!< Temperature register (integer, fraction)
+
+/**@brief Temperature read of a channel: configuration register then temperature register, in one transaction */
+#define DS1621_TEMP_READ(CHANNEL)                                                       \
+    {                                                                                   \
+        TWI_ASYNC_WRITE(DS1621_ADDRESS(CHANNEL), &command_access_config, 1),            \
+        TWI_ASYNC_READ (DS1621_ADDRESS(CHANNEL), &m_temp_config[CHANNEL], 1),           \
+        TWI_ASYNC_WRITE(DS1621_ADDRESS(CHANNEL), &command_read_temp, 1),                \
+        TWI_ASYNC_READ (DS1621_ADDRESS(CHANNEL), m_temp_data[CHANNEL], 2)               \
+    }
+
+static const twi_async_xfer_t m_temp_read[DS1621_CHANNEL_MAX][4] =
+{
+    DS1621_TEMP_READ(0), DS1621_TEMP_READ(1), DS1621_TEMP_READ(2), DS1621_TEMP_READ(3),
+    DS1621_TEMP_READ(4), DS1621_TEMP_READ(5), DS1621_TEMP_READ(6), DS1621_TEMP_READ(7)
+};
+
 /*****************************************************************************
 * Driver for Maxim (c) DS1621+
 *****************************************************************************/
 
 /**
- * @brief Function for reading the current configuration of the sensor.
+ * @brief Function for reading the current configuration of a sensor.
+ *
+ * @param[in] channel Channel # (A2..A0).
  *
  * @return uint8_t Zero if communication with the sensor failed. Contents (always non-zero) of configuration register (@ref DS1624_ONESHOT_MODE and @ref DS1624_CONVERSION_DONE) if communication succeeded.
  */
-static uint8_t ds1621_config_read(void)
+static uint8_t ds1621_config_read(uint8_t channel)
 {
     uint8_t config = 0;
 
-    // Write: command protocol
-    if (twi_master_transfer(DS1621_ADDRESS, (uint8_t *)&command_access_config, 1, TWI_DONT_ISSUE_STOP))
+    // Write: command protocol, Read: current configuration
+    const twi_async_xfer_t config_read[] =
     {
-        if (!twi_master_transfer(DS1621_ADDRESS | TWI_READ_BIT, &config, 1, TWI_ISSUE_STOP)) // Read: current configuration
-        {
-            // Read failed
-            config = 0;
-        }
+        TWI_ASYNC_WRITE(DS1621_ADDRESS(channel), &command_access_config, 1),
+        TWI_ASYNC_READ (DS1621_ADDRESS(channel), &config, 1)
+    };
+
+    if (!twi_async_transaction_wait(config_read, sizeof(config_read) / sizeof(config_read[0])))
+    {
+        // Read failed
+        config = 0;
     }
 
     return config;
 }
 
-/**@brief Initialize I2C peripheral */
+/**@brief Initialize I2C peripheral
+ *
+ * A channel is found if its sensor answers the configuration read. DS1624 sensors share the
+ * address range and the commands used here.
+ */
 void ds1621_init(void)
 {
-    bool transfer_succeeded = true;
+    uint8_t channel;
 
-    twi_master_init();
+    twi_async_init();
 
-    uint8_t config = ds1621_config_read();
+    m_channel_mask = 0;
+    m_continuous = false;
 
-    // Configure DS1624 for 1SHOT mode if not done so already.
-    if (config)
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
     {
+        uint8_t config = ds1621_config_read(channel);
+
+        if (!config) continue;                                              //< No sensor at this address
+
+        // Configure DS1624 for 1SHOT mode if not done so already.
         if (!(config & DS1621_ONESHOT_MODE))
         {
             uint8_t data_buffer[2];
@@ -67,72 +111,161 @@ void ds1621_init(void)
             data_buffer[0] = command_access_config;
             data_buffer[1] = DS1621_ONESHOT_MODE;
 
-            transfer_succeeded &= twi_master_transfer(DS1621_ADDRESS, data_buffer, 2, TWI_ISSUE_STOP);
+            if (!twi_async_transfer_wait(DS1621_ADDRESS(channel), data_buffer, 2, TWI_ISSUE_STOP))
+            {
+                DEBUG_PF("DS1621 #%u configuration is failed!\r\n", channel);
+                continue;
+            }
         }
+
+        m_channel_mask |= (1 << channel);
     }
-    else
+
+    if (!m_channel_mask)
+    {
+        DEBUG_ASSERT("DS1621 configuration is failed!\r\n");
+        return;
+    }
+
+    DEBUG_PF("DS1621 channels: 0x%02X\r\n", m_channel_mask);
+}
+
+/**@brief Get the channels found by ds1621_init() */
+uint8_t ds1621_channel_mask_get(void)
+{
+    return m_channel_mask;
+}
+
+/**@brief Select DS1621 conversion mode
+ *
+ * The configuration registers are written first, the EEPROM writes of all sensors run at once.
+ */
+bool ds1621_mode_set(bool continuous)
+{
+    bool transfer_succeeded = true;
+    uint8_t channel;
+
+    if (continuous == m_continuous) return true;
+
+    uint8_t data_buffer[2];
+
+    data_buffer[0] = command_access_config;
+    data_buffer[1] = continuous ? 0 : DS1621_ONESHOT_MODE;
+
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
     {
-        transfer_succeeded = false;
+        if (!(m_channel_mask & (1 << channel))) continue;
+
+        const twi_async_xfer_t config_write[] =
+        {
+            TWI_ASYNC_WRITE_STOP(DS1621_ADDRESS(channel), &command_stop_convert_temp, 1),
+            TWI_ASYNC_WRITE_STOP(DS1621_ADDRESS(channel), data_buffer, 2)
+        };
+
+        // Stop the running conversions first when leaving continuous mode
+        transfer_succeeded &= twi_async_transaction_wait(&config_write[continuous ? 1 : 0], continuous ? 1 : 2);
     }
+    nrf_delay_ms(10);                                                       /**< EEPROM write of the configuration registers. */
 
-    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos; /**< Save power! */
+    for (channel = 0; continuous && channel < DS1621_CHANNEL_MAX; channel++)
+    {
+        if (!(m_channel_mask & (1 << channel))) continue;
+
+        transfer_succeeded &= twi_async_transfer_wait(DS1621_ADDRESS(channel), (uint8_t *)&command_start_convert_temp, 1, TWI_ISSUE_STOP);
+    }
 
     if (!transfer_succeeded)
     {
-        DEBUG_ASSERT("DS1621 configuration is failed!\r\n");
-        return;
+        DEBUG_ASSERT("DS1621 mode setting is failed!\r\n");
+        return false;
     }
 
+    m_continuous = continuous;
+    return true;
 }
 
-/**@brief Start DS1621 temperature conversion */
+/**@brief Report a failed start of conversion. */
+static void conversion_start_handler(bool success, void *p_context)
+{
+    if (!success) DEBUG_PF("Starting DS1621 #%u temp. conversion is failed!\r\n", (uint8_t)(uintptr_t) p_context);
+}
+
+/**@brief Start DS1621 temperature conversion on all channels
+ *
+ * One transfer per channel, so that a sensor missing does not hold the others back.
+ */
 void ds1624_start_temp_conversion(void)
 {
-    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos;  /**< Resume power. */
-    TWI_DELAY();
+    uint8_t channel;
 
-    if (!twi_master_transfer(DS1621_ADDRESS, (uint8_t *)&command_start_convert_temp, 1, TWI_ISSUE_STOP))
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
     {
-        DEBUG_ASSERT("Starting DS1621 temp. conversion is failed!\r\n");
-    }
+        if (!(m_channel_mask & (1 << channel))) continue;
 
-    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos; /**< Save power! */
+        if (twi_async_transfer(DS1621_ADDRESS(channel), (uint8_t *)&command_start_convert_temp, 1, TWI_ISSUE_STOP,
+                               conversion_start_handler, (void *)(uintptr_t) channel) != NRF_SUCCESS)
+        {
+            DEBUG_ASSERT("Starting DS1621 temp. conversion is failed!\r\n");
+        }
+    }
 }
 
-/**@brief Read temperature value from DS1621*/
-void ds1621_temp_read(int8_t *temp, int8_t *temp_frac)
+/**@brief Store the temperature of a channel once its transaction is done, report all channels after the last one. */
+static void temp_read_handler(bool success, void *p_context)
 {
-    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos;  /**< Resume power. */
-    TWI_DELAY();
+    uint8_t channel  = (uint8_t)(uintptr_t) p_context;
+    int8_t temp      = (int8_t)m_temp_data[channel][0];
+    int8_t temp_frac = (int8_t)m_temp_data[channel][1];
+    uint8_t config   = m_temp_config[channel];
 
-    uint8_t config = ds1621_config_read();
+    if (!success)
+    {
+        DEBUG_PF("DS1621 #%u data reading is failed. (ds1621_temp_read)\r\n", channel);
+    }
+    else if ((config & DS1621_CONVERSION_DONE) || (m_continuous && config))  //< In continuous mode, read the last conversion
+    {
+        DEBUG_TRACE("Temp%u = %d%s\r\n", channel, temp, (temp_frac != 0) ? ".5" : "");
 
-    if (config & DS1621_CONVERSION_DONE)
+        m_temps[channel].temp      = temp;
+        m_temps[channel].temp_frac = temp_frac;
+        m_read_mask |= (1 << channel);
+    }
+    else
     {
-        // Write: Begin read temperature command
-        if (twi_master_transfer(DS1621_ADDRESS, (uint8_t *)&command_read_temp, 1, TWI_DONT_ISSUE_STOP))
-        {
-            uint8_t data_buffer[2];
+        DEBUG_PF("DS1621 #%u temperature conversion is not done. (ds1621_temp_read)\r\n", channel);
+    }
 
-            // Read: 2 temperature bytes to data_buffer
-            if (twi_master_transfer(DS1621_ADDRESS | TWI_READ_BIT, data_buffer, 2, TWI_ISSUE_STOP))
-            {
-                *temp       = (int8_t)data_buffer[0];
-                *temp_frac  = (int8_t)data_buffer[1];
+    m_read_pending &= ~(1 << channel);
+    if (!m_read_pending) m_temp_handler(m_read_mask, m_temps);
+}
 
-                DEBUG_PF("Temp = %d", *temp);
-                if (*temp_frac != 0) DEBUG_ASSERT(".5");
-                DEBUG_ASSERT("\r\n");
+/**@brief Read temperature value from all DS1621 channels
+ *
+ * The configuration register and the temperature register of a channel are read in one
+ * transaction, the conversion state is checked once both are in. The transactions of all
+ * channels are queued at once (TWI_ASYNC_QUEUE_SIZE is at least DS1621_CHANNEL_MAX) and run back
+ * to back, a channel that fails does not hold the others back.
+ */
+void ds1621_temp_read(ds1621_temp_handler_t handler)
+{
+    uint8_t channel;
 
-            }
-            else DEBUG_ASSERT("DS1621 data reading is failed. (ds1621_temp_read)\r\n");
+    m_temp_handler = handler;
+    m_read_mask    = 0;
+    m_read_pending = 0;
 
-        }
-        else DEBUG_ASSERT("DS1621 command is failed. (ds1621_temp_read)\r\n");
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
+    {
+        if (!(m_channel_mask & (1 << channel))) continue;
 
+        if (twi_async_transaction(m_temp_read[channel], sizeof(m_temp_read[0]) / sizeof(m_temp_read[0][0]),
+                                  temp_read_handler, (void *)(uintptr_t) channel) != NRF_SUCCESS)
+        {
+            DEBUG_ASSERT("DS1621 command is failed. (ds1621_temp_read)\r\n");
+            continue;
+        }
+        m_read_pending |= (1 << channel);
     }
-    else DEBUG_ASSERT("Temperature conversion is not done. (ds1621_temp_read)\r\n");
 
-    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos; /**< Save power! */
+    if (!m_read_pending) handler(0, m_temps);
 }
-
@@ -2,15 +2,59 @@
 #define I2C_DS1621_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 
-/**@brief Initialize I2C peripheral */
+#define DS1621_CONVERSION_TIME_MS   750     //!< Maximum temperature conversion time (in ms)
+#define DS1621_CHANNEL_MAX          8       //!< Number of sensor addresses on the bus, channel # is A2..A0
+
+#ifndef DS1621_CONTINUOUS_MODE
+#define DS1621_CONTINUOUS_MODE      0       //!< Keep the sensors in continuous mode whatever the sampling period
+#endif
+
+/**@brief Temperature of a channel */
+typedef struct
+{
+    int8_t  temp;                           //!< Integer part (in degC)
+    int8_t  temp_frac;                      //!< Fraction, 0x80 for .5 degC
+} ds1621_temp_t;
+
+/**@brief Temperature read handler type
+ *
+ * @param[in] read_mask Channels whose conversion was done and read (bit # is the channel #).
+ * @param[in] p_temps   Temperatures, indexed by channel #. Only valid for the channels read.
+ */
+typedef void (*ds1621_temp_handler_t)(uint8_t read_mask, const ds1621_temp_t *p_temps);
+
+/**@brief Initialize I2C peripheral
+ *
+ * The DS1621/DS1624 sensors are enumerated on the 8 addresses set by their A2..A0 pins, and set
+ * to 1-shot mode. Configuration transfers wait for their completion, the sampling transfers do not.
+ */
 void ds1621_init(void);
 
-/**@brief Start DS1621 temperature conversion */
+/**@brief Get the channels found by ds1621_init()
+ *
+ * @retval Channel mask, bit # is the channel # (A2..A0). 0 if no sensor answered.
+ */
+uint8_t ds1621_channel_mask_get(void);
+
+/**@brief Select DS1621 conversion mode
+ *
+ * In continuous mode the sensors convert all the time, and ds1621_temp_read() returns the last
+ * conversions without starting one. Used when samples are taken faster than a conversion.
+ *
+ * @retval TRUE  The sensors are in the mode asked. FALSE if a transfer failed, the mode in use
+ *               is then still the previous one.
+ */
+bool ds1621_mode_set(bool continuous);
+
+/**@brief Start DS1621 temperature conversion on all channels */
 void ds1624_start_temp_conversion(void);
 
-/**@brief Read temperature value from DS1621*/
-void ds1621_temp_read(int8_t *temp, int8_t *temp_frac);
+/**@brief Read temperature value from all DS1621 channels
+ *
+ * The transfers are queued, the handler is run by the scheduler once all channels are done.
+ */
+void ds1621_temp_read(ds1621_temp_handler_t handler);
 
 #endif
-
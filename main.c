@@ -15,6 +15,7 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "nordic_common.h"
 #include "ble_debug_assert_handler.h"
 #include "softdevice_handler.h"
 #include "pstorage.h"
@@ -32,10 +33,13 @@
 #include "timers.h"
 #include "gpio.h"
 #include "bluetooth.h"
+#include "settings.h"
+#include "twi_async.h"
 
 #define DEAD_BEEF                       0xDEADBEEF                                  /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
-#define SCHED_MAX_EVENT_DATA_SIZE       sizeof(app_timer_event_t)                   /**< Maximum size of scheduler events. Note that scheduler BLE stack events do not contain any data, as the events are being pulled from the stack in the event handler. */
-#define SCHED_QUEUE_SIZE                10                                          /**< Maximum number of events in the scheduler queue. */
+#define SCHED_MAX_EVENT_DATA_SIZE       MAX(sizeof(app_timer_event_t), \
+                                            sizeof(twi_async_evt_t))                /**< Maximum size of scheduler events. Note that scheduler BLE stack events do not contain any data, as the events are being pulled from the stack in the event handler. */
+#define SCHED_QUEUE_SIZE                (10 + TWI_ASYNC_QUEUE_SIZE)                 /**< Maximum number of events in the scheduler queue (TWI completions of all sensors included). */
 
 /**@brief Function for error handling, which is called when an error has occurred.
  *
@@ -63,6 +67,7 @@ void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t *p_
 
     DEBUG_PF("Error Code: %d\r\nError Line #: %d\r\nError File: %s\r\n",
           error_code, line_num, p_file_name);
+    uart_flush();                                       // Sent before the reset
 
     ble_debug_assert_handler(error_code, line_num, p_file_name);
 
@@ -138,6 +143,7 @@ int main(void)
 
     device_manager_init();
     back_data_init();
+    settings_init();
 
 
     if (!(rst_reas & POWER_RESETREAS_SREQ_Msk))         // Disable first power cycle for debug purpose.
@@ -167,6 +173,8 @@ int main(void)
     buttons_init();
     adc_init();
     ds1621_init();
+    back_data_sample_period_set(settings_sample_period_get());
+    back_data_width_set(settings_data_width_get());
 
     /* BLE Initialization */
     DEBUG_ASSERT("Initializing BLE...\r\n");
@@ -11,70 +11,113 @@
 #include "app_scheduler.h"
 
 #include "adc.h"
+#include "timers.h"
 #include "bluetooth.h"
 
+static uint32_t     m_adc_sum;                                                  /**< Sum of the conversions of the running measurement. */
+static uint32_t     m_adc_count;                                                /**< Number of conversions of the running measurement. */
+static uint8_t      m_batt_lvl_last = 0xFF;                                     /**< Last battery level sent to the peer (in %), 0xFF for none. */
+static uint16_t     m_batt_mv = BATTERY_VOLTAGE_NONE;                           /**< Battery voltage of the last measurement (in mV). */
+static bool         m_meas_periodic;                                            /**< The measurements are started by RTC1, not by battery_level_meas_once(). */
+static volatile bool m_meas_once;                                               /**< The running measurement was started by battery_level_meas_once(). */
+
 /*****************************************************************************
 * Event Handler
 *****************************************************************************/
 
-/**@brief Function for handling the ADC event.
- * @details  This function will fetch the conversion result from the ADC, convert the value into
- *           percentage and send it to peer.
+/**@brief Function for handling a new battery level.
+ * @details  This function is only scheduled when the battery level (in %) changes, and sends it
+ *           to peer.
  */
 static void ADC_IRQ_handler(void *p_event_data, uint16_t event_size)
 {
-    uint8_t     adc_result;
-    uint16_t    batt_lvl_in_milli_volts;
-    uint8_t     percentage_batt_lvl;
-    //uint32_t    err_code;
+    ble_bas_battery_level_update_handler(*(uint8_t *) p_event_data);
+}
 
-    adc_result = *(uint8_t *) p_event_data;
-    batt_lvl_in_milli_volts = ADC_RESULT_IN_MILLI_VOLTS(adc_result) +
-                              DIODE_FWD_VOLT_DROP_MILLIVOLTS;
-    percentage_batt_lvl     = battery_level_in_percent(batt_lvl_in_milli_volts);
+/**@brief Function for starting the battery level measurements.
+ * @details  The first measurement is taken one BATTERY_LEVEL_MEAS_INTERVAL from now, the next ones
+ *           follow at that interval. Each one is started by the RTC1 compare event through PPI,
+ *           without waking up the CPU. A single measurement already running does not move the
+ *           compare register once it is done.
+ */
+void battery_level_meas_start(void)
+{
+    uint32_t err_code;
 
-    ble_bas_battery_level_update_handler(percentage_batt_lvl);
+    m_meas_periodic = true;
 
-    NRF_ADC->ENABLE     = ADC_ENABLE_ENABLE_Disabled;
+    if (NRF_ADC->ENABLE == ADC_ENABLE_ENABLE_Disabled)     // Unless a single measurement is running
+    {
+        m_adc_sum   = 0;
+        m_adc_count = 0;
+
+        NRF_ADC->EVENTS_END = 0;
+        NRF_ADC->ENABLE     = ADC_ENABLE_ENABLE_Enabled;
+    }
+
+    NRF_RTC1->CC[ADC_RTC_CC]    = (NRF_RTC1->COUNTER + BATTERY_LEVEL_MEAS_INTERVAL) & RTC_COUNTER_COUNTER_Msk;
+    NRF_RTC1->EVTENSET          = RTC_EVTEN_COMPARE0_Msk << ADC_RTC_CC;
+
+    err_code = sd_ppi_channel_enable_set(1 << ADC_PPI_CHANNEL);
+    APP_ERROR_CHECK(err_code);
 }
 
-/**@brief Function for activate one battery level measurement.
- * @details This function will be activated each time the battery level measurement timer's
- *                  timeout event occurs. When triggered, it enables the ADC to execute one conversion.
+/**@brief Function for stopping the battery level measurements.
  */
-void battery_level_meas_timeout_handler(void *p_context)
+void battery_level_meas_stop(void)
 {
     uint32_t err_code;
 
-    UNUSED_PARAMETER(p_context);
+    err_code = sd_ppi_channel_enable_clr(1 << ADC_PPI_CHANNEL);
+    APP_ERROR_CHECK(err_code);
 
-    NRF_ADC->ENABLE     = ADC_ENABLE_ENABLE_Enabled;
+    NRF_RTC1->EVTENCLR  = RTC_EVTEN_COMPARE0_Msk << ADC_RTC_CC;
 
-    // Enable ADC interrupt
-    err_code = sd_nvic_ClearPendingIRQ(ADC_IRQn);
-    APP_ERROR_CHECK(err_code);
+    m_meas_periodic = false;
+    m_meas_once     = false;
 
-    err_code = sd_nvic_SetPriority(ADC_IRQn, NRF_APP_PRIORITY_LOW);
-    APP_ERROR_CHECK(err_code);
+    NRF_ADC->TASKS_STOP = 1;
+    NRF_ADC->ENABLE     = ADC_ENABLE_ENABLE_Disabled;
+}
 
-    err_code = sd_nvic_EnableIRQ(ADC_IRQn);
-    APP_ERROR_CHECK(err_code);
+/**@brief Function for taking one battery level measurement.
+ * @details The conversions are started by software, the ADC is disabled once they are done.
+ */
+void battery_level_meas_once(void)
+{
+    if (m_meas_periodic || NRF_ADC->ENABLE != ADC_ENABLE_ENABLE_Disabled) return;
+
+    m_adc_sum   = 0;
+    m_adc_count = 0;
+    m_meas_once = true;
 
-    NRF_ADC->EVENTS_END  = 0;    // Stop any running conversions.
+    NRF_ADC->EVENTS_END  = 0;
+    NRF_ADC->ENABLE      = ADC_ENABLE_ENABLE_Enabled;
     NRF_ADC->TASKS_START = 1;
 }
 
+/**@brief Function for getting the battery voltage of the last measurement.
+ */
+uint16_t battery_voltage_get(void)
+{
+    return m_batt_mv;
+}
+
 /*****************************************************************************
 * Initialization Function
 *****************************************************************************/
 
 /**@brief Function for initializing ADC operation
+ * @details  The ADC interrupt is enabled once for all, and RTC1 compare register ADC_RTC_CC is
+ *           connected to the ADC START task. app_timer only uses CC[0] of RTC1.
  */
 void adc_init(void)
 {
+    uint32_t err_code;
+
     // Configure ADC
     NRF_ADC->INTENSET   = ADC_INTENSET_END_Msk;
-    NRF_ADC->CONFIG     = (ADC_CONFIG_RES_8bit                        << ADC_CONFIG_RES_Pos)     |
+    NRF_ADC->CONFIG     = (ADC_CONFIG_RES_10bit                       << ADC_CONFIG_RES_Pos)     |
                           (ADC_CONFIG_INPSEL_SupplyOneThirdPrescaling << ADC_CONFIG_INPSEL_Pos)  |
                           (ADC_CONFIG_REFSEL_VBG                      << ADC_CONFIG_REFSEL_Pos)  |
                           (ADC_CONFIG_PSEL_Disabled                   << ADC_CONFIG_PSEL_Pos)    |
@@ -83,6 +126,25 @@ void adc_init(void)
     NRF_ADC->ENABLE     = ADC_ENABLE_ENABLE_Disabled;
 
     NRF_ADC->TASKS_STOP = 1;
+
+    // Enable ADC interrupt
+    err_code = sd_nvic_ClearPendingIRQ(ADC_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_nvic_SetPriority(ADC_IRQn, NRF_APP_PRIORITY_LOW);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_nvic_EnableIRQ(ADC_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    // Start a measurement on the RTC1 compare event (enabled by battery_level_meas_start)
+    err_code = sd_ppi_channel_assign(ADC_PPI_CHANNEL,
+                                     &(NRF_RTC1->EVENTS_COMPARE[ADC_RTC_CC]),
+                                     &(NRF_ADC->TASKS_START));
+    APP_ERROR_CHECK(err_code);
+
+    // Battery voltage of the first recorded block
+    battery_level_meas_once();
 }
 
 
@@ -91,23 +153,64 @@ void adc_init(void)
 *****************************************************************************/
 
 /**@brief Function for handling the ADC interrupt.
- * @details  This function will configure the scheduler to process ADC interruptions.
+ * @details  This function will add up ADC_OVERSAMPLE_COUNT conversions, starting each one after
+ *           the first, then convert their average into voltage and percentage and set the RTC1
+ *           compare register for the next measurement (or disable the ADC after a single one).
+ *           The compare register is not moved on after a single measurement, which may be running
+ *           when battery_level_meas_start() sets it.
+ *           The scheduler is only used when the percentage changes.
  */
 void ADC_IRQHandler(void)
 {
     uint32_t err_code;
-    uint8_t adc_result;
+    uint16_t batt_lvl_in_milli_volts;
+    uint8_t  percentage_batt_lvl;
 
     if (NRF_ADC->EVENTS_END != 0)
     {
-        // Fetch ADC result & Stop interruption
+        // Fetch ADC result
         NRF_ADC->EVENTS_END     = 0;    // REMEMBER TO CLEAR IRQ!
-        adc_result              = NRF_ADC->RESULT;
+        m_adc_sum              += NRF_ADC->RESULT;
+
+        if (++m_adc_count < ADC_OVERSAMPLE_COUNT)
+        {
+            NRF_ADC->TASKS_START = 1;   // Next conversion of the measurement
+            return;
+        }
+
         NRF_ADC->TASKS_STOP     = 1;
 
-        // Schedule ADC event
-        err_code = app_sched_event_put(&adc_result, sizeof(uint8_t), ADC_IRQ_handler);
-        APP_ERROR_CHECK(err_code);
+        batt_lvl_in_milli_volts = ADC_RESULT_IN_MILLI_VOLTS((m_adc_sum + ADC_OVERSAMPLE_COUNT / 2) / ADC_OVERSAMPLE_COUNT) +
+                                  DIODE_FWD_VOLT_DROP_MILLIVOLTS;
+        percentage_batt_lvl     = battery_level_in_percent(batt_lvl_in_milli_volts);
+
+        m_batt_mv               = batt_lvl_in_milli_volts;
+
+        m_adc_sum   = 0;
+        m_adc_count = 0;
+
+        if (m_meas_periodic)
+        {
+            if (!m_meas_once)           // Started by the compare event
+            {
+                // Next measurement, one interval from now (COUNTER is past the compare register)
+                NRF_RTC1->CC[ADC_RTC_CC] = (NRF_RTC1->COUNTER + BATTERY_LEVEL_MEAS_INTERVAL) & RTC_COUNTER_COUNTER_Msk;
+            }
+        }
+        else
+        {
+            NRF_ADC->ENABLE     = ADC_ENABLE_ENABLE_Disabled;
+        }
+        m_meas_once = false;
+
+        if (percentage_batt_lvl != m_batt_lvl_last)
+        {
+            m_batt_lvl_last = percentage_batt_lvl;
+
+            // Schedule the battery level update
+            err_code = app_sched_event_put(&percentage_batt_lvl, sizeof(uint8_t), ADC_IRQ_handler);
+            APP_ERROR_CHECK(err_code);
+        }
     }
 }
 
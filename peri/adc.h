@@ -11,28 +11,57 @@
 #ifndef CUSTOM_INT_H__
 #define CUSTOM_INT_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define ADC_REF_VOLTAGE_IN_MILLIVOLTS        1200                                      /**< Reference voltage (in milli volts) used by ADC while doing conversion. */
 #define ADC_PRE_SCALING_COMPENSATION         3                                         /**< The ADC is configured to use VDD with 1/3 prescaling as input. And hence the result of conversion is to be multiplied by 3 to get the actual value of the battery voltage.*/
+#define ADC_RESULT_MAX                       1023                                      /**< Result of a full-scale conversion (10-bit resolution). */
 #define DIODE_FWD_VOLT_DROP_MILLIVOLTS       270                                       /**< Typical forward voltage drop of the diode (Part no: SD103ATW-7-F) that is connected in series with the voltage supply. This is the voltage drop when the forward current is 1mA. Source: Data sheet of 'SURFACE MOUNT SCHOTTKY BARRIER DIODE ARRAY' available at www.diodes.com. */
 
+#ifndef ADC_OVERSAMPLE_COUNT
+#define ADC_OVERSAMPLE_COUNT                 8                                         /**< Conversions averaged per battery level measurement (about 68 us each). */
+#endif
+
+#define ADC_RTC_CC                           1                                         /**< RTC1 compare register triggering the measurements (CC[0] is used by app_timer). */
+#define ADC_PPI_CHANNEL                      1                                         /**< PPI channel from the RTC1 compare event to the ADC START task (channel 0 is used by twi_async.c). */
+
+#define BATTERY_VOLTAGE_NONE                 0xFFFF                                    /**< Battery voltage before the first measurement. */
+
 /**@brief Macro to convert the result of ADC conversion in millivolts.
  *
  * @param[in]  ADC_VALUE   ADC result.
  * @retval     Result converted to millivolts.
  */
 #define ADC_RESULT_IN_MILLI_VOLTS(ADC_VALUE)\
-    ((((ADC_VALUE) * ADC_REF_VOLTAGE_IN_MILLIVOLTS) / 255) * ADC_PRE_SCALING_COMPENSATION)
+    ((((ADC_VALUE) * ADC_REF_VOLTAGE_IN_MILLIVOLTS) / ADC_RESULT_MAX) * ADC_PRE_SCALING_COMPENSATION)
+
 
+/**@brief Function for starting the battery level measurements.
+ * @details A measurement is started every BATTERY_LEVEL_MEAS_INTERVAL by the RTC1 compare event
+ *          through PPI, the CPU only wakes up for the ADC interrupts.
+ */
+void battery_level_meas_start(void);
+
+/**@brief Function for stopping the battery level measurements.
+ */
+void battery_level_meas_stop(void);
 
-/**@brief Function for activate one battery level measurement.
- * @details This function will be activated each time the battery level measurement timer's
- *                  timeout event occurs. When triggered, it enables the ADC to execute one conversion.
+/**@brief Function for taking one battery level measurement.
+ * @details Does nothing while the periodic measurements run, or if a measurement is running.
+ *          The result is read with battery_voltage_get().
+ */
+void battery_level_meas_once(void);
+
+/**@brief Function for getting the battery voltage of the last measurement.
+ *
+ * @retval Battery voltage (in mV), BATTERY_VOLTAGE_NONE before the first measurement.
  */
-void battery_level_meas_timeout_handler(void *p_context);
+uint16_t battery_voltage_get(void);
 
 /**@brief Function for handling the ADC interrupt.
- * @details  This function will fetch the conversion result from the ADC, convert the value into
- *           percentage and send it to peer.
+ * @details  This function will average ADC_OVERSAMPLE_COUNT conversions, convert the value into
+ *           percentage and send it to peer when it changes.
  */
 void ADC_IRQHandler(void);
 
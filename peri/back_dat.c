@@ -12,6 +12,8 @@
 #include "softdevice_handler.h"
 #include "app_scheduler.h"
 
+#include "app_util.h"
+#include "crc16.h"
 #include "ble_nus.h"
 
 #include "back_dat.h"
@@ -19,21 +21,74 @@
 #include "bluetooth.h"
 #include "uart.h"
 #include "timers.h"
+#include "adc.h"
+#include "settings.h"
 
 /* Drivers */
 #include "i2c_ds1621.h"
 
 
 
+/**@brief Decoding state of the data segment of a block. */
+typedef struct
+{
+    const uint8_t *                  p_data;                                                          /**< Data segment of the block. */
+    uint8_t                          format;                                                          /**< Data format of the block (BD_FORMAT_*). */
+    uint32_t                         channel_num;                                                     /**< Number of channels of the block (data points per sample). */
+    uint32_t                         width;                                                           /**< Data width of the block (BD_WIDTH_*). */
+    uint32_t                         data_idx;                                                        /**< Index # of the next data point. */
+    uint32_t                         bit_idx;                                                         /**< Bit position of the next code (delta format) or pair (RLE format). */
+    uint32_t                         run;                                                             /**< Remaining occurrences of the current pair (RLE format). */
+    __DATA_TYPE                      value;                                                           /**< Last decoded data point. */
+    __DATA_TYPE                      last[DS1621_CHANNEL_MAX];                                        /**< Last decoded data point of each channel (delta format). */
+} bd_decoder_t;
+
+/**@brief Frame of a block to be transferred through BLE link (see block_frame_get). */
+typedef struct
+{
+    uint8_t                          header[BD_CONFIG_NUM_PER_BLOCK];                                 /**< Config info of the block, CONFIG1 replaced by the size of the data. */
+    const uint8_t *                  p_data;                                                          /**< Data segment of the block, in FLASH or in a staging copy. */
+    uint32_t                         len;                                                             /**< Length of the frame (header + data + CRC16), 0 if the block is not used. */
+    uint8_t                          crc[BD_FRAME_CRC_SIZE];                                          /**< CRC16 of header and data, little-endian. */
+} bd_frame_t;
+
 static volatile uint32_t             sys_state;                                                      /**< System function state. */
-static volatile uint32_t             fsm_state = 0;                                                  /**< State of the FSM, 0 - Start conversion, 1 - Report temp. */
+static bool                          m_sample_continuous;                                             /**< Sensor in continuous conversion mode, read on each sample without starting a conversion. */
+static uint32_t                      m_data_width = BD_DATA_WIDTH;                                    /**< Data width of the blocks to be recorded (BD_WIDTH_*). */
 
 static uint8_t                       ram_page[2][BD_BLOCK_SIZE] __attribute__((aligned(4)));          /**< Ram pages for data & config to be saved in FLASH. */
 static volatile uint32_t             m_cur_page;                                                      /**< Current page # for data & config. */
 static volatile uint32_t             m_cur_data_idx;                                                  /**< Current index # for data & config. */
+static uint8_t                       m_cur_channel_mask;                                              /**< Channels of the current page. */
+static uint32_t                      m_cur_channel_num;                                               /**< Number of channels of the current page (data points per sample). */
+static uint32_t                      m_cur_width;                                                     /**< Data width of the current page (BD_WIDTH_*). */
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+static uint32_t                      m_cur_bit_idx;                                                   /**< Bit position of the next code (or pair) in the current page. */
+static __DATA_TYPE                   m_last_data[DS1621_CHANNEL_MAX];                                 /**< Last data point of each channel appended to the current page (RLE format: [0], whatever the channel). */
+#endif
 static volatile uint32_t             m_cur_block_idx;                                                 /**< Current block # of FLASH area for saving current data & config */
 static volatile uint32_t             m_ble_data_idx;                                                  /**< Index # (head pointer) for data & config to be transferred. */
+static bd_frame_t                    m_ble_frame;                                                     /**< Frame being transferred. */
+#if BD_BLE_PREFETCH
+static bd_frame_t                    m_ble_next;                                                      /**< Frame of the next block. */
+static bool                          m_ble_next_ready;                                                /**< The frame of the next block is fetched. */
+static bool                          m_ble_prefetch_pending;                                          /**< A prefetch is in the scheduler queue. */
+#endif
+static uint32_t                      m_ble_stall_count;                                               /**< Frames fetched from the TX complete event. */
+static uint32_t                      m_ble_frame_skip;                                                /**< Bytes of the first frame not to be transferred (resume). */
+static uint16_t                      m_ble_packet_seq;                                                /**< Sequence # of the next packet. */
 static volatile uint32_t             m_ble_block_idx;                                                 /**< Block # of FLASH area to be transferred */
+static uint32_t                      m_ble_first_seq;                                                 /**< Sequence # of the block a transfer starts from. */
+static uint8_t                       m_ble_tail[BD_BLOCK_SIZE] __attribute__((aligned(4)));           /**< Snapshot of the current page, the last block of a transfer. */
+static bool                          m_ble_tail_valid;                                                /**< The current page was not empty at the start of the transfer. */
+static uint8_t                       m_ble_stage[2][BD_BLOCK_SIZE] __attribute__((aligned(4)));       /**< Copies of the blocks that may change while their frames are sent (current and next frame). */
+static uint32_t                      m_ble_stage_idx;                                                 /**< Staging copy of the next block to be copied. */
+static uint32_t                      m_ble_block_num;                                                 /**< Number of blocks to be transferred. */
+static volatile uint32_t             m_next_seq;                                                      /**< Sequence # of the next preserved block. */
+static volatile uint32_t             m_stored_seq;                                                    /**< Sequence # after the newest block written to FLASH (its store may still be pending). */
+#if BD_RING_BUFFER
+static uint32_t                      m_first_seq;                                                     /**< Sequence # of block 0 at boot, blocks below belong to the previous pass. */
+#endif
 static pstorage_handle_t             m_base_handle;                                                   /**< Identifier for allocated blocks' base address. */
 
 /*****************************************************************************
@@ -59,14 +114,14 @@ void set_sys_state( uint32_t state )
         case SYS_BLE_DATA_INSTANT:
         {
             glb_timers_start();                         //< Start data recording timer
+            conn_params_mode_set(state);                //< Long connection interval
             DEBUG_ASSERT("SYS_BLE_DATA_INSTANT.\r\n");
             break;
         }
         case SYS_BLE_DATA_TRANSFER:
         {
-            glb_timers_stop();                          //< Stop data recording timer
-            back_data_preserve();
-            wait_flash_op();
+            glb_timers_start();                         //< Keep recording during the transfer
+            conn_params_mode_set(state);                //< Short connection interval
             DEBUG_ASSERT("SYS_BLE_DATA_TRANSFER.\r\n");
             break;
         }
@@ -82,18 +137,528 @@ uint32_t get_sys_state(void)
     return sys_state;
 }
 
+#if BD_LOG_STRUCTURED
+/**@brief Check whether a FLASH block is still erased.
+ *
+ * @param[in] p_block   Block handle.
+ *
+ * @retval TRUE  All bytes of the block are 0xFF.
+ */
+static bool is_block_erased(pstorage_handle_t *p_block)
+{
+    uint32_t    err_code;
+    uint32_t    i;
+    uint32_t    block[BD_BLOCK_SIZE / sizeof(uint32_t)];
+    
+    err_code = pstorage_load((uint8_t *)block, p_block, BD_BLOCK_SIZE, 0);
+    APP_ERROR_CHECK(err_code);
+    
+    for (i = 0; i < BD_BLOCK_SIZE / sizeof(uint32_t); i++)
+    {
+        if (block[i] != 0xFFFFFFFF) return false;
+    }
+    
+    return true;
+}
+#endif
+
+#if BD_RING_BUFFER
+/**@brief Check whether all blocks of a FLASH page are erased.
+ *
+ * @param[in] block_idx First block # of the page.
+ */
+static bool is_page_erased(uint32_t block_idx)
+{
+    uint32_t            err_code;
+    uint32_t            i;
+    pstorage_handle_t   block_handle;
+    
+    for (i = block_idx; i < block_idx + BD_BLOCKS_PER_PAGE; i++)
+    {
+        err_code = pstorage_block_identifier_get(&m_base_handle, i, &block_handle);
+        APP_ERROR_CHECK(err_code);
+        
+        if (!is_block_erased(&block_handle)) return false;
+    }
+    
+    return true;
+}
+#endif
+
+/**@brief Load the config info of a FLASH block.
+ *
+ * @param[in]  block_idx Block #.
+ * @param[out] config    Array of BD_CONFIG_NUM_PER_BLOCK bytes.
+ */
+static void block_config_load(uint32_t block_idx, uint8_t *config)
+{
+    uint32_t            err_code;
+    pstorage_handle_t   block_handle;                       /**< Block handle. */
+    
+    err_code = pstorage_block_identifier_get(&m_base_handle, block_idx, &block_handle);
+    APP_ERROR_CHECK(err_code);
+    
+    err_code = pstorage_load(config, &block_handle, BD_CONFIG_NUM_PER_BLOCK, BD_CONFIG_BASE_ADDR);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Check whether config info marks its block as used.
+ *
+ * @retval TRUE  The used marker of the block is set, and the whole config info is programmed.
+ */
+static bool is_config_used(const uint8_t *config)
+{
+    /** @note As clear operation set all FLASH bits to FF, reversed logic is used for config info bytes: 0 - set, 1 - unset. */ 
+    if (!(~config[BD_CONFIG1_OFFSET] & BD_CONFIG1_USE_Msk)) return false;
+    
+    /** @note Words are programmed in order and WIDTH is in the last one: once it is programmed,
+     *        so are SEQ, TIME and CHANNELS. */
+    if (config[BD_CONFIG_WIDTH_OFFSET] == 0xFF) return false;          // Torn before the last config word was programmed
+    
+    return true;
+}
+
+/**@brief Check whether a FLASH block was written before the write cursor.
+ *
+ * @details In ring buffer mode, used blocks with a sequence # lower than that of block 0
+ *          were written in the previous pass and lie after the write cursor.
+ *
+ * @param[in] block_idx Block #.
+ */
+static bool is_block_written(uint32_t block_idx)
+{
+    uint8_t config[BD_CONFIG_NUM_PER_BLOCK];    /**< Config info. */
+    
+    block_config_load(block_idx, config);
+    
+    if (!is_config_used(config)) return false;
+    
+#if BD_RING_BUFFER
+    if (uint32_decode(&config[BD_CONFIG_SEQ_OFFSET]) < m_first_seq) return false;
+#endif
+    
+    return true;
+}
+
+/**@brief Find the first non-used block by checking every block in order.
+ *
+ * @retval Block # of the write cursor, BD_BLOCK_COUNT if the storage is full.
+ */
+static uint32_t find_cursor_linear(void)
+{
+    uint32_t block_idx;
+    
+    for (block_idx = 0; block_idx < BD_BLOCK_COUNT; block_idx++)
+    {
+        DEBUG_TRACE("Load Block %d\r\n", block_idx);
+        
+        if (!is_block_written(block_idx)) break;    // Block is marked as non-used 
+    }
+    
+    return block_idx;
+}
+
+#if BD_INIT_BINARY_SEARCH
+/**@brief Find the first non-used block by binary search over the used markers.
+ *
+ * @details Blocks are filled strictly in order, so written blocks form a prefix of the storage
+ *          and the cursor is found in log2(BD_BLOCK_COUNT) loads.
+ *
+ * @retval Block # of the write cursor, BD_BLOCK_COUNT if the storage is full.
+ */
+static uint32_t find_cursor_bsearch(void)
+{
+    uint32_t lo = 0;                //< Blocks below lo are used.
+    uint32_t hi = BD_BLOCK_COUNT;   //< Blocks from hi on are non-used.
+    uint32_t mid;
+    
+    while (lo < hi)
+    {
+        mid = lo + ((hi - lo) >> 1);
+        
+        if (is_block_written(mid)) lo = mid + 1; else hi = mid;
+    }
+    
+    return lo;
+}
+#endif
+
+/**@brief Block # of the oldest preserved block.
+ *
+ * @details In ring buffer mode, blocks are ordered from the write cursor on (erased blocks
+ *          ahead of the cursor come first). Otherwise, block 0 is the oldest.
+ */
+static uint32_t oldest_block_idx(void)
+{
+#if BD_RING_BUFFER
+    return m_cur_block_idx;
+#else
+    return 0;
+#endif
+}
+
+#if BD_DATA_FORMAT == BD_FORMAT_DELTA
+/**@brief Write a bit field into a data segment, MSB first.
+ *
+ * @param[in] p_buf     Data segment.
+ * @param[in] bit_idx   Bit position of the field.
+ * @param[in] value     Value of the field.
+ * @param[in] bits      Size of the field (in bits).
+ */
+static void bits_put(uint8_t *p_buf, uint32_t bit_idx, uint32_t value, uint32_t bits)
+{
+    uint8_t mask;
+    
+    while (bits--)
+    {
+        mask = 0x80 >> (bit_idx & 0x7);
+        
+        if (value & (1UL << bits)) p_buf[bit_idx >> 3] |= mask; else p_buf[bit_idx >> 3] &= ~mask;
+        bit_idx ++;
+    }
+}
+#endif
+
+/**@brief Read a bit field from a data segment, MSB first.
+ *
+ * @param[in] p_buf     Data segment.
+ * @param[in] bit_idx   Bit position of the field.
+ * @param[in] bits      Size of the field (in bits).
+ *
+ * @retval Value of the field.
+ */
+static uint32_t bits_get(const uint8_t *p_buf, uint32_t bit_idx, uint32_t bits)
+{
+    uint32_t value = 0;
+    
+    while (bits--)
+    {
+        value = (value << 1) | ((p_buf[bit_idx >> 3] >> (7 - (bit_idx & 0x7))) & 0x1);
+        bit_idx ++;
+    }
+    
+    return value;
+}
+
+#if BD_DATA_FORMAT != BD_FORMAT_DELTA
+/**@brief Save a data point on a given width, little-endian.
+ *
+ * @param[out] p_buf    Data segment address of the data point.
+ * @param[in]  value    Data point.
+ * @param[in]  width    Data width (BD_WIDTH_*).
+ */
+static void data_put(uint8_t *p_buf, __DATA_TYPE value, uint32_t width)
+{
+    p_buf[0] = (uint8_t) value;
+    if (width == BD_WIDTH_FINE) p_buf[1] = (uint8_t)(value >> 8);
+}
+#endif
+
+/**@brief Read a data point saved on a given width.
+ *
+ * @param[in] p_buf     Data segment address of the data point.
+ * @param[in] width     Data width (BD_WIDTH_*).
+ *
+ * @retval Data point.
+ */
+static __DATA_TYPE data_get(const uint8_t *p_buf, uint32_t width)
+{
+    return (width == BD_WIDTH_FINE) ? (__DATA_TYPE)(int16_t) uint16_decode(p_buf) : (__DATA_TYPE)(int8_t) p_buf[0];
+}
+
+/**@brief Sign-extend a data point read from a bit field of 8 x width bits. */
+static __DATA_TYPE data_extend(uint32_t value, uint32_t width)
+{
+    return (width == BD_WIDTH_FINE) ? (__DATA_TYPE)(int16_t) value : (__DATA_TYPE)(int8_t) value;
+}
+
+/**@brief Number of channels set in a channel mask. */
+static uint32_t channel_num_get(uint8_t channel_mask)
+{
+    uint32_t num = 0;
+    
+    for (; channel_mask; channel_mask &= channel_mask - 1) num ++;
+    
+    return num;
+}
+
+/**@brief Append a data point to the current page in BD_DATA_FORMAT.
+ *
+ * @details The data point belongs to channel slot m_cur_data_idx % m_cur_channel_num, and is saved
+ *          on m_cur_width bytes.
+ *
+ * @retval FALSE  The data point does not fit, the page has to be preserved first.
+ */
+static bool page_data_append(__DATA_TYPE value)
+{
+    uint8_t *   page = ram_page[m_cur_page];        //< Data segment of the current page.
+    
+    if (m_cur_data_idx == 0)
+    {
+        uint32_encode(timers_time_get(), &page[BD_CONFIG_BASE_ADDR + BD_CONFIG_TIME_OFFSET]);    //< Time of the first data point.
+        page[BD_CONFIG_BASE_ADDR + BD_CONFIG_FORMAT_OFFSET] = BD_DATA_FORMAT |
+                                                              (timers_time_is_set() ? 0 : BD_FORMAT_TIME_BOOT); //< Data format, and whether TIME is on the host clock.
+        uint16_encode(battery_voltage_get(), &page[BD_CONFIG_BASE_ADDR + BD_CONFIG_BATTERY_OFFSET]); //< Battery voltage of the block.
+        battery_level_meas_once();                                                              //< Battery voltage of the next block.
+    }
+    
+#if BD_DATA_FORMAT == BD_FORMAT_DELTA
+    __DATA_TYPE *p_last = &m_last_data[m_cur_data_idx % m_cur_channel_num];   //< Previous data point of the channel.
+    uint32_t    value_bits = 8 * m_cur_width;
+    uint32_t    code;
+    uint32_t    bits;
+    
+    if (m_cur_data_idx < m_cur_channel_num)
+    {
+        code = value & ((1UL << value_bits) - 1);   //< First sample is saved as is.
+        bits = value_bits;
+    }
+    else if (value == *p_last)
+    {
+        code = BD_DELTA_ZERO;
+        bits = BD_DELTA_CODE_BITS;
+    }
+    else if (value == (__DATA_TYPE)(*p_last + 1))
+    {
+        code = BD_DELTA_INC;
+        bits = BD_DELTA_CODE_BITS;
+    }
+    else if (value == (__DATA_TYPE)(*p_last - 1))
+    {
+        code = BD_DELTA_DEC;
+        bits = BD_DELTA_CODE_BITS;
+    }
+    else
+    {
+        code = (BD_DELTA_ESC << value_bits) | (value & ((1UL << value_bits) - 1));
+        bits = BD_DELTA_CODE_BITS + value_bits;
+    }
+    
+    if (m_cur_bit_idx + bits > BD_DATA_END_ADDR * 8) return false;
+    
+    bits_put(page, m_cur_bit_idx, code, bits);
+    m_cur_bit_idx += bits;
+    *p_last = value;
+#elif BD_DATA_FORMAT == BD_FORMAT_RLE
+    uint32_t    pair_addr = m_cur_bit_idx >> 3;     //< Address of the next pair, the repeat count of the current one is right before.
+    
+    if (m_cur_data_idx != 0 && value == m_last_data[0] && page[pair_addr - 1] < BD_RLE_RUN_MAX)
+    {
+        page[pair_addr - 1] ++;                     //< Extend the current run.
+    }
+    else
+    {
+        if (pair_addr + BD_RLE_PAIR_SIZE(m_cur_width) > BD_DATA_END_ADDR) return false;
+        
+        data_put(&page[pair_addr], value, m_cur_width);
+        page[pair_addr + m_cur_width] = 1;
+        m_cur_bit_idx += BD_RLE_PAIR_SIZE(m_cur_width) * 8;
+    }
+    m_last_data[0] = value;
+#else
+    if ((m_cur_data_idx + 1) * m_cur_width > BD_DATA_END_ADDR) return false;
+    
+    data_put(&page[m_cur_data_idx * m_cur_width], value, m_cur_width);
+#endif
+    
+    m_cur_data_idx ++;
+    return true;
+}
+
+/**@brief Append a sample, one data point per channel, to the current page.
+ *
+ * @details The first sample of a page sets its channels and data width (m_data_width). A sample
+ *          that does not fit as a whole is taken back: the data points written past the restored
+ *          cursor are not counted in CONFIG2.
+ *
+ * @param[in] channel_mask  Channels of the sample.
+ * @param[in] p_values      Data points of the channels, from the lowest channel # up.
+ *
+ * @retval FALSE  The sample does not fit or its channels or width differ, the page has to be preserved first.
+ */
+static bool page_sample_append(uint8_t channel_mask, const __DATA_TYPE *p_values)
+{
+    uint32_t    data_idx = m_cur_data_idx;          //< Cursor before the sample.
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+    uint32_t    bit_idx = m_cur_bit_idx;
+    __DATA_TYPE last_data[DS1621_CHANNEL_MAX];
+#endif
+#if BD_DATA_FORMAT == BD_FORMAT_RLE
+    uint8_t     run = (bit_idx != 0) ? ram_page[m_cur_page][(bit_idx >> 3) - 1] : 0;   //< Repeat count of the current pair.
+#endif
+    uint32_t    i;
+    
+    if (m_cur_data_idx == 0)
+    {
+        m_cur_channel_mask = channel_mask;
+        m_cur_channel_num = channel_num_get(channel_mask);
+        m_cur_width = m_data_width;
+    }
+    else if (channel_mask != m_cur_channel_mask || m_data_width != m_cur_width) return false;
+    
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+    memcpy(last_data, m_last_data, sizeof(last_data));
+#endif
+    
+    for (i = 0; i < m_cur_channel_num; i++)
+    {
+        if (!page_data_append(p_values[i]))
+        {
+            m_cur_data_idx = data_idx;
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+            m_cur_bit_idx = bit_idx;
+            memcpy(m_last_data, last_data, sizeof(last_data));
+#endif
+#if BD_DATA_FORMAT == BD_FORMAT_RLE
+            if (bit_idx != 0) ram_page[m_cur_page][(bit_idx >> 3) - 1] = run;
+#endif
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**@brief Start decoding the data segment of a block.
+ *
+ * @param[out] p_dec    Decoding state.
+ * @param[in]  p_data   Data segment of the block.
+ * @param[in]  config   Config info of the block.
+ */
+static void block_decoder_init(bd_decoder_t *p_dec, const uint8_t *p_data, const uint8_t *config)
+{
+    p_dec->p_data   = p_data;
+    p_dec->format   = config[BD_CONFIG_FORMAT_OFFSET] & BD_FORMAT_Msk;
+    p_dec->channel_num = MAX(channel_num_get(config[BD_CONFIG_CHANNEL_OFFSET]), 1);
+    p_dec->width    = (config[BD_CONFIG_WIDTH_OFFSET] == BD_WIDTH_FINE) ? BD_WIDTH_FINE : BD_WIDTH_HALF;
+    p_dec->data_idx = 0;
+    p_dec->bit_idx  = 0;
+    p_dec->run      = 0;
+    p_dec->value    = 0;
+}
+
+/**@brief Decode the next data point of a block.
+ *
+ * @note The caller stops after the number of data points given by CONFIG2.
+ */
+static __DATA_TYPE block_decoder_next(bd_decoder_t *p_dec)
+{
+    uint32_t code;
+    
+    if (p_dec->format == BD_FORMAT_RLE)
+    {
+        if (p_dec->run == 0)                        //< Move on to the next pair.
+        {
+            p_dec->value = data_get(&p_dec->p_data[p_dec->bit_idx >> 3], p_dec->width);
+            p_dec->run = p_dec->p_data[(p_dec->bit_idx >> 3) + p_dec->width];
+            p_dec->bit_idx += BD_RLE_PAIR_SIZE(p_dec->width) * 8;
+        }
+        p_dec->run --;
+    }
+    else if (p_dec->format != BD_FORMAT_DELTA)
+    {
+        p_dec->value = data_get(&p_dec->p_data[p_dec->data_idx * p_dec->width], p_dec->width);
+    }
+    else
+    {
+        __DATA_TYPE *p_last = &p_dec->last[p_dec->data_idx % p_dec->channel_num];  //< Previous data point of the channel.
+        
+        if (p_dec->data_idx < p_dec->channel_num)
+        {
+            code = BD_DELTA_ESC;                    //< First sample is saved as is.
+        }
+        else
+        {
+            code = bits_get(p_dec->p_data, p_dec->bit_idx, BD_DELTA_CODE_BITS);
+            p_dec->bit_idx += BD_DELTA_CODE_BITS;
+        }
+        
+        switch (code)
+        {
+            case BD_DELTA_INC:  (*p_last) ++;       break;
+            case BD_DELTA_DEC:  (*p_last) --;       break;
+            case BD_DELTA_ESC:
+            {
+                *p_last = data_extend(bits_get(p_dec->p_data, p_dec->bit_idx, 8 * p_dec->width), p_dec->width);
+                p_dec->bit_idx += 8 * p_dec->width;
+                break;
+            }
+            default:                                break;
+        }
+        p_dec->value = *p_last;
+    }
+    
+    p_dec->data_idx ++;
+    return p_dec->value;
+}
+
+/**@brief Sequence # of the oldest preserved block.
+ *
+ * @details Block # is always the sequence # modulo BD_BLOCK_COUNT. In ring buffer mode, the blocks
+ *          following the write cursor in its FLASH page were erased together with that page.
+ */
+static uint32_t oldest_seq(void)
+{
+#if BD_RING_BUFFER
+    uint32_t num = BD_BLOCK_COUNT;                  //< Number of blocks that may hold data.
+    
+    if (m_cur_block_idx % BD_BLOCKS_PER_PAGE) num -= BD_BLOCKS_PER_PAGE - (m_cur_block_idx % BD_BLOCKS_PER_PAGE);
+    
+    return (m_next_seq > num) ? m_next_seq - num : 0;
+#else
+    return 0;
+#endif
+}
+
 /**@brief Clear all saved data in FLASH
  */
 void back_data_clear_storage(void)
 {
-    uint32_t err_code;
-    err_code = pstorage_clear(&m_base_handle, BD_BLOCK_COUNT * BD_BLOCK_SIZE);
-    APP_ERROR_CHECK(err_code);
+    uint32_t            err_code;
+    uint32_t            i;
+    pstorage_handle_t   block_handle;       //< First block of each cleared segment.
+    
+    for (i = 0; i < BD_BLOCK_COUNT; i += BD_CLEAR_BLOCK_COUNT)
+    {
+        err_code = pstorage_block_identifier_get(&m_base_handle, i, &block_handle);
+        APP_ERROR_CHECK(err_code);
+        
+        err_code = pstorage_clear(&block_handle, 
+                                  MIN(BD_CLEAR_BLOCK_COUNT, BD_BLOCK_COUNT - i) * BD_BLOCK_SIZE);
+        APP_ERROR_CHECK(err_code);
+        
+        wait_flash_op();                    //< Do not overflow the pstorage command queue on large storage.
+    }
+    
+    settings_storage_generation_bump();     //< Sequence #s start again from 0
     
     // Avoid any further preserve operation
     m_cur_page = 0;
     m_cur_data_idx = 0;
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+    m_cur_bit_idx = 0;
+#endif
     memset(ram_page, __DATA_FILL, 2 * BD_BLOCK_SIZE);
+    
+    m_cur_block_idx = 0;
+    m_next_seq = 0;
+    m_stored_seq = 0;
+#if BD_RING_BUFFER
+    m_first_seq = 0;
+#endif
+}
+
+/**@brief Set the config info of a page holding the current data.
+ *
+ * @param[out] p_page   Page of BD_BLOCK_SIZE bytes.
+ */
+static void page_config_set(uint8_t *p_page)
+{
+    p_page[BD_CONFIG_BASE_ADDR + BD_CONFIG1_OFFSET] = ~BD_CONFIG1_USE_Msk;                      //< Mark block as used. (Reversed logic)
+    uint16_encode((uint16_t) m_cur_data_idx, &p_page[BD_CONFIG_BASE_ADDR + BD_CONFIG2_OFFSET]); //< Number of data points in current block.
+    uint32_encode(m_next_seq, &p_page[BD_CONFIG_BASE_ADDR + BD_CONFIG_SEQ_OFFSET]);             //< Sequence # of current block.
+    p_page[BD_CONFIG_BASE_ADDR + BD_CONFIG_CHANNEL_OFFSET] = m_cur_channel_mask;                //< Channels of current block.
+    p_page[BD_CONFIG_BASE_ADDR + BD_CONFIG_WIDTH_OFFSET] = (uint8_t) m_cur_width;               //< Data width of current block.
 }
 
 /**@brief Preserve data in FLASH when a page is full
@@ -102,6 +667,7 @@ void back_data_preserve(void)
 {
     pstorage_handle_t           block_handle;                       /**< Current block handle. */
     uint32_t                    err_code;
+    bool                        blank = false;                      /**< Current block is erased. */
     
     if (m_cur_data_idx != 0) // Not run if page is empty
     {
@@ -110,110 +676,358 @@ void back_data_preserve(void)
             err_code = pstorage_block_identifier_get(&m_base_handle, m_cur_block_idx, &block_handle);
             APP_ERROR_CHECK(err_code);
             
-            // Set config info
-            ram_page[m_cur_page][BD_CONFIG_BASE_ADDR + BD_CONFIG1_OFFSET] = ~BD_CONFIG1_USE_Msk;            //< Mark block as used. (Reversed logic)
-            ram_page[m_cur_page][BD_CONFIG_BASE_ADDR + BD_CONFIG2_OFFSET] = (uint8_t) m_cur_data_idx;       //< Number of data points in current block.
+            page_config_set(ram_page[m_cur_page]);      // Set config info
+            
+#if BD_RING_BUFFER
+            if ((m_cur_block_idx % BD_BLOCKS_PER_PAGE) == 0)
+            {
+                if (!is_page_erased(m_cur_block_idx))
+                {
+                    err_code = pstorage_clear(&block_handle, BD_BLOCKS_PER_PAGE * BD_BLOCK_SIZE);   //< Drop the oldest blocks
+                    APP_ERROR_CHECK(err_code);
+                }
+                blank = true;
+            }
+            else blank = is_block_erased(&block_handle);
+#elif BD_LOG_STRUCTURED
+            blank = is_block_erased(&block_handle);
+#endif
             
-            err_code = pstorage_update(&block_handle, ram_page[m_cur_page], BD_BLOCK_SIZE ,0);  //< Save a full page to a block
+            if (blank)
+            {
+                err_code = pstorage_store(&block_handle, ram_page[m_cur_page], BD_BLOCK_SIZE, 0);   //< Append a full page to an erased block
+            }
+            else
+            {
+                err_code = pstorage_update(&block_handle, ram_page[m_cur_page], BD_BLOCK_SIZE ,0);  //< Save a full page to a block
+            }
             APP_ERROR_CHECK(err_code);
             
-            DEBUG_PF("PAGE:%d, BLOCK:%d PRESERVED\r\n", m_cur_page, m_cur_block_idx);
+            DEBUG_TRACE("PAGE:%d, BLOCK:%d PRESERVED\r\n", m_cur_page, m_cur_block_idx);
 
+            m_next_seq ++;
+#if BD_RING_BUFFER
+            m_cur_block_idx = (m_cur_block_idx + 1) % BD_BLOCK_COUNT;
+#else
             m_cur_block_idx ++;
+#endif
         }
         
         m_cur_page ^= 0x1; //< Change Page
         m_cur_data_idx = 0;
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+        m_cur_bit_idx = 0;
+#endif
         memset(ram_page[m_cur_page], __DATA_FILL, BD_BLOCK_SIZE);
     }
     
 }
 
-/**@brief Prepare data to be sent through BLE UART service.
+/**@brief Size of the data segment used by a block.
  *
- * @details This function fill the p_data array, which is transferred through BLE UART, with all
- *          data preserved in the FLASH. As in each transmission, only BLE_NUS_MAX_DATA_LEN bytes could
- *          be sent. All FLASH data will be reassigned into multiple BLE_NUS_MAX_DATA_LEN-byte segments.
+ * @param[in] p_data    Data segment of the block.
+ * @param[in] config    Config info of the block.
  *
- * @param[out] p_data   Pointer to a array of BLE_NUS_MAX_DATA_LEN bytes.
- * @param[out] length   Length of data in p_data. If length is equal to 0, all data has been processed.
- * 
- * @rtval TRUE  All data has been processed.
+ * @retval Number of bytes holding the data points.
+ */
+static uint32_t block_data_size(const uint8_t *p_data, const uint8_t *config)
+{
+    bd_decoder_t    decoder;
+    uint32_t        count = uint16_decode(&config[BD_CONFIG2_OFFSET]);
+    uint32_t        i;
+    
+    block_decoder_init(&decoder, p_data, config);
+    
+    if (decoder.format == BD_FORMAT_RAW) return MIN(count, BD_DATA_END_ADDR / decoder.width) * decoder.width;
+    
+    for (i = 0; i < count && decoder.bit_idx < BD_DATA_END_ADDR * 8; i++)
+    {
+        block_decoder_next(&decoder);
+    }
+    
+    return MIN((decoder.bit_idx + 7) >> 3, BD_DATA_END_ADDR);
+}
+
+/**@brief Get the transfer frame of a block.
  *
+ * @details The frame is a header of BD_CONFIG_NUM_PER_BLOCK bytes followed by the used part of the data
+ *          segment and a CRC16. The header is the config info of the block, with CONFIG1 replaced by
+ *          the size of the data that follows (padding and erased bytes are not sent). Only the header
+ *          is copied, the data is sent from the block itself.
+ *
+ * @param[in]  p_block  Block (data segment and config info).
+ * @param[in]  seq      Sequence # of the block.
+ * @param[out] p_frame  Frame of the block, of length 0 if the block is not used or holds another sequence #.
  */
-void back_data_ble_nus_fill(uint8_t *p_data, uint8_t *length)
+static void block_frame_get(const uint8_t *p_block, uint32_t seq, bd_frame_t *p_frame)
+{
+    const uint8_t       *config = &p_block[BD_CONFIG_BASE_ADDR];
+    uint32_t            size;
+    uint16_t            crc;
+    
+    p_frame->len = 0;
+    if (!is_config_used(config)) return;                                // Torn block, or erased block ahead of the write cursor
+    if (uint32_decode(&config[BD_CONFIG_SEQ_OFFSET]) != seq) return;    // Block dropped and reused since the transfer started (ring buffer)
+    
+    size = block_data_size(p_block, config);
+    
+    memcpy(p_frame->header, config, BD_CONFIG_NUM_PER_BLOCK);
+    p_frame->header[BD_CONFIG1_OFFSET] = (uint8_t) size;
+    p_frame->p_data = p_block;
+    
+    crc = crc16_compute(p_frame->header, BD_CONFIG_NUM_PER_BLOCK, NULL);
+    crc = crc16_compute(p_block, size, &crc);
+    uint16_encode(crc, p_frame->crc);
+    
+    p_frame->len = BD_CONFIG_NUM_PER_BLOCK + size + BD_FRAME_CRC_SIZE;
+}
+
+/**@brief Get the transfer frame of the block of a given sequence #.
+ *
+ * @details FLASH is memory mapped: a preserved block is sent straight from its FLASH address (the
+ *          pstorage block ID). The block preserved last is sent from its page while its store is
+ *          pending, and the block being recorded from the snapshot taken when the transfer started.
+ *
+ *          Recording goes on while a frame is sent: the page preserved last is cleared by the next
+ *          page change, and in ring buffer mode the oldest blocks are erased as the write cursor
+ *          comes round. Such blocks are copied first, and their frame is sent from the copy. The
+ *          config info is at the end of the block, so a block erased or cleared during the copy is
+ *          found unused, unless the page changed meanwhile: it is then copied again.
+ *
+ * @param[in]  seq      Sequence # of the block.
+ * @param[out] p_frame  Frame of the block.
+ */
+static void ble_frame_fetch(uint32_t seq, bd_frame_t *p_frame)
 {
     uint32_t            err_code;
-    uint8_t             *data;              //< Pointer to a page
-    pstorage_handle_t   block_handle;       //< Current block handle.
+    pstorage_handle_t   block_handle;
+    uint8_t *           p_stage;
+    uint32_t            next_seq;
     
-    data = ram_page[m_cur_page^0x1];        //< Access to the idle page
-    *length = 0;
+    if (m_ble_tail_valid && seq == m_ble_first_seq + m_ble_block_num - 1)
+    {
+        block_frame_get(m_ble_tail, seq, p_frame);                      //< Snapshot of the current page
+        return;
+    }
+    
+#if !BD_RING_BUFFER
+    if (seq < m_stored_seq)
+    {
+        err_code = pstorage_block_identifier_get(&m_base_handle, seq % BD_BLOCK_COUNT, &block_handle);
+        APP_ERROR_CHECK(err_code);
+        
+        block_frame_get((const uint8_t *)(uintptr_t) block_handle.block_id, seq, p_frame);  //< Block ID is the FLASH address, never written again
+        return;
+    }
+#endif
+    
+    p_stage = m_ble_stage[m_ble_stage_idx];
+    m_ble_stage_idx ^= 0x1;                                             //< The other copy may hold the frame being sent
     
-    while(*length < BLE_NUS_MAX_DATA_LEN)
+    do
     {
-        if (m_ble_data_idx != BD_BLOCK_SIZE)                // Fill p_data with remained data in current block
+        next_seq = m_next_seq;
+        if (seq >= m_stored_seq)
         {
-            p_data[*length] = data[m_ble_data_idx];
-            (*length) ++;
-            m_ble_data_idx ++;
-            
-        } else if (m_ble_block_idx + 1 != BD_BLOCK_COUNT)   // Fetch next block if current block is all sent
+            memcpy(p_stage, ram_page[m_cur_page^0x1], BD_BLOCK_SIZE);  //< Store pending: page preserved last
+        }
+        else
         {
-            m_ble_data_idx = 0;
-            m_ble_block_idx ++;
-            
-            err_code = pstorage_block_identifier_get(&m_base_handle, m_ble_block_idx, &block_handle);
-            APP_ERROR_CHECK(err_code);
-        
-            err_code = pstorage_load(data, &block_handle, BD_BLOCK_SIZE, 0);
+            err_code = pstorage_block_identifier_get(&m_base_handle, seq % BD_BLOCK_COUNT, &block_handle);
             APP_ERROR_CHECK(err_code);
             
-        } else break;
+            memcpy(p_stage, (const uint8_t *)(uintptr_t) block_handle.block_id, BD_BLOCK_SIZE);
+        }
+    } while (next_seq != m_next_seq);                                   //< A page was preserved during the copy
+    
+    block_frame_get(p_stage, seq, p_frame);
+}
+
+#if BD_BLE_PREFETCH
+/**@brief Get the frame of the next block of a BLE transfer (scheduler event handler).
+ *
+ * @details Runs from the main loop between connection events, so that the TX complete event does
+ *          not have to decode a block (to find its size) and compute its CRC16 when a frame is all sent.
+ */
+static void ble_frame_prefetch(void *p_event_data, uint16_t event_size)
+{
+    uint32_t next_idx = m_ble_block_idx + 1;
+    
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+    
+    m_ble_prefetch_pending = false;
+    
+    if (m_ble_next_ready || next_idx >= m_ble_block_num) return;
+    
+    ble_frame_fetch(m_ble_first_seq + next_idx, &m_ble_next);
+    m_ble_next_ready = true;
+}
+
+/**@brief Queue the prefetch of the frame of the next block of a BLE transfer. */
+static void ble_frame_prefetch_request(void)
+{
+    if (m_ble_prefetch_pending || m_ble_next_ready || m_ble_block_idx + 1 >= m_ble_block_num) return;
+    
+    m_ble_prefetch_pending = (app_sched_event_put(NULL, 0, ble_frame_prefetch) == NRF_SUCCESS);  //< Fetched on demand if the queue is full
+}
+#endif
+
+/**@brief Make the frame of the next block of a BLE transfer the current one. */
+static void ble_frame_next(void)
+{
+    uint32_t seq = m_ble_first_seq + m_ble_block_idx;
+    
+#if BD_BLE_PREFETCH
+    if (m_ble_next_ready)
+    {
+        m_ble_frame = m_ble_next;
+        m_ble_next_ready = false;
     }
+    else
+    {
+        ble_frame_fetch(seq, &m_ble_frame);
+        if (m_ble_block_idx != 0) m_ble_stall_count ++;
+    }
+    
+    ble_frame_prefetch_request();
+#else
+    ble_frame_fetch(seq, &m_ble_frame);
+    if (m_ble_block_idx != 0) m_ble_stall_count ++;
+#endif
+}
+
+/**@brief Copy part of the frame being transferred.
+ *
+ * @param[out] p_dest   Destination.
+ * @param[in]  idx      Index # in the frame of the first byte.
+ * @param[in]  size     Number of bytes.
+ */
+static void ble_frame_copy(uint8_t *p_dest, uint32_t idx, uint32_t size)
+{
+    uint32_t body = m_ble_frame.len - BD_FRAME_CRC_SIZE;    //< Header + data.
+    uint32_t chunk;
+    
+    while (size != 0)
+    {
+        if (idx < BD_CONFIG_NUM_PER_BLOCK)
+        {
+            chunk = MIN(size, BD_CONFIG_NUM_PER_BLOCK - idx);
+            memcpy(p_dest, &m_ble_frame.header[idx], chunk);
+        }
+        else if (idx < body)
+        {
+            chunk = MIN(size, body - idx);
+            memcpy(p_dest, &m_ble_frame.p_data[idx - BD_CONFIG_NUM_PER_BLOCK], chunk);  //< From FLASH or the staging copy
+        }
+        else
+        {
+            chunk = MIN(size, m_ble_frame.len - idx);
+            memcpy(p_dest, &m_ble_frame.crc[idx - body], chunk);
+        }
+        
+        p_dest += chunk;
+        idx    += chunk;
+        size   -= chunk;
+    }
+}
+
+/**@brief Prepare data to be sent through BLE UART service.
+ *
+ * @details This function fill the p_data array, which is transferred through BLE UART, with the
+ *          next packet of the blocks selected by back_data_transfer_ble_init(),
+ *          back_data_transfer_ble_range_init() or back_data_transfer_ble_resume_init(). Each block
+ *          is sent as a frame (see block_frame_get), split into packets of at most
+ *          BLE_NUS_MAX_DATA_LEN bytes. A packet holds part of a single frame.
+ *
+ * @param[out] p_data   Pointer to a array of BLE_NUS_MAX_DATA_LEN bytes.
+ * @param[out] length   Length of data in p_data. If length is equal to 0, all data has been processed.
+ */
+void back_data_ble_nus_fill(uint8_t *p_data, uint8_t *length)
+{
+    uint32_t            size;
+    
+    *length = 0;
+    
+    while (m_ble_data_idx == m_ble_frame.len)               // Fetch next block if current frame is all sent
+    {
+        if (m_ble_block_idx + 1 == m_ble_block_num) return; // All data has been processed
+        
+        m_ble_block_idx ++;
+        ble_frame_next();
+        m_ble_data_idx = MIN(m_ble_frame_skip, m_ble_frame.len);
+        m_ble_frame_skip = 0;
+    }
+    
+    uint16_encode(m_ble_packet_seq, &p_data[BD_PACKET_SEQ_OFFSET]);
+    p_data[BD_PACKET_FRAME_OFFSET] = (uint8_t) m_ble_data_idx;
+    m_ble_packet_seq ++;
+    
+    size = MIN(BLE_NUS_MAX_DATA_LEN - BD_PACKET_HEADER_SIZE, m_ble_frame.len - m_ble_data_idx);
+    ble_frame_copy(&p_data[BD_PACKET_HEADER_SIZE], m_ble_data_idx, size);   // Fill p_data with remained data in current frame
+    m_ble_data_idx += size;
+    
+    *length = BD_PACKET_HEADER_SIZE + size;
 }
 
 /**@brief Transfer preserved data through UART */
 void back_data_transfer(void *p_event_data, uint16_t event_size)
 {
     uint32_t                    i,j;
+    uint32_t                    block_idx;
     uint32_t                    err_code;
-    uint8_t                     config[BD_CONFIG_NUM_PER_BLOCK];    /**< Config info. */
-    uint8_t                     count;
+    const uint8_t *             config;                             /**< Config info. */
+    uint16_t                    count;
     pstorage_handle_t           block_handle;                       /**< Current block handle. */
-    __DATA_TYPE *               data;
+    const uint8_t *             data;
+    bd_decoder_t                decoder;
     
     UNUSED_PARAMETER(p_event_data);
     UNUSED_PARAMETER(event_size);
     
-    data = (__DATA_TYPE *)ram_page[m_cur_page^0x1];
-    
     /** FOR TEST ONLY, BLOCKING CPU !!!! **/
+    uart_tx_wait_set(true);                                         //< Data, not log: nothing is dropped
     for (i=0; i<BD_BLOCK_COUNT; i++)
     {
-        err_code = pstorage_block_identifier_get(&m_base_handle, i, &block_handle);
-        APP_ERROR_CHECK(err_code);
+        block_idx = (oldest_block_idx() + i) % BD_BLOCK_COUNT;
         
-        err_code = pstorage_load(config, &block_handle, BD_CONFIG_NUM_PER_BLOCK, BD_CONFIG_BASE_ADDR);
+        err_code = pstorage_block_identifier_get(&m_base_handle, block_idx, &block_handle);
         APP_ERROR_CHECK(err_code);
         
-        if (!(~config[BD_CONFIG1_OFFSET] & BD_CONFIG1_USE_Msk)) break;       // Block is marked as non-used
+        data = (const uint8_t *)(uintptr_t) block_handle.block_id;    //< FLASH is memory mapped, recording goes on in the RAM pages
+        config = &data[BD_CONFIG_BASE_ADDR];
         
-        count = config[BD_CONFIG2_OFFSET];
+        if (!is_config_used(config))
+        {
+#if BD_RING_BUFFER
+            continue;                                                        // Erased block ahead of the write cursor
+#else
+            break;                                                           // Block is marked as non-used
+#endif
+        }
         
-        err_code = pstorage_load((uint8_t *)data, &block_handle, BD_DATA_NUM_PER_BLOCK * sizeof(__DATA_TYPE), 0);
-        APP_ERROR_CHECK(err_code);
+        count = uint16_decode(&config[BD_CONFIG2_OFFSET]);
         
+        block_decoder_init(&decoder, data, config);
         
+        
+#if BD_RING_BUFFER
+        printf("GROUP %u", uint32_decode(&config[BD_CONFIG_SEQ_OFFSET]));
+#else
         printf("GROUP %d", i);
+#endif
+        printf(" @%u%s #%02X %umV", uint32_decode(&config[BD_CONFIG_TIME_OFFSET]),
+               (config[BD_CONFIG_FORMAT_OFFSET] & BD_FORMAT_TIME_BOOT) ? "~" : "", config[BD_CONFIG_CHANNEL_OFFSET],
+               uint16_decode(&config[BD_CONFIG_BATTERY_OFFSET]));
         for (j=0; j<count; j++)
         {
-            printf(", %d", data[j]);
+            printf(", %d", block_decoder_next(&decoder));
         }
         printf("\r\n");
         
         app_sched_execute();
     }
+    uart_tx_wait_set(false);
 }
 
 /**@brief Return a bool value indicating whether data storage is full
@@ -221,7 +1035,11 @@ void back_data_transfer(void *p_event_data, uint16_t event_size)
  */
 bool is_data_full(void)
 {
+#if BD_RING_BUFFER
+    return false;
+#else
     return m_cur_block_idx == BD_BLOCK_COUNT;
+#endif
 }
 
 /**@brief Wait if there is any flash access pending
@@ -246,15 +1064,13 @@ void wait_flash_op(void)
 * Event Handlers
 *****************************************************************************/
 
-/**@brief Function for send instant data.
- * @details This function will be activated each time the data report timer's
- *          timeout event occurs.
+/**@brief Function for starting a sample.
+ * @details This function will be activated once per sampling period by the data report timer.
+ *          The sensor conversion is started, and read when the conversion timer expires. In
+ *          continuous mode, the last conversion is read at once.
  */
 void data_report_timeout_handler(void *p_context)
 {
-    
-    __DATA_TYPE *  data = (__DATA_TYPE *)ram_page[m_cur_page];       /**< Pointer for data segment. */
-
     UNUSED_PARAMETER(p_context);
 
     /**@note Use sd_temp_get(&temp) to obtain the core temperature if the softdevice is enabled.
@@ -265,35 +1081,66 @@ void data_report_timeout_handler(void *p_context)
     // err_code = sd_temp_get(&core_temp_val);
     // APP_ERROR_CHECK(err_code);
 
-    int8_t temp, temp_frac;
+    if (m_sample_continuous)
+    {
+        data_conversion_timeout_handler(NULL);
+        return;
+    }
+    
+    ds1624_start_temp_conversion();
+    timers_conversion_start(DS1621_CONVERSION_TIME_MS);    //< Sized by the slowest sensor
+}
 
-    switch (fsm_state)
+/**@brief Function for recording a sample and sending it as instant data.
+ * @details A sample holds a data point per channel found at init. A channel that failed to read
+ *          repeats its previous data point, so that the samples of a block keep their times.
+ *          The temperature register is kept whole (13 bits on a DS1624), and saved in the unit of
+ *          the data width. The lowest channel is sent as instant data, in 0.5 degC.
+ */
+static void sample_record(uint8_t read_mask, const ds1621_temp_t *p_temps)
+{
+    static int16_t  last_sample[DS1621_CHANNEL_MAX];    /**< Last reading recorded per channel (in 1/32 degC). */
+    __DATA_TYPE     sample[DS1621_CHANNEL_MAX];         /**< Data points of the channels, from the lowest channel # up. */
+    uint8_t         channel_mask = ds1621_channel_mask_get();
+    uint32_t        num = 0;
+    uint32_t        channel;
+    
+    for (channel = 0; channel < DS1621_CHANNEL_MAX; channel++)
     {
-        case 0:
-        {
-            ds1624_start_temp_conversion();
-            break;
-        }
-        case 1:
+        if (!(channel_mask & (1 << channel))) continue;
+        
+        if (read_mask & (1 << channel))
         {
-            ds1621_temp_read(&temp, &temp_frac);
-            ble_dts_update_handler((uint16_t) temp);
-            
-            if (temp_frac != 0) temp = (temp << 1) + 1; else temp = temp << 1;
-            
-            data[m_cur_data_idx] = (__DATA_TYPE) temp;      //< Save data
-            m_cur_data_idx ++;
-            
-            if (m_cur_data_idx == BD_DATA_NUM_PER_BLOCK) back_data_preserve(); //< Preserve data if one page is full;
-            
-            
-            break;
+            last_sample[channel] = (int16_t)(((uint8_t) p_temps[channel].temp << 8) | (uint8_t) p_temps[channel].temp_frac) >> 3;
         }
-        default:
-            break;
+        
+        if (m_data_width == BD_WIDTH_FINE) sample[num++] = last_sample[channel];
+        else sample[num++] = (int8_t)(last_sample[channel] >> 4);           //< Rounded down to 0.5 degC
+    }
+    
+    if (num == 0) return;                           //< No sensor
+    
+    if (sys_state != SYS_BLE_DATA_TRANSFER)         //< Not to interleave with the transfer
+    {
+        ble_dts_update_handler((int8_t)(m_data_width == BD_WIDTH_FINE ? sample[0] >> 4 : sample[0]));
+    }
+    
+    if (!page_sample_append(channel_mask, sample))  //< Save data
+    {
+        back_data_preserve();                       //< Preserve data if one page is full;
+        page_sample_append(channel_mask, sample);
     }
-    fsm_state = fsm_state ^ 0x1;
+}
 
+/**@brief Function for reading a sample.
+ * @details This function will be activated when the conversion timer expires. The sample is
+ *          recorded once the TWI transfers are done.
+ */
+void data_conversion_timeout_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    ds1621_temp_read(sample_record);
 }
 
 /**@brief Persistent Storage Error Reporting Callback
@@ -323,6 +1170,14 @@ static void pstorage_callback(pstorage_handle_t   *p_handle,
                               uint32_t             data_len)
 {
     /** @note sys_evt_dispatch --> pstorage_sys_event_handler --> pstorage_callback */
+    
+    const uint8_t * p_block = (const uint8_t *)(uintptr_t) p_handle->block_id;
+    
+    if ((op_code == PSTORAGE_STORE_OP_CODE || op_code == PSTORAGE_UPDATE_OP_CODE) && result == NRF_SUCCESS
+        && is_config_used(&p_block[BD_CONFIG_BASE_ADDR]))
+    {
+        m_stored_seq = uint32_decode(&p_block[BD_CONFIG_BASE_ADDR + BD_CONFIG_SEQ_OFFSET]) + 1;    //< The block can be read from FLASH
+    }
 }
 
 /*****************************************************************************
@@ -331,9 +1186,10 @@ static void pstorage_callback(pstorage_handle_t   *p_handle,
 
 /**@brief Initialize file (group data) transfer through BLE link 
  *
- * @details This function send the whole FLASH storage area in binary format through
- *          Bluetooth link. Nordic BLE UART service is used for the file transfer, and maximum 
- *          throughput is achieved.
+ * @details This function send all preserved blocks, from the oldest to the newest one, in binary
+ *          format through Bluetooth link. Nordic BLE UART service is used for the file transfer, and
+ *          maximum throughput is achieved. The block being recorded is the last block sent, as it is
+ *          when the transfer starts (see back_data_transfer_ble_range_init).
  * 
  * @note    Maximize BLE throughput
  *          https://devzone.nordicsemi.com/question/1741/dealing-large-data-packets-through-ble/
@@ -341,8 +1197,187 @@ static void pstorage_callback(pstorage_handle_t   *p_handle,
 void back_data_transfer_ble_init(void)
 {
     // Initialize data transfer
-    m_ble_data_idx = BD_BLOCK_SIZE;
+    back_data_transfer_ble_range_init(0, ~(0x0));
+}
+
+/**@brief Initialize the transfer of a range of blocks through BLE link.
+ *
+ * @details The range is clipped to the blocks in the storage when the transfer starts, from the
+ *          oldest one to the block being recorded. The block being recorded is sent as it is at
+ *          this time (sequence # back_data_next_seq_get()), and again with more data points by a
+ *          later transfer. Blocks preserved during the transfer are not sent.
+ *
+ * @param[in] first_seq Sequence # of the first block.
+ * @param[in] last_seq  Sequence # of the last block (included).
+ */
+void back_data_transfer_ble_range_init(uint32_t first_seq, uint32_t last_seq)
+{
+    uint32_t end_seq = (last_seq < m_next_seq) ? last_seq + 1 : m_next_seq;     //< Sequence # after the last block.
+    
+    first_seq = MAX(first_seq, oldest_seq());
+    
+    m_ble_data_idx = 0;
+    m_ble_frame.len = 0;
+    m_ble_frame_skip = 0;
+    m_ble_packet_seq = 0;
+    m_ble_stall_count = 0;
     m_ble_block_idx = ~(0x0);
+#if BD_BLE_PREFETCH
+    m_ble_next_ready = false;
+#endif
+    m_ble_first_seq = first_seq;
+    m_ble_block_num = (end_seq > first_seq) ? end_seq - first_seq : 0;
+    
+    // The block being recorded is sent last, as it is now: recording goes on during the transfer.
+    m_ble_tail_valid = (last_seq >= m_next_seq && first_seq <= m_next_seq && m_cur_data_idx != 0 && !is_data_full());
+    if (m_ble_tail_valid)
+    {
+        memcpy(m_ble_tail, ram_page[m_cur_page], BD_BLOCK_SIZE);
+        page_config_set(m_ble_tail);
+        m_ble_block_num ++;
+    }
+    
+    DEBUG_PF("Transfer SEQ %u, %u block(s)\r\n", first_seq, m_ble_block_num);
+}
+
+/**@brief Get the sequence # of the next block to be preserved.
+ *
+ * @retval Sequence # after the newest block.
+ */
+uint32_t back_data_next_seq_get(void)
+{
+    return m_next_seq;
+}
+
+/**@brief Set the sampling period.
+ *
+ * @details The block being recorded is preserved first, so that all samples of a block are taken
+ *          at the same period. Periods not longer than a conversion use the sensors in continuous
+ *          mode, longer ones start a conversion for each sample (unless DS1621_CONTINUOUS_MODE).
+ *          A conversion not read yet is dropped. Sensors that could not be switched are read in
+ *          the mode they were left in.
+ *
+ * @param[in] period_ms Sampling period (in ms).
+ *
+ * @retval NRF_SUCCESS, NRF_ERROR_INVALID_PARAM if out of SAMPLE_PERIOD_MIN_MS to SAMPLE_PERIOD_MAX_MS.
+ */
+uint32_t back_data_sample_period_set(uint32_t period_ms)
+{
+    bool continuous;
+    
+    if (period_ms < SAMPLE_PERIOD_MIN_MS || period_ms > SAMPLE_PERIOD_MAX_MS)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    
+    timers_conversion_stop();                       //< No sample at the previous timing in the next block
+    back_data_preserve();
+    
+    continuous = DS1621_CONTINUOUS_MODE || (period_ms <= DS1621_CONVERSION_TIME_MS);
+    if (!ds1621_mode_set(continuous))
+    {
+        continuous = !continuous;                   //< Sensors left in their previous mode
+    }
+    m_sample_continuous = continuous;
+    timers_sample_period_set(period_ms);
+    
+    DEBUG_PF("Sampling period: %u ms\r\n", period_ms);
+    
+    return NRF_SUCCESS;
+}
+
+/**@brief Set the data width of the blocks recorded from now on.
+ *
+ * @param[in] width Data width (BD_WIDTH_*).
+ *
+ * @retval NRF_SUCCESS, NRF_ERROR_INVALID_PARAM if not a BD_WIDTH_* value.
+ */
+uint32_t back_data_width_set(uint32_t width)
+{
+    if (width != BD_WIDTH_HALF && width != BD_WIDTH_FINE)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    
+    back_data_preserve();
+    m_data_width = width;
+    
+    DEBUG_PF("Data width: %u B\r\n", width);
+    
+    return NRF_SUCCESS;
+}
+
+/**@brief Get the number of frames fetched from the TX complete event of the current BLE transfer. */
+uint32_t back_data_ble_stall_count_get(void)
+{
+    return m_ble_stall_count;
+}
+
+/**@brief Get the number of packets filled since the start of the current BLE transfer. */
+uint16_t back_data_ble_packet_count_get(void)
+{
+    return m_ble_packet_seq;
+}
+
+/**@brief Initialize the transfer of the blocks from a given position through BLE link.
+ *
+ * @details Resume an interrupted transfer: the first frame is sent from the given offset on, then
+ *          all following blocks up to the newest one.
+ *
+ * @param[in] seq       Sequence # of the first block.
+ * @param[in] offset    Offset in the frame of the first block (in uint8_t).
+ */
+void back_data_transfer_ble_resume_init(uint32_t seq, uint32_t offset)
+{
+    back_data_transfer_ble_range_init(seq, ~(0x0));
+    
+    if (MAX(seq, oldest_seq()) == seq) m_ble_frame_skip = offset;   //< Unless the block has been dropped since.
+}
+
+/**@brief Find the block holding the data point of a given time.
+ *
+ * @details Blocks are preserved in time order, so the TIME field of the config info serves as an
+ *          index: the block is found by binary search in log2(BD_BLOCK_COUNT) config loads.
+ *
+ * @param[in] time  Time (in seconds, see timers_time_get).
+ *
+ * @retval Sequence # of the newest block started at or before time, or of the oldest block
+ *         if all blocks started after time.
+ */
+uint32_t back_data_seq_find(uint32_t time)
+{
+    uint8_t     config[BD_CONFIG_NUM_PER_BLOCK];    /**< Config info. */
+    uint32_t    first = oldest_seq();
+    uint32_t    lo = first;                         //< Blocks below lo started at or before time.
+    uint32_t    hi = m_next_seq;                    //< Blocks from hi on started after time.
+    uint32_t    mid;
+    
+    while (lo < hi)
+    {
+        mid = lo + ((hi - lo) >> 1);
+        
+        block_config_load(mid % BD_BLOCK_COUNT, config);
+        
+        if (uint32_decode(&config[BD_CONFIG_TIME_OFFSET]) <= time) lo = mid + 1; else hi = mid;
+    }
+    
+    return (lo > first) ? lo - 1 : first;
+}
+
+/**@brief Get the time of the newest block in FLASH.
+ *
+ * @retval Time of the first data point of the newest preserved block (see timers_time_get), 0 if
+ *         there is none.
+ */
+uint32_t back_data_newest_time_get(void)
+{
+    uint8_t     config[BD_CONFIG_NUM_PER_BLOCK];    /**< Config info. */
+    
+    if (m_next_seq == oldest_seq()) return 0;
+    
+    block_config_load((m_next_seq - 1) % BD_BLOCK_COUNT, config);
+    
+    return is_config_used(config) ? uint32_decode(&config[BD_CONFIG_TIME_OFFSET]) : 0;
 }
 
 /**@brief Initializing system function state.
@@ -350,9 +1385,10 @@ void back_data_transfer_ble_init(void)
 void back_data_init(void)
 {
     pstorage_module_param_t     storage_param;                      /**< pstorage parameter for data recording. */
-    pstorage_handle_t           block_handle;                       /**< Current block handle. */
-    uint8_t                     config[BD_CONFIG_NUM_PER_BLOCK];    /**< Config info. */
     uint32_t                    err_code;
+#if BD_RING_BUFFER
+    uint8_t                     config[BD_CONFIG_NUM_PER_BLOCK];    /**< Config info. */
+#endif
 
     storage_param.block_size = BD_BLOCK_SIZE;
     storage_param.block_count = BD_BLOCK_COUNT;
@@ -365,27 +1401,42 @@ void back_data_init(void)
     // Clear data cache
     m_cur_page = 0;
     m_cur_data_idx = 0;
+#if BD_DATA_FORMAT != BD_FORMAT_RAW
+    m_cur_bit_idx = 0;
+#endif
     memset(ram_page, __DATA_FILL, 2 * BD_BLOCK_SIZE);
     
     /* Find the first non-used block saved previously,
      and start saving data from the next non-used block. */
-    m_cur_block_idx = 0;
+#if BD_RING_BUFFER
+    block_config_load(0, config);
+    m_first_seq = is_config_used(config) ? uint32_decode(&config[BD_CONFIG_SEQ_OFFSET]) : 0;
+#endif
+    
+#if BD_INIT_BINARY_SEARCH
+    m_cur_block_idx = find_cursor_bsearch();
     
-    while (!is_data_full())
+    // Used blocks must form a prefix; otherwise (a block torn during an update) scan block by block.
+    if (m_cur_block_idx + 1 < BD_BLOCK_COUNT && is_block_written(m_cur_block_idx + 1))
+#endif
     {
-        err_code = pstorage_block_identifier_get(&m_base_handle, m_cur_block_idx, &block_handle);
-        APP_ERROR_CHECK(err_code);
-        
-        err_code = pstorage_load(config, &block_handle, BD_CONFIG_NUM_PER_BLOCK, BD_CONFIG_BASE_ADDR);
-        APP_ERROR_CHECK(err_code);   
-        
-        DEBUG_PF("Load Block %d, Config1 %x\r\n", m_cur_block_idx, config[BD_CONFIG1_OFFSET]);
-        
-        /** @note As clear operation set all FLASH bits to FF, reversed logic is used for config info bytes: 0 - set, 1 - unset. */ 
-        if (!(~config[BD_CONFIG1_OFFSET] & BD_CONFIG1_USE_Msk)) break;       // Block is marked as non-used 
-        
-        m_cur_block_idx ++ ;
+        m_cur_block_idx = find_cursor_linear();
     }
+    
+#if BD_RING_BUFFER
+    // The newest block is right before the cursor, across the wrap-around if the cursor is 0.
+    block_config_load((m_cur_block_idx + BD_BLOCK_COUNT - 1) % BD_BLOCK_COUNT, config);
+    m_next_seq = is_config_used(config) ? uint32_decode(&config[BD_CONFIG_SEQ_OFFSET]) + 1 : 0;
+    m_stored_seq = m_next_seq;
+    m_cur_block_idx %= BD_BLOCK_COUNT;
+    
+    DEBUG_PF("Write cursor at block %d, SEQ %u\r\n", m_cur_block_idx, m_next_seq);
+#else
+    m_next_seq = m_cur_block_idx;
+    m_stored_seq = m_next_seq;
+    
+    DEBUG_PF("Write cursor at block %d\r\n", m_cur_block_idx);
+#endif
 
 }
 
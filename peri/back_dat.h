@@ -21,25 +21,150 @@
   | BLOCK | BLOCK | ... | BLOCK | BLOCK |
   +-------------------------------------+
   |        \
-  +----------------------------------------------------------------+
-  | DATA | DATA | ... | DATA | CONFIG1 | CONFIG2 | ... | N/A | ... |
-  +----------------------------------------------------------------+
+  +---------------------------------------------------------------------------------------------------------------------+
+  | DATA | DATA | ... | DATA | CONFIG1 | FORMAT | CONFIG2 (x2) | SEQ (x4) | TIME (x4) | CHANNELS | WIDTH | BATTERY (x2) |
+  +---------------------------------------------------------------------------------------------------------------------+
 
 */
 
-#define __DATA_TYPE             uint8_t                                                 /**< Background recording data type. */
+#define __DATA_TYPE             int16_t                                                 /**< Background recording data type (in RAM, saved on the data width of its block). */
 #define __DATA_FILL             0xFF                                                    /**< Filling data for unused space. */
 
 #define BD_BLOCK_SIZE           128                                                     /**< Size of each pstorage FLASH block (in uint8_t). */
+#ifndef BD_BLOCK_COUNT
 #define BD_BLOCK_COUNT          256                                                     /**< Total No. of pstorage FLASH blocks (256 x 128 = 32K blocks). */
-#define BD_DATA_NUM_PER_BLOCK   120                                                     /**< Number of data points per block. */
-#define BD_DATA_END_ADDR        BD_DATA_NUM_PER_BLOCK * sizeof(__DATA_TYPE)             /**< End address of data segment in each block. */
-#define BD_CONFIG_BASE_ADDR     (BD_DATA_END_ADDR & 0x3) ? \
+#endif
+#define BD_CLEAR_BLOCK_COUNT    256                                                     /**< Blocks erased per pstorage_clear() (size is a 16-bit pstorage_size_t). */
+#define BD_DATA_END_ADDR        112                                                     /**< End address of data segment in each block (in uint8_t). */
+#define BD_CONFIG_BASE_ADDR     ((BD_DATA_END_ADDR & 0x3) ? \
                                 (((BD_DATA_END_ADDR >> 0x2) + 1) << 0x2) : \
-                                (BD_DATA_END_ADDR)                                      /**< Base address for CONFIG blocks (in uint8_t, aligned to Word). */
-#define BD_CONFIG_NUM_PER_BLOCK 4                                                       /**< Number of config info per block (a multiple of 4 bytes). */
+                                (BD_DATA_END_ADDR))                                     /**< Base address for CONFIG blocks (in uint8_t, aligned to Word). */
+#define BD_CONFIG_NUM_PER_BLOCK 16                                                      /**< Number of config info per block (a multiple of 4 bytes). */
 #define BD_CONFIG1_OFFSET       0x0                                                     /**< Offset address for CONFIG1 block. */
-#define BD_CONFIG2_OFFSET       0x1                                                     /**< Offset address for CONFIG2 block: number of data points. */
+#define BD_CONFIG_FORMAT_OFFSET 0x1                                                     /**< Offset address for the data format of the block (BD_FORMAT_*, and BD_FORMAT_TIME_BOOT). */
+#define BD_CONFIG2_OFFSET       0x2                                                     /**< Offset address for CONFIG2 block: number of data points (uint16_t). */
+#define BD_CONFIG_SEQ_OFFSET    0x4                                                     /**< Offset address for block sequence # (uint32_t, free-running, the block # is SEQ modulo BD_BLOCK_COUNT). */
+#define BD_CONFIG_TIME_OFFSET   0x8                                                     /**< Offset address for the time of the first data point (uint32_t, see timers_time_get). */
+#define BD_CONFIG_CHANNEL_OFFSET 0xC                                                    /**< Offset address for the channel mask of the block (bit # is the DS1621 channel #). */
+#define BD_CONFIG_WIDTH_OFFSET  0xD                                                     /**< Offset address for the data width of the block (BD_WIDTH_*). */
+#define BD_CONFIG_BATTERY_OFFSET 0xE                                                    /**< Offset address for the battery voltage of the block (uint16_t, in mV, 0xFFFF if unknown). */
+
+/** @note TIME is the time of the first data point of the block, the next ones follow at the sampling
+          period. Recording goes on in SYS_BLE_DATA_TRANSFER, so a block only ends when it is full (or
+          when the device is put to sleep). Before the host sets the time, TIME counts seconds since boot,
+          from the TIME of the newest block in FLASH: it never goes back across a reset, so the blocks
+          stay in time order for back_data_seq_find(). */
+
+/** @note BATTERY is the last battery voltage measured when the first data point of the block is
+          recorded, saved with TIME. It also starts the measurement read by the next block, so
+          the ADC runs once per block while BLE is off. */
+
+/** @note Channels: a sample is one data point per channel set in CHANNELS, from the lowest channel #
+          up, so the data points of the channels are interleaved and CONFIG2 is a multiple of the
+          number of channels. A block only holds whole samples, and is preserved when the channels
+          change. */
+
+/* Data widths of a block: the size of a data point (in uint8_t), which also sets its unit */
+#define BD_WIDTH_HALF           1                                                       /**< int8_t, in 0.5 degC (DS1621 resolution). */
+#define BD_WIDTH_FINE           2                                                       /**< int16_t, in 1/32 degC (DS1624 13-bit resolution). */
+
+#ifndef BD_DATA_WIDTH
+#define BD_DATA_WIDTH           BD_WIDTH_HALF                                           /**< Data width of newly recorded blocks, until one is set (see back_data_width_set). */
+#endif
+
+/** @note Data width: a DS1624 reading holds a 13-bit temperature, in 1/32 degC. A block of width
+          BD_WIDTH_FINE saves it whole, one of width BD_WIDTH_HALF saves it rounded down to 0.5 degC
+          (the DS1621 resolution). The width is selected at run time and applies from the next block on. */
+
+#define BD_FLASH_PAGE_SIZE      1024                                                    /**< nRF51 FLASH page size (in uint8_t). */
+#define BD_BLOCKS_PER_PAGE      (BD_FLASH_PAGE_SIZE / BD_BLOCK_SIZE)                    /**< Number of blocks sharing one FLASH page. */
+
+/** @note Log-structured storage: blocks are appended with pstorage_store() into flash that is already
+          erased, so a block costs BD_BLOCK_SIZE / 4 word writes and no erase. Pages are only erased
+          when they are reclaimed as a whole (back_data_clear_storage). A block that is not blank
+          (e.g. torn by a power loss before its used marker was written) falls back to pstorage_update(),
+          which rewrites its page through the swap page. Words are programmed in order, the used marker
+          after all data words but before SEQ, TIME, CHANNELS, WIDTH and BATTERY: a block only counts as
+          used once WIDTH, in the last word, is programmed too. Set to 0 to always use pstorage_update(). */
+#ifndef BD_LOG_STRUCTURED
+#define BD_LOG_STRUCTURED       1                                                       /**< Append blocks to pre-erased flash. */
+#endif
+
+/* Data formats of a block */
+#define BD_FORMAT_RAW           0x0                                                     /**< One data point per WIDTH bytes. */
+#define BD_FORMAT_DELTA         0x1                                                     /**< First data point, then a 2-bit code per data point (see BD_DELTA_*). */
+#define BD_FORMAT_RLE           0x2                                                     /**< (data point, repeat count) pairs (see BD_RLE_*). */
+#define BD_FORMAT_Msk           0x0F                                                    /**< Mask for the data format in FORMAT. */
+#define BD_FORMAT_TIME_BOOT     0x80                                                    /**< Flag of FORMAT: TIME is not on the host clock, which was not set since boot. */
+
+/** @note Time flag: until the host sets the clock after a reset, TIME goes on from the newest block
+          (see timers_init) and the time spent in reset or System OFF is not counted. Such blocks keep
+          their order but not their place on the host timeline, and are flagged BD_FORMAT_TIME_BOOT. */
+
+/** @note Delta format: consecutive readings of a channel mostly differ by 0 or +/-1 step, so each data
+          point after the first sample is coded on 2 bits against the previous data point of its channel,
+          MSB first. The data points of the first sample are saved as is, and an escape code is followed
+          by the data point itself on 8 x WIDTH bits. A one-channel block of width 1 holds up to
+          1 + (BD_DATA_END_ADDR * 8 - 8) / 2 data points, and is preserved as soon as the codes of the
+          next sample do not fit. */
+#define BD_DELTA_CODE_BITS      2                                                       /**< Size of a delta code (in bits). */
+#define BD_DELTA_ZERO           0x0                                                     /**< Same as the previous data point. */
+#define BD_DELTA_INC            0x1                                                     /**< Previous data point + 1. */
+#define BD_DELTA_DEC            0x2                                                     /**< Previous data point - 1. */
+#define BD_DELTA_ESC            0x3                                                     /**< Escape: the data point follows on 8 x WIDTH bits. */
+
+/** @note RLE format: flat stretches are saved as a data point followed by its number of consecutive
+          occurrences (1 to BD_RLE_RUN_MAX, longer runs take several pairs). A block holds
+          BD_DATA_END_ADDR / BD_RLE_PAIR_SIZE(WIDTH) pairs, i.e. up to 14280 data points, so the number of
+          data points in CONFIG2 is 16-bit wide. Runs follow the interleaved data points, so RLE only
+          pays off with a single channel. */
+#define BD_RLE_RUN_MAX          0xFF                                                    /**< Maximum repeat count of a pair. */
+#define BD_RLE_PAIR_SIZE(WIDTH) ((WIDTH) + 1)                                           /**< Size of a pair (in uint8_t). */
+
+#ifndef BD_DATA_FORMAT
+#define BD_DATA_FORMAT          BD_FORMAT_DELTA                                         /**< Format of newly recorded blocks. */
+#endif
+
+/** @note At boot, the write cursor is found by binary search over the used markers (blocks are filled
+          in order), falling back to a block-by-block scan if the used blocks do not form a prefix.
+          Set to 0 to always scan block by block. */
+#ifndef BD_INIT_BINARY_SEARCH
+#define BD_INIT_BINARY_SEARCH   1                                                       /**< Binary search for the write cursor at boot. */
+#endif
+
+/** @note Ring buffer: when the storage is full, recording wraps around to block 0 instead of stopping.
+          The FLASH page holding the oldest blocks is erased right before its first block is rewritten,
+          so BD_BLOCKS_PER_PAGE blocks are dropped at a time. Each block carries a sequence # (SEQ) that
+          increases by one per preserved block; a block only counts as used if SEQ has been written too.
+          At boot, blocks with a SEQ lower than that of block 0 belong to the previous pass, so the
+          write cursor is still the end of a prefix and the newest block is the one right before it. */
+#ifndef BD_RING_BUFFER
+#define BD_RING_BUFFER          0                                                       /**< Overwrite the oldest data when the storage is full. */
+#endif
+
+#ifndef BD_BLE_PREFETCH
+#define BD_BLE_PREFETCH         1                                                       /**< Fetch the next frame of a BLE transfer from the scheduler, ahead of the TX complete event that needs it. */
+#endif
+
+#if BD_RING_BUFFER && !BD_LOG_STRUCTURED
+#error "BD_RING_BUFFER requires BD_LOG_STRUCTURED."
+#endif
+
+#if BD_RING_BUFFER && (BD_BLOCK_COUNT % BD_BLOCKS_PER_PAGE)
+#error "BD_RING_BUFFER requires BD_BLOCK_COUNT to fill whole FLASH pages."
+#endif
+
+/** @note BLE transfer: each block is sent as a frame made of a header of BD_CONFIG_NUM_PER_BLOCK bytes
+          (the config info of the block, with CONFIG1 replaced by the number of data bytes that follow),
+          the used data bytes, and a CRC16 (crc16_compute, little-endian) of header and data. Frames are
+          split into packets of at most BLE_NUS_MAX_DATA_LEN bytes, each one starting with a packet
+          sequence # and the offset of its payload in the frame, so that lost packets are detected and
+          the block they belong to can be requested again. */
+#define BD_FRAME_CRC_SIZE       2                                                       /**< Size of the CRC16 closing a frame. */
+#define BD_FRAME_MAX_SIZE       (BD_CONFIG_NUM_PER_BLOCK + BD_DATA_END_ADDR + BD_FRAME_CRC_SIZE)    /**< Maximum size of a frame. */
+#define BD_PACKET_SEQ_OFFSET    0x0                                                     /**< Offset address for packet sequence # (uint16_t, from 0 at the start of each transfer). */
+#define BD_PACKET_FRAME_OFFSET  0x2                                                     /**< Offset address for the offset of the payload in its frame (uint8_t). */
+#define BD_PACKET_HEADER_SIZE   3                                                       /**< Size of the packet header. */
 
 /** @note As clear operation set all FLASH bits to FF, reversed logic is used for config info bytes: 0 - set, 1 - unset. */
 #define BD_CONFIG1_USE_Msk      0x1                                                     /**< Mask for "this block is used." */
@@ -52,12 +177,39 @@ enum
     SYS_BLE_DATA_TRANSFER       //< Data transfer mode
 };
 
-/**@brief Function for send instant data.
- * @details This function will be activated each time the data report timer's
- *          timeout event occurs.
+/**@brief Function for starting a sample.
+ * @details This function will be activated once per sampling period by the data report timer.
  */
 void data_report_timeout_handler(void *p_context);
 
+/**@brief Function for reading a sample.
+ * @details This function will be activated when the conversion timer expires. The sample is
+ *          recorded, and sent as instant data, once the TWI transfers are done.
+ */
+void data_conversion_timeout_handler(void *p_context);
+
+/**@brief Set the sampling period.
+ *
+ * @details The block being recorded is preserved first, so that all samples of a block are taken
+ *          at the same period.
+ *
+ * @param[in] period_ms Sampling period (in ms).
+ *
+ * @retval NRF_SUCCESS, NRF_ERROR_INVALID_PARAM if out of SAMPLE_PERIOD_MIN_MS to SAMPLE_PERIOD_MAX_MS.
+ */
+uint32_t back_data_sample_period_set(uint32_t period_ms);
+
+/**@brief Set the data width of the blocks recorded from now on.
+ *
+ * @details The block being recorded is preserved first, so that all data points of a block have
+ *          the same width.
+ *
+ * @param[in] width Data width (BD_WIDTH_*).
+ *
+ * @retval NRF_SUCCESS, NRF_ERROR_INVALID_PARAM if not a BD_WIDTH_* value.
+ */
+uint32_t back_data_width_set(uint32_t width);
+
 /**@brief Set system function state.
  */
 void set_sys_state( uint32_t state );
@@ -74,15 +226,60 @@ void back_data_init(void);
 
 /**@brief Initialize file (group data) transfer through BLE link 
  *
- * @details This function send the whole FLASH storage area in binary format through
- *          Bluetooth link. Nordic BLE UART service is used for the file transfer, and maximum 
- *          throughput is achieved.
+ * @details This function send all preserved blocks, from the oldest to the newest one, in binary
+ *          format through Bluetooth link. Nordic BLE UART service is used for the file transfer, and
+ *          maximum throughput is achieved. The block being recorded is the last block sent, as it is
+ *          when the transfer starts (see back_data_transfer_ble_range_init).
  * 
  * @note    Maximize BLE throughput
  *          https://devzone.nordicsemi.com/question/1741/dealing-large-data-packets-through-ble/
  */
 void back_data_transfer_ble_init(void);
 
+/**@brief Initialize the transfer of a range of blocks through BLE link.
+ *
+ * @details The range is clipped to the blocks in the storage when the transfer starts, from the
+ *          oldest one to the block being recorded. The block being recorded is sent as it is at
+ *          this time (sequence # back_data_next_seq_get()), and again with more data points by a
+ *          later transfer. Blocks preserved during the transfer are not sent.
+ *
+ * @param[in] first_seq Sequence # of the first block.
+ * @param[in] last_seq  Sequence # of the last block (included).
+ */
+void back_data_transfer_ble_range_init(uint32_t first_seq, uint32_t last_seq);
+
+/**@brief Initialize the transfer of the blocks from a given position through BLE link.
+ *
+ * @details Resume an interrupted transfer: the first frame is sent from the given offset on, then
+ *          all following blocks up to the newest one.
+ *
+ * @param[in] seq       Sequence # of the first block.
+ * @param[in] offset    Offset in the frame of the first block (in uint8_t).
+ */
+void back_data_transfer_ble_resume_init(uint32_t seq, uint32_t offset);
+
+/**@brief Get the sequence # of the next block to be preserved.
+ *
+ * @retval Sequence # after the newest block.
+ */
+uint32_t back_data_next_seq_get(void);
+
+/**@brief Find the block holding the data point of a given time.
+ *
+ * @param[in] time  Time (in seconds, see timers_time_get).
+ *
+ * @retval Sequence # of the newest block started at or before time, or of the oldest block
+ *         if all blocks started after time.
+ */
+uint32_t back_data_seq_find(uint32_t time);
+
+/**@brief Get the time of the newest block in FLASH.
+ *
+ * @retval Time of the first data point of the newest preserved block (see timers_time_get), 0 if
+ *         there is none.
+ */
+uint32_t back_data_newest_time_get(void);
+
 /**@brief Clear all saved data in FLASH
  */
 void back_data_clear_storage(void);
@@ -93,18 +290,29 @@ void back_data_preserve(void);
 
 /**@brief Prepare data to be sent through BLE UART service.
  *
- * @details This function fill the p_data array, which is transferred through BLE UART, with all
- *          data preserved in the FLASH. As in each transmission, only BLE_NUS_MAX_DATA_LEN bytes could
- *          be sent. All FLASH data will be reassigned into multiple BLE_NUS_MAX_DATA_LEN-byte segments.
+ * @details This function fill the p_data array, which is transferred through BLE UART, with the
+ *          next packet of the selected blocks. Each block is sent as a frame, split into packets of
+ *          at most BLE_NUS_MAX_DATA_LEN bytes (see BD_PACKET_*).
  *
  * @param[out] p_data   Pointer to a array of BLE_NUS_MAX_DATA_LEN bytes.
  * @param[out] length   Length of data in p_data. If length is equal to 0, all data has been processed.
- * 
- * @rtval TRUE  All data has been processed.
- *
  */
 void back_data_ble_nus_fill(uint8_t *p_data, uint8_t *length);
 
+/**@brief Get the number of frames fetched from the TX complete event of the current BLE transfer.
+ *
+ * @details Each one delays the notifications queued behind it by a decoding of the block and a
+ *          CRC16 computation. With BD_BLE_PREFETCH, only frames the prefetch did not fetch in time
+ *          are counted (the first frame of a transfer is not).
+ */
+uint32_t back_data_ble_stall_count_get(void);
+
+/**@brief Get the number of packets filled since the start of the current BLE transfer.
+ *
+ * @details The sequence # of the next packet. A resumed transfer counts from 0 again.
+ */
+uint16_t back_data_ble_packet_count_get(void);
+
 /**@brief Transfer preserved data through UART */
 void back_data_transfer(void *p_event_data, uint16_t event_size);
 
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "app_util.h"
+
+#include "bds_wire.h"
+
+
+/**@brief Get the length of a command from its opcode.
+ *
+ * @retval Length of the command, 0 if the opcode is unknown.
+ */
+static uint8_t cmd_length(uint8_t op)
+{
+    switch (op)
+    {
+        case BDS_OP_INSTANT:
+        case BDS_OP_TRANSFER:
+        case BDS_OP_SYNC:
+            return 1;
+        case BDS_OP_TIME_SET:
+        case BDS_OP_SINCE:
+        case BDS_OP_ACK:
+        case BDS_OP_PERIOD_SET:
+        case BDS_OP_WIDTH_SET:
+            return 1 + sizeof(uint32_t);
+        case BDS_OP_RESUME:
+            return 1 + sizeof(uint32_t) + sizeof(uint8_t);
+        case BDS_OP_RANGE:
+            return 1 + 2 * sizeof(uint32_t);
+        default:
+            return 0;
+    }
+}
+
+/**@brief Get the length of an event from its type.
+ *
+ * @retval Length of the event, 0 if the type is unknown.
+ */
+static uint8_t evt_length(uint8_t type)
+{
+    switch (type)
+    {
+        case BDS_EVT_START:
+            return 1;
+        case BDS_EVT_END:
+            return 1 + sizeof(uint16_t);
+        default:
+            return 0;
+    }
+}
+
+/**@brief Encode a command. */
+uint8_t bds_cmd_encode(const bds_cmd_t *p_cmd, uint8_t *p_data)
+{
+    uint8_t length = cmd_length(p_cmd->op);
+
+    if (length == 0) return 0;
+
+    p_data[0] = p_cmd->op;
+    if (length > 1)
+    {
+        uint32_encode(p_cmd->value, &p_data[1]);
+    }
+    if (p_cmd->op == BDS_OP_RANGE)
+    {
+        uint32_encode(p_cmd->value2, &p_data[5]);
+    }
+    else if (p_cmd->op == BDS_OP_RESUME)
+    {
+        p_data[5] = (uint8_t) p_cmd->value2;
+    }
+
+    return length;
+}
+
+/**@brief Decode a command. */
+bool bds_cmd_decode(const uint8_t *p_data, uint16_t length, bds_cmd_t *p_cmd)
+{
+    memset(p_cmd, 0, sizeof(*p_cmd));
+
+    if (length == 0 || cmd_length(p_data[0]) != length) return false;
+
+    p_cmd->op = p_data[0];
+    if (length > 1)
+    {
+        p_cmd->value = uint32_decode(&p_data[1]);
+    }
+    if (p_cmd->op == BDS_OP_RANGE)
+    {
+        p_cmd->value2 = uint32_decode(&p_data[5]);
+    }
+    else if (p_cmd->op == BDS_OP_RESUME)
+    {
+        p_cmd->value2 = p_data[5];
+    }
+
+    return true;
+}
+
+/**@brief Encode an event. */
+uint8_t bds_evt_encode(const bds_evt_t *p_evt, uint8_t *p_data)
+{
+    uint8_t length = evt_length(p_evt->type);
+
+    if (length == 0) return 0;
+
+    p_data[0] = p_evt->type;
+    if (p_evt->type == BDS_EVT_END)
+    {
+        uint16_encode(p_evt->packets, &p_data[1]);
+    }
+
+    return length;
+}
+
+/**@brief Decode an event. */
+bool bds_evt_decode(const uint8_t *p_data, uint16_t length, bds_evt_t *p_evt)
+{
+    memset(p_evt, 0, sizeof(*p_evt));
+
+    if (length == 0 || evt_length(p_data[0]) != length) return false;
+
+    p_evt->type = p_data[0];
+    if (p_evt->type == BDS_EVT_END)
+    {
+        p_evt->packets = uint16_decode(&p_data[1]);
+    }
+
+    return true;
+}
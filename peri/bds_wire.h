@@ -0,0 +1,107 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_bds_wire Bulk Data Service Wire Format
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Encoding of the control point of the Bulk Data Service (see ble_bds.h).
+ *
+ * The central writes commands to the control point: an opcode followed by its parameters,
+ * little-endian. The opcodes are the command characters of the Nordic UART Service, both
+ * services share one command handler. The peripheral notifies the start and the end of each
+ * transfer on the control point, the packets themselves (see BD_PACKET_* in back_dat.h) are
+ * notified on the data characteristic.
+ *
+ * Outside of transfers, samples are notified in batches on the instant characteristic: the time
+ * of the first sample (uint32_t) followed by the samples, in the format of the data segment of a
+ * raw block (half degrees Celsius, int8_t). The number of samples is given by the length.
+ *
+ * This file has no SoftDevice dependency, it is built into the host tools as well.
+ */
+
+#ifndef BDS_WIRE_H__
+#define BDS_WIRE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Commands (central to peripheral)
+#define BDS_OP_INSTANT          'I'                                                     /**< Report data instantly. */
+#define BDS_OP_TRANSFER         'T'                                                     /**< Transfer all blocks. */
+#define BDS_OP_SYNC             'Y'                                                     /**< Transfer the blocks not acknowledged yet. */
+#define BDS_OP_TIME_SET         'E'                                                     /**< Set time: Unix time (uint32_t). */
+#define BDS_OP_RANGE            'B'                                                     /**< Transfer a block range: first SEQ, last SEQ (uint32_t each). */
+#define BDS_OP_SINCE            'S'                                                     /**< Transfer the blocks since a time (uint32_t). */
+#define BDS_OP_RESUME           'R'                                                     /**< Resume a transfer: SEQ (uint32_t), offset in its frame (uint8_t). */
+#define BDS_OP_ACK              'A'                                                     /**< Acknowledge: SEQ of the last block received (uint32_t). */
+#define BDS_OP_PERIOD_SET       'P'                                                     /**< Set and save the sampling period: period in ms (uint32_t). */
+#define BDS_OP_WIDTH_SET        'W'                                                     /**< Set and save the data width of the next blocks: BD_WIDTH_* (uint32_t). */
+
+#define BDS_CMD_MAX_LEN         9                                                       /**< Length of the longest command ('B'). */
+
+// Events (peripheral to central)
+#define BDS_EVT_START           0x01                                                    /**< A transfer starts, its first packet has sequence # 0. */
+#define BDS_EVT_END             0x02                                                    /**< A transfer is done: number of packets sent (uint16_t). */
+
+#define BDS_EVT_MAX_LEN         3                                                       /**< Length of the longest event ('END'). */
+
+// Instant data batches (peripheral to central)
+#define BDS_INSTANT_TIME_OFFSET 0x0                                                     /**< Offset address for the time of the first sample (uint32_t). */
+#define BDS_INSTANT_DATA_OFFSET 0x4                                                     /**< Offset address for the samples (int8_t each). */
+#define BDS_INSTANT_MAX_SAMPLES (20 - BDS_INSTANT_DATA_OFFSET)                          /**< Samples in a full 20-byte notification. */
+
+/**@brief Command written to the control point. */
+typedef struct
+{
+    uint8_t                 op;                                                         /**< Opcode (BDS_OP_*). */
+    uint32_t                value;                                                      /**< Time ('E', 'S'), SEQ ('B' first, 'R', 'A'), period ('P'), width ('W'). */
+    uint32_t                value2;                                                     /**< Last SEQ ('B'), offset in the frame ('R'). */
+} bds_cmd_t;
+
+/**@brief Event notified on the control point. */
+typedef struct
+{
+    uint8_t                 type;                                                       /**< Event (BDS_EVT_*). */
+    uint16_t                packets;                                                    /**< Number of packets sent ('END'). */
+} bds_evt_t;
+
+/**@brief Encode a command.
+ *
+ * @param[in]  p_cmd    Command.
+ * @param[out] p_data   Buffer of at least BDS_CMD_MAX_LEN bytes.
+ *
+ * @retval Length of the command, 0 if the opcode is unknown.
+ */
+uint8_t bds_cmd_encode(const bds_cmd_t *p_cmd, uint8_t *p_data);
+
+/**@brief Decode a command.
+ *
+ * @param[in]  p_data   Command written by the central.
+ * @param[in]  length   Length of the command.
+ * @param[out] p_cmd    Command. Unused parameters are set to 0.
+ *
+ * @retval TRUE  The opcode is known and the length matches it.
+ */
+bool bds_cmd_decode(const uint8_t *p_data, uint16_t length, bds_cmd_t *p_cmd);
+
+/**@brief Encode an event.
+ *
+ * @param[in]  p_evt    Event.
+ * @param[out] p_data   Buffer of at least BDS_EVT_MAX_LEN bytes.
+ *
+ * @retval Length of the event, 0 if the type is unknown.
+ */
+uint8_t bds_evt_encode(const bds_evt_t *p_evt, uint8_t *p_data);
+
+/**@brief Decode an event.
+ *
+ * @param[in]  p_data   Event notified by the peripheral.
+ * @param[in]  length   Length of the event.
+ * @param[out] p_evt    Event.
+ *
+ * @retval TRUE  The type is known and the length matches it.
+ */
+bool bds_evt_decode(const uint8_t *p_data, uint16_t length, bds_evt_t *p_evt);
+
+#endif
+
+/** @} */
@@ -0,0 +1,309 @@
+#include <string.h>
+
+#include "nordic_common.h"
+#include "ble_srv_common.h"
+
+#include "ble_bds.h"
+#include "bds_wire.h"
+
+
+/**@brief Function for handling the Connect event.
+ *
+ * @param[in] p_bds         Bulk Data Service structure.
+ * @param[in] p_ble_evt     Event received from the BLE stack.
+ */
+static void on_connect(ble_bds_t * p_bds, ble_evt_t * p_ble_evt)
+{
+    p_bds->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+}
+
+/**@brief Function for handling the Disconnect event.
+ *
+ * @param[in] p_bds         Bulk Data Service structure.
+ * @param[in] p_ble_evt     Event received from the BLE stack.
+ */
+static void on_disconnect(ble_bds_t * p_bds, ble_evt_t * p_ble_evt)
+{
+    UNUSED_PARAMETER(p_ble_evt);
+
+    p_bds->conn_handle                     = BLE_CONN_HANDLE_INVALID;
+    p_bds->is_cp_notification_enabled      = false;
+    p_bds->is_data_notification_enabled    = false;
+    p_bds->is_instant_notification_enabled = false;
+}
+
+/**@brief Function for handling the Write event.
+ *
+ * @param[in] p_bds         Bulk Data Service structure.
+ * @param[in] p_ble_evt     Event received from the BLE stack.
+ */
+static void on_write(ble_bds_t * p_bds, ble_evt_t * p_ble_evt)
+{
+    ble_gatts_evt_write_t * p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+
+    if ((p_evt_write->handle == p_bds->cp_handles.cccd_handle) && (p_evt_write->len == 2))
+    {
+        p_bds->is_cp_notification_enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+    }
+    else if ((p_evt_write->handle == p_bds->data_handles.cccd_handle) && (p_evt_write->len == 2))
+    {
+        p_bds->is_data_notification_enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+    }
+    else if ((p_evt_write->handle == p_bds->instant_handles.cccd_handle) && (p_evt_write->len == 2))
+    {
+        p_bds->is_instant_notification_enabled = ble_srv_is_notification_enabled(p_evt_write->data);
+    }
+    else if ((p_evt_write->handle == p_bds->cp_handles.value_handle) && (p_bds->cp_handler != NULL))
+    {
+        p_bds->cp_handler(p_bds, p_evt_write->data, p_evt_write->len);
+    }
+}
+
+/**@brief Function for adding the control point characteristic.
+ *
+ * @param[in] p_bds     Bulk Data Service structure.
+ *
+ * @retval NRF_SUCCESS on success, otherwise an error code.
+ */
+static uint32_t cp_char_add(ble_bds_t * p_bds)
+{
+    ble_gatts_char_md_t char_md;
+    ble_gatts_attr_md_t cccd_md;
+    ble_gatts_attr_t    attr_char_value;
+    ble_uuid_t          ble_uuid;
+    ble_gatts_attr_md_t attr_md;
+    uint8_t             init_value = 0;
+
+    memset(&cccd_md, 0, sizeof(cccd_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+    cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+    memset(&char_md, 0, sizeof(char_md));
+
+    char_md.char_props.write         = 1;
+    char_md.char_props.write_wo_resp = 1;
+    char_md.char_props.notify        = 1;
+    char_md.p_char_user_desc         = NULL;
+    char_md.p_char_pf                = NULL;
+    char_md.p_user_desc_md           = NULL;
+    char_md.p_cccd_md                = &cccd_md;
+    char_md.p_sccd_md                = NULL;
+
+    ble_uuid.type = p_bds->uuid_type;
+    ble_uuid.uuid = BLE_UUID_BDS_CP_CHARACTERISTIC;
+
+    memset(&attr_md, 0, sizeof(attr_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.write_perm);
+    attr_md.vloc    = BLE_GATTS_VLOC_STACK;
+    attr_md.rd_auth = 0;
+    attr_md.wr_auth = 0;
+    attr_md.vlen    = 1;
+
+    memset(&attr_char_value, 0, sizeof(attr_char_value));
+
+    attr_char_value.p_uuid    = &ble_uuid;
+    attr_char_value.p_attr_md = &attr_md;
+    attr_char_value.init_len  = sizeof(init_value);
+    attr_char_value.init_offs = 0;
+    attr_char_value.max_len   = MAX(BDS_CMD_MAX_LEN, BDS_EVT_MAX_LEN);
+    attr_char_value.p_value   = &init_value;
+
+    return sd_ble_gatts_characteristic_add(p_bds->service_handle,
+                                           &char_md,
+                                           &attr_char_value,
+                                           &p_bds->cp_handles);
+}
+
+/**@brief Function for adding a notify-only characteristic (data or instant).
+ *
+ * @param[in]  p_bds        Bulk Data Service structure.
+ * @param[in]  uuid         16-bit UUID of the characteristic.
+ * @param[out] p_handles    Handles of the characteristic.
+ *
+ * @retval NRF_SUCCESS on success, otherwise an error code.
+ */
+static uint32_t notify_char_add(ble_bds_t * p_bds, uint16_t uuid, ble_gatts_char_handles_t * p_handles)
+{
+    ble_gatts_char_md_t char_md;
+    ble_gatts_attr_md_t cccd_md;
+    ble_gatts_attr_t    attr_char_value;
+    ble_uuid_t          ble_uuid;
+    ble_gatts_attr_md_t attr_md;
+    uint8_t             init_value = 0;
+
+    memset(&cccd_md, 0, sizeof(cccd_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+    cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+    memset(&char_md, 0, sizeof(char_md));
+
+    char_md.char_props.notify = 1;
+    char_md.p_char_user_desc  = NULL;
+    char_md.p_char_pf         = NULL;
+    char_md.p_user_desc_md    = NULL;
+    char_md.p_cccd_md         = &cccd_md;
+    char_md.p_sccd_md         = NULL;
+
+    ble_uuid.type = p_bds->uuid_type;
+    ble_uuid.uuid = uuid;
+
+    memset(&attr_md, 0, sizeof(attr_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+    attr_md.vloc    = BLE_GATTS_VLOC_STACK;
+    attr_md.rd_auth = 0;
+    attr_md.wr_auth = 0;
+    attr_md.vlen    = 1;
+
+    memset(&attr_char_value, 0, sizeof(attr_char_value));
+
+    attr_char_value.p_uuid    = &ble_uuid;
+    attr_char_value.p_attr_md = &attr_md;
+    attr_char_value.init_len  = sizeof(init_value);
+    attr_char_value.init_offs = 0;
+    attr_char_value.max_len   = BLE_BDS_MAX_DATA_LEN;
+    attr_char_value.p_value   = &init_value;
+
+    return sd_ble_gatts_characteristic_add(p_bds->service_handle,
+                                           &char_md,
+                                           &attr_char_value,
+                                           p_handles);
+}
+
+/**@brief Function for notifying a value.
+ *
+ * @param[in] p_bds     Bulk Data Service structure.
+ * @param[in] handle    Value handle of the characteristic.
+ * @param[in] p_data    Value.
+ * @param[in] length    Length of the value.
+ *
+ * @retval Error code of sd_ble_gatts_hvx().
+ */
+static uint32_t notify(ble_bds_t * p_bds, uint16_t handle, uint8_t * p_data, uint16_t length)
+{
+    ble_gatts_hvx_params_t hvx_params;
+
+    memset(&hvx_params, 0, sizeof(hvx_params));
+
+    hvx_params.handle = handle;
+    hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.offset = 0;
+    hvx_params.p_len  = &length;
+    hvx_params.p_data = p_data;
+
+    return sd_ble_gatts_hvx(p_bds->conn_handle, &hvx_params);
+}
+
+void ble_bds_on_ble_evt(ble_bds_t * p_bds, ble_evt_t * p_ble_evt)
+{
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            on_connect(p_bds, p_ble_evt);
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            on_disconnect(p_bds, p_ble_evt);
+            break;
+
+        case BLE_GATTS_EVT_WRITE:
+            on_write(p_bds, p_ble_evt);
+            break;
+
+        default:
+            break;
+    }
+}
+
+uint32_t ble_bds_init(ble_bds_t * p_bds, const ble_bds_init_t * p_bds_init)
+{
+    uint32_t        err_code;
+    ble_uuid_t      ble_uuid;
+    ble_uuid128_t   bds_base_uuid = {BDS_UUID_BASE};
+
+    memset(p_bds, 0, sizeof(*p_bds));
+
+    p_bds->conn_handle = BLE_CONN_HANDLE_INVALID;
+    p_bds->cp_handler  = p_bds_init->cp_handler;
+
+    // Add the vendor specific base UUID.
+    err_code = sd_ble_uuid_vs_add(&bds_base_uuid, &p_bds->uuid_type);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    ble_uuid.type = p_bds->uuid_type;
+    ble_uuid.uuid = BLE_UUID_BDS_SERVICE;
+
+    // Add the service.
+    err_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY,
+                                        &ble_uuid,
+                                        &p_bds->service_handle);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    // Add the characteristics.
+    err_code = cp_char_add(p_bds);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    err_code = notify_char_add(p_bds, BLE_UUID_BDS_DATA_CHARACTERISTIC, &p_bds->data_handles);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    return notify_char_add(p_bds, BLE_UUID_BDS_INSTANT_CHARACTERISTIC, &p_bds->instant_handles);
+}
+
+uint32_t ble_bds_cp_send(ble_bds_t * p_bds, uint8_t * p_data, uint16_t length)
+{
+    if ((p_bds->conn_handle == BLE_CONN_HANDLE_INVALID) || !p_bds->is_cp_notification_enabled)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    return notify(p_bds, p_bds->cp_handles.value_handle, p_data, length);
+}
+
+uint32_t ble_bds_data_send(ble_bds_t * p_bds, uint8_t * p_data, uint16_t length)
+{
+    if ((p_bds->conn_handle == BLE_CONN_HANDLE_INVALID) || !p_bds->is_data_notification_enabled)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    if (length > BLE_BDS_MAX_DATA_LEN)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    return notify(p_bds, p_bds->data_handles.value_handle, p_data, length);
+}
+
+uint32_t ble_bds_instant_send(ble_bds_t * p_bds, uint8_t * p_data, uint16_t length)
+{
+    if ((p_bds->conn_handle == BLE_CONN_HANDLE_INVALID) || !p_bds->is_instant_notification_enabled)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    if (length > BLE_BDS_MAX_DATA_LEN)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    return notify(p_bds, p_bds->instant_handles.value_handle, p_data, length);
+}
@@ -0,0 +1,120 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_bds Bulk Data Service
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Custom service for block transfers.
+ *
+ * The service has three characteristics:
+ * - Control point (write, write without response, notify): commands from the central and
+ *   transfer events from the peripheral (see bds_wire.h).
+ * - Data (notify): transfer packets (see BD_PACKET_* in back_dat.h), full 20-byte notifications
+ *   except at the end of a frame.
+ * - Instant (notify): batches of samples recorded outside of transfers (see bds_wire.h).
+ *
+ * It carries the same transfers as the Nordic UART Service, without its text indicators. The
+ * Nordic UART Service is kept for debugging.
+ */
+
+#ifndef BLE_BDS_H__
+#define BLE_BDS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ble.h"
+#include "ble_srv_common.h"
+
+#define BDS_UUID_BASE                   {0x3C, 0x1E, 0x7B, 0x52, 0x9A, 0x60, 0x4D, 0x8F, \
+                                         0xB1, 0x27, 0x0E, 0x94, 0x00, 0x00, 0x5B, 0xD4}   /**< 128-bit base UUID (D45B0000-940E-27B1-8F4D-609A527B1E3C), bytes 12 and 13 hold the 16-bit UUIDs below. */
+#define BLE_UUID_BDS_SERVICE            0x0001                                      /**< UUID of the Bulk Data Service. */
+#define BLE_UUID_BDS_CP_CHARACTERISTIC  0x0002                                      /**< UUID of the control point characteristic. */
+#define BLE_UUID_BDS_DATA_CHARACTERISTIC 0x0003                                     /**< UUID of the data characteristic. */
+#define BLE_UUID_BDS_INSTANT_CHARACTERISTIC 0x0004                                  /**< UUID of the instant characteristic. */
+
+#define BLE_BDS_MAX_DATA_LEN            (GATT_MTU_SIZE_DEFAULT - 3)                 /**< Maximum length of a notification. */
+
+// Forward declaration of the ble_bds_t type.
+typedef struct ble_bds_s ble_bds_t;
+
+/**@brief Control point write handler type.
+ *
+ * @param[in] p_bds     Bulk Data Service structure.
+ * @param[in] p_data    Data written to the control point.
+ * @param[in] length    Length of the data.
+ */
+typedef void (*ble_bds_cp_handler_t) (ble_bds_t * p_bds, uint8_t * p_data, uint16_t length);
+
+/**@brief Bulk Data Service init structure. */
+typedef struct
+{
+    ble_bds_cp_handler_t        cp_handler;                 /**< Handler of the commands written to the control point. */
+} ble_bds_init_t;
+
+/**@brief Bulk Data Service structure. */
+typedef struct ble_bds_s
+{
+    uint8_t                     uuid_type;                  /**< UUID type of the service base UUID. */
+    uint16_t                    service_handle;             /**< Handle of the service (as provided by the SoftDevice). */
+    ble_gatts_char_handles_t    cp_handles;                 /**< Handles of the control point characteristic. */
+    ble_gatts_char_handles_t    data_handles;               /**< Handles of the data characteristic. */
+    ble_gatts_char_handles_t    instant_handles;            /**< Handles of the instant characteristic. */
+    uint16_t                    conn_handle;                /**< Handle of the current connection, BLE_CONN_HANDLE_INVALID if not connected. */
+    bool                        is_cp_notification_enabled; /**< The central enabled notifications of the control point. */
+    bool                        is_data_notification_enabled;   /**< The central enabled notifications of the data characteristic. */
+    bool                        is_instant_notification_enabled;    /**< The central enabled notifications of the instant characteristic. */
+    ble_bds_cp_handler_t        cp_handler;                 /**< Handler of the commands written to the control point. */
+} ble_bds_t;
+
+/**@brief Function for initializing the Bulk Data Service.
+ *
+ * @param[out] p_bds        Bulk Data Service structure.
+ * @param[in]  p_bds_init   Information needed to initialize the service.
+ *
+ * @retval NRF_SUCCESS on successful initialization, otherwise an error code.
+ */
+uint32_t ble_bds_init(ble_bds_t * p_bds, const ble_bds_init_t * p_bds_init);
+
+/**@brief Function for handling the BLE stack events of the Bulk Data Service.
+ *
+ * @param[in] p_bds         Bulk Data Service structure.
+ * @param[in] p_ble_evt     Event received from the BLE stack.
+ */
+void ble_bds_on_ble_evt(ble_bds_t * p_bds, ble_evt_t * p_ble_evt);
+
+/**@brief Function for notifying an event on the control point.
+ *
+ * @param[in] p_bds     Bulk Data Service structure.
+ * @param[in] p_data    Event (see bds_wire.h).
+ * @param[in] length    Length of the event.
+ *
+ * @retval NRF_SUCCESS if queued, NRF_ERROR_INVALID_STATE if notifications are not enabled,
+ *         otherwise the error code of sd_ble_gatts_hvx().
+ */
+uint32_t ble_bds_cp_send(ble_bds_t * p_bds, uint8_t * p_data, uint16_t length);
+
+/**@brief Function for notifying a transfer packet on the data characteristic.
+ *
+ * @param[in] p_bds     Bulk Data Service structure.
+ * @param[in] p_data    Packet.
+ * @param[in] length    Length of the packet, at most BLE_BDS_MAX_DATA_LEN.
+ *
+ * @retval NRF_SUCCESS if queued, NRF_ERROR_INVALID_STATE if notifications are not enabled,
+ *         otherwise the error code of sd_ble_gatts_hvx().
+ */
+uint32_t ble_bds_data_send(ble_bds_t * p_bds, uint8_t * p_data, uint16_t length);
+
+/**@brief Function for notifying a batch of samples on the instant characteristic.
+ *
+ * @param[in] p_bds     Bulk Data Service structure.
+ * @param[in] p_data    Batch (see bds_wire.h).
+ * @param[in] length    Length of the batch, at most BLE_BDS_MAX_DATA_LEN.
+ *
+ * @retval NRF_SUCCESS if queued, NRF_ERROR_INVALID_STATE if notifications are not enabled,
+ *         otherwise the error code of sd_ble_gatts_hvx().
+ */
+uint32_t ble_bds_instant_send(ble_bds_t * p_bds, uint8_t * p_data, uint16_t length);
+
+#endif
+
+/** @} */
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <string.h>
 
 #include "nordic_common.h"
 #include "nrf51.h"
@@ -8,6 +9,7 @@
 #include "nrf_gpio.h"
 #include "nrf_delay.h"
 #include "app_util_platform.h"
+#include "app_util.h"
 
 #include "ble_gap.h"
 #include "ble_hci.h"
@@ -19,22 +21,50 @@
 #include "ble_nus.h"
 #include "softdevice_handler.h"
 
+#include "ble_bds.h"
+#include "bds_wire.h"
+
 #include "timers.h"
 #include "gpio.h"
 #include "bluetooth.h"
 #include "back_dat.h"
+#include "settings.h"
 #include "uart.h"
 
 
+/**@brief Sync mark of a bonded central. */
+typedef struct
+{
+    uint32_t    seq;                                                                /**< Sequence # of the first block not acknowledged by the central. */
+    uint32_t    generation;                                                         /**< Storage generation of seq (see settings_storage_generation_get). */
+} sync_mark_t;
+
+STATIC_ASSERT(sizeof(sync_mark_t) == DEVICE_MANAGER_APP_CONTEXT_SIZE);
+
 // Global Variables
 static volatile uint16_t                         m_conn_handle = BLE_CONN_HANDLE_INVALID;    /**< Handle of the current connection. */
 static volatile bool                             m_file_in_transit;                          /**< Indicator of file (group data) in transit. */
 static ble_bas_t                        m_bas;                                      /**< Structure used to identify the battery service. */
 static ble_hrs_t                        m_dts;                                      /**< Structure used to report data instantly. */
 static ble_nus_t                        m_nus;                                      /**< Structure to identify the Nordic UART Service. */
+static ble_bds_t                        m_bds;                                      /**< Structure to identify the Bulk Data Service. */
+static bool                             m_transfer_on_bds;                          /**< The current file transfer is sent through the Bulk Data Service (Nordic UART Service otherwise). */
 static dm_application_instance_t        m_app_handle;                               /**< Application identifier allocated by device manager. */
+static dm_handle_t                      m_peer_handle;                              /**< Device manager handle of the connected central. */
+static bool                             m_conn_params_pending;                      /**< Preferred parameters changed while disconnected, not known to the Connection Parameters module. */
+static sync_mark_t                      m_sync_mark;                                /**< Sync mark of the central (its application context). */
 static uint8_t                          m_data[BLE_NUS_MAX_DATA_LEN];               /**< Cached data to be transmitted. */
 static uint8_t                          m_data_length;                              /**< Cached data length. */
+static uint32_t                         m_tx_packet_count;                          /**< Packets sent in the current file transfer. */
+static uint32_t                         m_tx_event_count;                           /**< TX complete events (connection events with packets sent) in the current file transfer. */
+static uint8_t                          m_tx_packet_max;                            /**< Maximum packets sent in a connection event in the current file transfer. */
+static uint32_t                         m_tx_start_ticks;                           /**< RTC1 counter at the start of the current file transfer. */
+static uint8_t                          m_instant[BLE_BDS_MAX_DATA_LEN];            /**< Instant data batch being filled (see bds_wire.h). */
+static uint8_t                          m_instant_count;                            /**< Samples in the instant data batch. */
+
+#if BLE_INSTANT_BATCH_SIZE < 1 || BLE_INSTANT_BATCH_SIZE > BDS_INSTANT_MAX_SAMPLES
+#error "BLE_INSTANT_BATCH_SIZE must be 1 to BDS_INSTANT_MAX_SAMPLES."
+#endif
 
 
 /*****************************************************************************
@@ -60,61 +90,283 @@ void system_off_mode(void)
     nrf_gpio_pin_clear(ADVERTISING_LED_PIN_NO);
     nrf_gpio_pin_clear(CONNECTED_LED_PIN_NO);
 
+    uart_flush();
+
     err_code = sd_power_system_off();
     APP_ERROR_CHECK(err_code);
 
 }
 
+/**@brief Function for sending the instant data batch, even if it is not full.
+ */
+static void instant_flush(void)
+{
+    uint32_t err_code;
+    
+    if (m_instant_count == 0) return;
+    
+    // Update data through BLE HRS, in degrees Celsius
+    ble_hrs_heart_rate_measurement_send(&m_dts, (uint16_t)((int8_t) m_instant[BDS_INSTANT_DATA_OFFSET + m_instant_count - 1] >> 1));
+    
+    // Update data through the Bulk Data Service
+    err_code = ble_bds_instant_send(&m_bds, m_instant, BDS_INSTANT_DATA_OFFSET + m_instant_count);
+    
+    if (
+        (err_code != NRF_SUCCESS)
+        &&
+        (err_code != NRF_ERROR_INVALID_STATE)
+        &&
+        (err_code != BLE_ERROR_NO_TX_BUFFERS)
+        &&
+        (err_code != BLE_ERROR_GATTS_SYS_ATTR_MISSING)
+    )
+    {
+        APP_ERROR_HANDLER(err_code);
+    }
+    
+    m_instant_count = 0;
+}
+
 /**@brief Function for updating instant data.
  *
- * @details This function sends instant data through Heart Rate Service.
+ * @details This function adds a sample to the batch notified on the Bulk Data Service instant
+ *          characteristic. A full batch is sent along with its last sample through the Heart Rate Service,
+ *          and so is a batch whose first sample would wait longer than BLE_INSTANT_MAX_DELAY_MS for
+ *          the next sample (a batch of one sample at periods over BLE_INSTANT_MAX_DELAY_MS).
  */
-void ble_dts_update_handler(uint16_t data)
+void ble_dts_update_handler(int8_t sample)
 {
-    // Update data through BLE HRS
-    ble_hrs_heart_rate_measurement_send(&m_dts, data);
-
-    char str[21];
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID) return;
+    
+    if (m_instant_count == 0)
+    {
+        uint32_encode(timers_time_get(), &m_instant[BDS_INSTANT_TIME_OFFSET]);
+    }
+    m_instant[BDS_INSTANT_DATA_OFFSET + m_instant_count] = (uint8_t) sample;
+    m_instant_count ++;
+    
+    if (m_instant_count >= BLE_INSTANT_BATCH_SIZE
+        || (uint64_t) m_instant_count * timers_sample_period_get() > BLE_INSTANT_MAX_DELAY_MS)
+    {
+        instant_flush();
+    }
+}
 
-    // Update data through BLE UART
-    sprintf(str, "DATA=%d", data);
-    ble_nus_send_string( &m_nus, (uint8_t *)str, strlen(str) );
+/**@brief    Function for entering the file transfer mode (recording goes on, instant data is not sent).
+ */
+static void file_transfer_prepare(void)
+{
+    instant_flush();                            //< Not to time the batch across the transfer
+    set_sys_state(SYS_BLE_DATA_TRANSFER);
+}
 
+/**@brief    Function for notifying a transfer event on the Bulk Data Service control point.
+ *
+ * @param[in] type  Event (BDS_EVT_*).
+ */
+static void transfer_evt_send(uint8_t type)
+{
+    uint32_t    err_code;
+    bds_evt_t   evt;
+    uint8_t     data[BDS_EVT_MAX_LEN];
+    uint8_t     length;
+    
+    evt.type    = type;
+    evt.packets = back_data_ble_packet_count_get();
+    length      = bds_evt_encode(&evt, data);
+    
+    err_code = ble_bds_cp_send(&m_bds, data, length);
+    
+    if (
+        (err_code != NRF_SUCCESS)
+        &&
+        (err_code != NRF_ERROR_INVALID_STATE)
+        &&
+        (err_code != BLE_ERROR_NO_TX_BUFFERS)
+        &&
+        (err_code != BLE_ERROR_GATTS_SYS_ATTR_MISSING)
+    )
+    {
+        APP_ERROR_HANDLER(err_code);
+    }
 }
 
-/**@brief    Function for handling the data from the Nordic UART Service.
+/**@brief    Function for starting a file transfer initialized through back_data_transfer_ble_init()
+ *           or back_data_transfer_ble_range_init().
+ *
+ * @param[in] on_bds    Send the transfer through the Bulk Data Service, through the Nordic UART
+ *                      Service otherwise.
  */
-static void nus_data_handler(ble_nus_t *p_nus, uint8_t *p_data, uint16_t length)
+static void file_transfer_start(bool on_bds)
 {
     uint32_t err_code;
     
-    if (length==1) //< Control Command
+    instant_flush();                                    //< Samples of the batch are not reported after the transfer
+    
+    m_file_in_transit = true;
+    m_tx_packet_count = 0;
+    m_tx_event_count  = 0;
+    m_tx_packet_max   = 0;
+    
+    err_code = app_timer_cnt_get(&m_tx_start_ticks);
+    APP_ERROR_CHECK(err_code);
+
+    m_transfer_on_bds = on_bds;
+    
+    if (m_transfer_on_bds)
     {
-        switch(p_data[0])
-        {
-            case 'I':
-                set_sys_state(SYS_BLE_DATA_INSTANT);
-                break;
-            case 'T':
-                set_sys_state(SYS_BLE_DATA_TRANSFER);
-                nrf_delay_ms(MAX_CONN_INTERVAL * 2);    //< Wait until all BLE operation is done.
-            
-                back_data_transfer_ble_init();          //< Initialize a file transfer
-                m_file_in_transit = true;
-            
-                back_data_ble_nus_fill(m_data, &m_data_length); //< Cache the first data segment to be sent
+        transfer_evt_send(BDS_EVT_START);               //< Start indicator on the control point
+        back_data_ble_nus_fill(m_data, &m_data_length); //< First packet
+    }
+    else
+    {
+        memcpy(m_data, "**START**", 9);                 //< Start indicator, queued behind instant data still in the TX buffers
+        m_data_length = 9;
+    }
+    
+    ble_data_transfer();
+}
 
-                err_code = ble_nus_send_string(&m_nus, (uint8_t *) "**START**", 9);     //< Start indicator
-                APP_ERROR_CHECK(err_code);
+/**@brief    Function for loading the sync mark of the connected central.
+ *
+ * @details  The sync mark is kept by the device manager as the application context of a bonded
+ *           central. It is restarted from the oldest block if the central is not bonded, has never
+ *           acknowledged any block, or if the storage has been cleared since (the storage generation
+ *           differs).
+ *
+ * @retval   Sequence # of the first block not acknowledged by the central.
+ */
+static uint32_t sync_mark_load(void)
+{
+    uint32_t                    err_code;
+    dm_application_context_t    context;
+    
+    context.len    = sizeof(m_sync_mark);
+    context.p_data = (uint8_t *) &m_sync_mark;
+    
+    err_code = dm_application_context_get(&m_peer_handle, &context);
+    
+    if (err_code != NRF_SUCCESS || m_sync_mark.generation != settings_storage_generation_get()
+        || m_sync_mark.seq > back_data_next_seq_get())
+    {
+        m_sync_mark.seq = 0;
+    }
+    
+    return m_sync_mark.seq;
+}
 
-                break;
-        }
+/**@brief    Function for saving the sync mark of the connected central.
+ *
+ * @note     The device manager saves the context in FLASH from m_sync_mark, which must not be
+ *           modified until the operation is done. Nothing is saved for a central that is not bonded.
+ *
+ * @param[in] seq   Sequence # of the last block acknowledged by the central.
+ */
+static void sync_mark_store(uint32_t seq)
+{
+    uint32_t                    err_code;
+    dm_application_context_t    context;
+    
+    if (back_data_next_seq_get() == 0) return;     //< Nothing preserved yet.
+    
+    m_sync_mark.seq        = MIN(seq + 1, back_data_next_seq_get());    //< The block being recorded is sent again by the next sync
+    m_sync_mark.generation = settings_storage_generation_get();
+    
+    context.flags  = 0;
+    context.len    = sizeof(m_sync_mark);
+    context.p_data = (uint8_t *) &m_sync_mark;
+    
+    err_code = dm_application_context_set(&m_peer_handle, &context);
+    
+    if (err_code != NRF_SUCCESS)
+    {
+        DEBUG_PF("Sync mark not saved: 0x%x\r\n", err_code);
     }
 }
 
+/**@brief    Function for handling a command from the central (see bds_wire.h).
+ *
+ * @param[in] on_bds    The command was written to the Bulk Data Service control point, the transfer
+ *                      it starts is sent through this service (through the Nordic UART Service otherwise).
+ * @param[in] p_data    Command.
+ * @param[in] length    Length of the command.
+ */
+static void command_handler(bool on_bds, uint8_t *p_data, uint16_t length)
+{
+    bds_cmd_t cmd;
+    
+    if (!bds_cmd_decode(p_data, length, &cmd)) return;
+    
+    switch (cmd.op)
+    {
+        case BDS_OP_INSTANT:
+            set_sys_state(SYS_BLE_DATA_INSTANT);
+            break;
+        case BDS_OP_TRANSFER:
+            file_transfer_prepare();
+            back_data_transfer_ble_init();              //< Initialize a file transfer
+            file_transfer_start(on_bds);
+            break;
+        case BDS_OP_SYNC:                               //< Sync: blocks not acknowledged by this central yet
+            file_transfer_prepare();
+            back_data_transfer_ble_range_init(sync_mark_load(), ~(0x0));
+            file_transfer_start(on_bds);
+            break;
+        case BDS_OP_TIME_SET:
+            instant_flush();                            //< Samples of the batch are timed on the previous clock
+            timers_time_set(cmd.value);
+            break;
+        case BDS_OP_RANGE:
+            file_transfer_prepare();
+            back_data_transfer_ble_range_init(cmd.value, cmd.value2);
+            file_transfer_start(on_bds);
+            break;
+        case BDS_OP_SINCE:                              //< Up to the newest block
+            file_transfer_prepare();
+            back_data_transfer_ble_range_init(back_data_seq_find(cmd.value), ~(0x0));
+            file_transfer_start(on_bds);
+            break;
+        case BDS_OP_RESUME:                             //< Up to the newest block
+            file_transfer_prepare();
+            back_data_transfer_ble_resume_init(cmd.value, cmd.value2);
+            file_transfer_start(on_bds);
+            break;
+        case BDS_OP_ACK:
+            sync_mark_store(cmd.value);
+            break;
+        case BDS_OP_PERIOD_SET:
+            instant_flush();                            //< Samples of the batch are timed on the previous period
+            if (back_data_sample_period_set(cmd.value) == NRF_SUCCESS)
+            {
+                settings_sample_period_set(cmd.value);  //< Kept across resets
+            }
+            break;
+        case BDS_OP_WIDTH_SET:
+            if (back_data_width_set(cmd.value) == NRF_SUCCESS)
+            {
+                settings_data_width_set(cmd.value);     //< Kept across resets
+            }
+            break;
+    }
+}
+
+/**@brief    Function for handling the data from the Nordic UART Service.
+ */
+static void nus_data_handler(ble_nus_t *p_nus, uint8_t *p_data, uint16_t length)
+{
+    command_handler(false, p_data, length);
+}
+
+/**@brief    Function for handling the commands written to the Bulk Data Service control point.
+ */
+static void bds_cp_handler(ble_bds_t *p_bds, uint8_t *p_data, uint16_t length)
+{
+    command_handler(true, p_data, length);
+}
+
 /**@brief Function for updating battery level.
  *
- * @details This function is called in ADC_IRQHandler to update current battery level.
+ * @details This function is scheduled by ADC_IRQHandler when the battery level changes.
  */
 void ble_bas_battery_level_update_handler(uint8_t percentage_batt_lvl)
 {
@@ -145,6 +397,12 @@ static uint32_t device_manager_evt_handler(dm_handle_t const     *p_handle,
         api_result_t           event_result)
 {
     APP_ERROR_CHECK(event_result);
+    
+    if (p_event->event_id == DM_EVT_CONNECTION)
+    {
+        m_peer_handle = (*p_handle);        //< Identify the central for its sync mark.
+    }
+    
     return NRF_SUCCESS;
 }
 
@@ -165,6 +423,11 @@ static void on_ble_evt(ble_evt_t *p_ble_evt)
 
             m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
 
+            if (m_conn_params_pending)
+            {
+                conn_params_mode_set(get_sys_state());      //< The module negotiates the preferred parameters of the system state
+            }
+
             ble_timers_start(); // Start service-related timers
 
             break;
@@ -178,11 +441,22 @@ static void on_ble_evt(ble_evt_t *p_ble_evt)
             /** @note: Remember to clear connection handle.
                         Otherwise, the chip cannot be waken up after entering sleep mode!*/
             m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            m_instant_count = 0;
             set_sys_state(SYS_DATA_RECORDING);
 
             //advertising_start();
             break;
 
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        {
+            ble_gap_conn_params_t * p_params = &p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+            
+            DEBUG_PF("Conn params: %u-%u x1.25ms, latency %u, timeout %u x10ms\r\n",
+                     p_params->min_conn_interval, p_params->max_conn_interval,
+                     p_params->slave_latency, p_params->conn_sup_timeout);
+            break;
+        }
+
         case BLE_GAP_EVT_TIMEOUT:
             if (p_ble_evt->evt.gap_evt.params.timeout.src == BLE_GAP_TIMEOUT_SRC_ADVERTISEMENT)
             {
@@ -201,7 +475,16 @@ static void on_ble_evt(ble_evt_t *p_ble_evt)
             break;
             
         case BLE_EVT_TX_COMPLETE:
-            if (m_file_in_transit) ble_nus_data_transfer();
+            if (m_file_in_transit)
+            {
+                uint8_t count = p_ble_evt->evt.common_evt.params.tx_complete.count;     //< Packets sent in the connection event
+                
+                m_tx_packet_count += count;
+                m_tx_event_count ++;
+                m_tx_packet_max = MAX(m_tx_packet_max, count);
+                
+                ble_data_transfer();
+            }
             break;
 
         default:
@@ -214,9 +497,8 @@ static void on_ble_evt(ble_evt_t *p_ble_evt)
  *
  * @details This function will be called for all events in the Connection Parameters Module which
  *          are passed to the application.
- *          @note All this function does is to disconnect. This could have been done by simply
- *                setting the disconnect_on_fail config parameter, but instead we use the event
- *                handler mechanism to demonstrate its use.
+ *          @note A central refusing the file transfer parameters is kept: the transfer is only
+ *                slower. A central refusing the instant mode parameters is disconnected.
  *
  * @param[in]   p_evt   Event received from the Connection Parameters Module.
  */
@@ -224,10 +506,19 @@ static void on_conn_params_evt(ble_conn_params_evt_t *p_evt)
 {
     uint32_t err_code;
 
-    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_SUCCEEDED)
     {
-        err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
-        APP_ERROR_CHECK(err_code);
+        DEBUG_PF("Conn params accepted.\r\n");
+    }
+    else if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+    {
+        DEBUG_PF("Conn params refused.\r\n");
+        
+        if (get_sys_state() != SYS_BLE_DATA_TRANSFER)
+        {
+            err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
+            APP_ERROR_CHECK(err_code);
+        }
     }
 }
 
@@ -254,6 +545,7 @@ static void ble_evt_dispatch(ble_evt_t *p_ble_evt)
     ble_bas_on_ble_evt(&m_bas, p_ble_evt);
     ble_hrs_on_ble_evt(&m_dts, p_ble_evt);
     ble_nus_on_ble_evt(&m_nus, p_ble_evt);
+    ble_bds_on_ble_evt(&m_bds, p_ble_evt);
     ble_conn_params_on_ble_evt(p_ble_evt);
     on_ble_evt(p_ble_evt);
 
@@ -355,14 +647,14 @@ void advertising_init(void)
     1. Battery service for monitoring battery usage
     2. Pseudo heart rate service for real-time data report
     3. Device information service for general report
-    4. UART service for group data transfer
+    4. Bulk data service for group data transfer (the UART service is not advertised)
     */
     ble_uuid_t adv_uuids[] =
     {
         {BLE_UUID_BATTERY_SERVICE,                  BLE_UUID_TYPE_BLE},
         {BLE_UUID_HEART_RATE_SERVICE,               BLE_UUID_TYPE_BLE},
         {BLE_UUID_DEVICE_INFORMATION_SERVICE,       BLE_UUID_TYPE_BLE},
-        {BLE_UUID_NUS_SERVICE,                      m_nus.uuid_type}
+        {BLE_UUID_BDS_SERVICE,                      m_bds.uuid_type}
     }; // Too long to fit all in advdata
 
     // Build and set advertising data
@@ -395,7 +687,7 @@ void conn_params_init(void)
     cp_init.next_conn_params_update_delay  = NEXT_CONN_PARAMS_UPDATE_DELAY;
     cp_init.max_conn_params_update_count   = MAX_CONN_PARAMS_UPDATE_COUNT;
     cp_init.start_on_notify_cccd_handle    = m_dts.hrm_handles.cccd_handle; //BLE_GATT_HANDLE_INVALID;
-    cp_init.disconnect_on_fail             = true;
+    cp_init.disconnect_on_fail             = false;    //< See on_conn_params_evt()
     cp_init.evt_handler                    = on_conn_params_evt;
     cp_init.error_handler                  = conn_params_error_handler;
 
@@ -403,13 +695,65 @@ void conn_params_init(void)
     APP_ERROR_CHECK(err_code);
 }
 
+/**@brief Function for requesting the connection parameters suited to a system state.
+ *
+ * @details Short intervals without slave latency in SYS_BLE_DATA_TRANSFER, long intervals otherwise.
+ *          Takes effect on the current connection. While disconnected, only the preferred
+ *          parameters (PPCP) are set, and negotiated once the next connection is up.
+ *
+ * @param[in] state System state (see set_sys_state).
+ */
+void conn_params_mode_set(uint32_t state)
+{
+    uint32_t                err_code;
+    ble_gap_conn_params_t   conn_params;
+    
+    memset(&conn_params, 0, sizeof(conn_params));
+    
+    if (state == SYS_BLE_DATA_TRANSFER)
+    {
+        conn_params.min_conn_interval = TRANSFER_MIN_CONN_INTERVAL;
+        conn_params.max_conn_interval = TRANSFER_MAX_CONN_INTERVAL;
+        conn_params.slave_latency     = TRANSFER_SLAVE_LATENCY;
+        conn_params.conn_sup_timeout  = TRANSFER_CONN_SUP_TIMEOUT;
+    }
+    else
+    {
+        conn_params.min_conn_interval = MIN_CONN_INTERVAL;
+        conn_params.max_conn_interval = MAX_CONN_INTERVAL;
+        conn_params.slave_latency     = SLAVE_LATENCY;
+        conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
+    }
+    
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        /** @note ble_conn_params_change_conn_params() would request an update on the invalid
+         *        connection handle: only set the preferred parameters (PPCP) of the next connection. */
+        err_code = sd_ble_gap_ppcp_set(&conn_params);
+        APP_ERROR_CHECK(err_code);
+        
+        m_conn_params_pending = true;
+        return;
+    }
+    
+    m_conn_params_pending = false;
+    
+    err_code = ble_conn_params_change_conn_params(&conn_params);     //< Also sets the preferred parameters (PPCP)
+    if ((err_code == NRF_ERROR_INVALID_STATE) || (err_code == BLE_ERROR_INVALID_CONN_HANDLE))
+    {
+        err_code = NRF_SUCCESS;     //< Disconnected meanwhile: the PPCP is set for the next connection
+    }
+    APP_ERROR_CHECK(err_code);
+}
+
 /**@brief Function for initializing the services that will be used by the application.
  *
- * @details Initialize the Heart Rate, Battery and Device Information services.
+ * @details Initialize the Heart Rate, Battery, Device Information, Nordic UART and Bulk Data services.
  */
 void services_init(void)
 {
     uint32_t       err_code;
+    ble_bds_init_t bds_init;
     ble_hrs_init_t dts_init;
     ble_bas_init_t bas_init;
     ble_dis_init_t dis_init;
@@ -472,6 +816,14 @@ void services_init(void)
     err_code = ble_nus_init(&m_nus, &nus_init);
     APP_ERROR_CHECK(err_code);
 
+    // Initialize Bulk Data Service
+    memset(&bds_init, 0, sizeof(bds_init));
+
+    bds_init.cp_handler = bds_cp_handler;
+
+    err_code = ble_bds_init(&m_bds, &bds_init);
+    APP_ERROR_CHECK(err_code);
+
 }
 
 /**@brief Function for the Device Manager initialization.
@@ -549,6 +901,7 @@ void ble_connection_disconnect(void)
     uint32_t err_code;
     if (m_conn_handle != BLE_CONN_HANDLE_INVALID)
     {
+        instant_flush();                    //< Last samples, queued ahead of the disconnection
         err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
         APP_ERROR_CHECK(err_code);
         m_conn_handle = BLE_CONN_HANDLE_INVALID;
@@ -561,16 +914,36 @@ void ble_connection_disconnect(void)
     
 }
 
-/**@brief Send data through BLE UART service with maximum throughput. */
-void ble_nus_data_transfer(void)
+/**@brief Send file transfer data through the BLE UART or Bulk Data service with maximum throughput. */
+void ble_data_transfer(void)
 {
     uint32_t        err_code;
+    uint32_t        ticks;
     
     if (m_data_length == 0)    //< All data is sent.
     {
         m_file_in_transit = false;
-        err_code = ble_nus_send_string(&m_nus, (uint8_t *) "**END**", 7);     //< End indicator
+        
+        if (m_transfer_on_bds)
+        {
+            transfer_evt_send(BDS_EVT_END);                                 //< End indicator with the number of packets sent
+        }
+        else
+        {
+            err_code = ble_nus_send_string(&m_nus, (uint8_t *) "**END**", 7);     //< End indicator
+            APP_ERROR_CHECK(err_code);
+        }
+        
+        err_code = app_timer_cnt_get(&ticks);
+        APP_ERROR_CHECK(err_code);
+        err_code = app_timer_cnt_diff_compute(ticks, m_tx_start_ticks, &ticks);
         APP_ERROR_CHECK(err_code);
+        
+        DEBUG_PF("TX: %u packets in %u events (max %u per event), %u stalls, %u ms\r\n",
+                 m_tx_packet_count, m_tx_event_count, m_tx_packet_max, back_data_ble_stall_count_get(),
+                 (uint32_t)(((uint64_t) ticks * 1000 * (APP_TIMER_PRESCALER + 1)) / APP_TIMER_CLOCK_FREQ));
+        
+        set_sys_state(SYS_BLE_DATA_INSTANT);            //< Instant data and idle link until the next command
         return;
     }
     
@@ -579,7 +952,14 @@ void ble_nus_data_transfer(void)
       */
     for (;;)
     {
-        err_code = ble_nus_send_string(&m_nus, m_data, m_data_length);
+        if (m_transfer_on_bds)
+        {
+            err_code = ble_bds_data_send(&m_bds, m_data, m_data_length);
+        }
+        else
+        {
+            err_code = ble_nus_send_string(&m_nus, m_data, m_data_length);
+        }
         
         if (err_code == BLE_ERROR_NO_TX_BUFFERS ||
             err_code == NRF_ERROR_INVALID_STATE ||
@@ -593,6 +973,8 @@ void ble_nus_data_transfer(void)
         }
         
         back_data_ble_nus_fill(m_data, &m_data_length);
+        
+        if (m_data_length == 0) break;  //< All data is queued, "**END**" follows on the next TX complete event.
     }
     
     
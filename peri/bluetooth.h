@@ -19,6 +19,14 @@
 #define DEVICE_NAME                     "BKG Record"                                /**< Name of device. Will be included in the advertising data. (CANNOT BE TOO LONG!)*/
 #define MANUFACTURER_NAME               "SCY"                                   /**< Manufacturer. Will be passed to Device Information Service. */
 
+// Instant Data Report
+#ifndef BLE_INSTANT_BATCH_SIZE
+#define BLE_INSTANT_BATCH_SIZE          8                                           /**< Samples per instant data notification (1 to BDS_INSTANT_MAX_SAMPLES). The Heart Rate measurement is sent once per batch. */
+#endif
+#ifndef BLE_INSTANT_MAX_DELAY_MS
+#define BLE_INSTANT_MAX_DELAY_MS        10000                                       /**< Longest wait of a sample in the instant data batch (10s): at long sampling periods, batches are sent before they are full. */
+#endif
+
 // Advertising Parameters
 #define APP_ADV_INTERVAL                64                                          /**< The advertising interval (in units of 0.625 ms. This value corresponds to 40 ms). */
 #define APP_ADV_TIMEOUT_IN_SECONDS      15                                          /**< The advertising timeout (in units of seconds). */
@@ -30,11 +38,17 @@
  *       (1 + Conn_Latency) * Conn_Interval_Max * 2, where Conn_Interval_Max is given in milliseconds.
  */
 
-// Connection Parameters
-#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(20, UNIT_1_25_MS)             /**< Minimum acceptable connection interval (20ms, setting for iOS). */
-#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(40, UNIT_1_25_MS)             /**< Maximum acceptable connection interval (40ms). */
-#define SLAVE_LATENCY                   50                                          /**< Slave latency. */
+// Connection Parameters (instant data report mode, and idle link after a file transfer)
+#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(500, UNIT_1_25_MS)            /**< Minimum acceptable connection interval (500ms). A batch of instant data is at most one notification, sent every BLE_INSTANT_BATCH_SIZE samples (800 ms at the 100 ms shortest period) and at least every BLE_INSTANT_MAX_DELAY_MS: one event per batch at most, with commands answered within a second. */
+#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(1000, UNIT_1_25_MS)           /**< Maximum acceptable connection interval (1s). */
+#define SLAVE_LATENCY                   0                                           /**< Slave latency. */
 #define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)             /**< Connection supervisory timeout (4 seconds). */
+
+// Connection Parameters (file transfer mode)
+#define TRANSFER_MIN_CONN_INTERVAL      MSEC_TO_UNITS(7.5, UNIT_1_25_MS)            /**< Minimum acceptable connection interval (7.5ms, the shortest allowed). */
+#define TRANSFER_MAX_CONN_INTERVAL      MSEC_TO_UNITS(30, UNIT_1_25_MS)             /**< Maximum acceptable connection interval (30ms, iOS grants a multiple of 15ms). */
+#define TRANSFER_SLAVE_LATENCY          0                                           /**< Slave latency. */
+#define TRANSFER_CONN_SUP_TIMEOUT       MSEC_TO_UNITS(4000, UNIT_10_MS)             /**< Connection supervisory timeout (4 seconds). */
 #define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(5000, APP_TIMER_PRESCALER)  /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(30000, APP_TIMER_PRESCALER) /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT    3                                           /**< Number of attempts before giving up the connection parameter negotiation. */
@@ -54,13 +68,16 @@ void system_off_mode(void);
 
 /**@brief Function for updating instant data.
  *
- * @details This function sends instant data through Heart Rate Service.
+ * @details This function adds a sample to the batch notified on the Bulk Data Service instant
+ *          characteristic. A full batch is sent along with its last sample through the Heart Rate Service.
+ *
+ * @param[in] sample    Sample, in the format of the data segment of a raw block (half degrees Celsius).
  */
-void ble_dts_update_handler(uint16_t data);
+void ble_dts_update_handler(int8_t sample);
 
 /**@brief Function for updating battery level.
  *
- * @details This function is called in ADC_IRQHandler to update current battery level.
+ * @details This function is scheduled by ADC_IRQHandler when the battery level changes.
  */
 void ble_bas_battery_level_update_handler(uint8_t percentage_batt_lvl);
 
@@ -88,9 +105,19 @@ void advertising_init(void);
  */
 void conn_params_init(void);
 
+/**@brief Function for requesting the connection parameters suited to a system state.
+ *
+ * @details Short intervals without slave latency in SYS_BLE_DATA_TRANSFER, long intervals otherwise.
+ *          Takes effect on the current connection. While disconnected, only the preferred
+ *          parameters (PPCP) are set, and negotiated once the next connection is up.
+ *
+ * @param[in] state System state (see set_sys_state).
+ */
+void conn_params_mode_set(uint32_t state);
+
 /**@brief Function for initializing the services that will be used by the application.
  *
- * @details Initialize the Heart Rate, Battery and Device Information services.
+ * @details Initialize the Heart Rate, Battery, Device Information, Nordic UART and Bulk Data services.
  */
 void services_init(void);
 
@@ -109,8 +136,8 @@ void ble_connection_disconnect(void);
 /**@brief Initialize system event handler. */
 void sys_evt_init(void);
 
-/**@brief Send data through BLE UART service with maximum throughput. */
-void ble_nus_data_transfer(void);
+/**@brief Send file transfer data through the BLE UART or Bulk Data service with maximum throughput. */
+void ble_data_transfer(void);
 
 #endif
 
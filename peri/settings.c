@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "nordic_common.h"
+#include "app_util.h"
+#include "app_error.h"
+#include "pstorage.h"
+
+#include "settings.h"
+#include "timers.h"
+#include "back_dat.h"
+#include "uart.h"
+
+static pstorage_handle_t    m_settings_handle;                                          /**< Settings block. */
+static settings_t           m_settings;                                                 /**< Settings in use, source of the FLASH writes. */
+
+STATIC_ASSERT(sizeof(settings_t) == SETTINGS_BLOCK_SIZE);
+
+/**@brief Settings pstorage callback: report the failed writes. */
+static void settings_pstorage_callback(pstorage_handle_t   *p_handle,
+                                       uint8_t              op_code,
+                                       uint32_t             result,
+                                       uint8_t             *p_data,
+                                       uint32_t             data_len)
+{
+    if (result != NRF_SUCCESS)
+    {
+        DEBUG_PF("Settings not saved: 0x%x\r\n", result);
+    }
+}
+
+/**@brief Write the settings in use to FLASH.
+ *
+ * @note  pstorage reads m_settings when the operation runs, a later change is saved by the next one.
+ */
+static void settings_save(void)
+{
+    uint32_t err_code;
+
+    m_settings.magic = SETTINGS_MAGIC;
+
+    err_code = pstorage_update(&m_settings_handle, (uint8_t *) &m_settings, SETTINGS_BLOCK_SIZE, 0);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Register the settings block and load the saved settings. */
+void settings_init(void)
+{
+    pstorage_module_param_t     storage_param;
+    uint32_t                    err_code;
+    const settings_t *          p_saved;
+
+    storage_param.block_size  = SETTINGS_BLOCK_SIZE;
+    storage_param.block_count = 1;
+    storage_param.cb          = settings_pstorage_callback;
+
+    err_code = pstorage_register(&storage_param, &m_settings_handle);
+    APP_ERROR_CHECK(err_code);
+
+    p_saved = (const settings_t *)(uintptr_t) m_settings_handle.block_id;         //< FLASH is memory-mapped
+
+    if (p_saved->magic == SETTINGS_MAGIC)
+    {
+        memcpy(&m_settings, p_saved, sizeof(m_settings));
+    }
+    else
+    {
+        memset(&m_settings, 0xFF, sizeof(m_settings));
+        m_settings.sample_period_ms = SAMPLE_PERIOD_DEFAULT_MS;
+    }
+
+    if (m_settings.data_width == 0xFFFFFFFF)
+    {
+        m_settings.data_width = BD_DATA_WIDTH;                                  //< Saved without a data width
+    }
+
+    if (m_settings.storage_generation == 0xFFFFFFFF)
+    {
+        m_settings.storage_generation = 0;                                      //< Never cleared
+    }
+}
+
+/**@brief Get the saved sampling period. */
+uint32_t settings_sample_period_get(void)
+{
+    return m_settings.sample_period_ms;
+}
+
+/**@brief Save the sampling period. */
+void settings_sample_period_set(uint32_t period_ms)
+{
+    if (m_settings.magic == SETTINGS_MAGIC && m_settings.sample_period_ms == period_ms) return;
+
+    m_settings.sample_period_ms = period_ms;
+    settings_save();
+}
+
+/**@brief Get the saved data width. */
+uint32_t settings_data_width_get(void)
+{
+    return m_settings.data_width;
+}
+
+/**@brief Save the data width. */
+void settings_data_width_set(uint32_t width)
+{
+    if (m_settings.magic == SETTINGS_MAGIC && m_settings.data_width == width) return;
+
+    m_settings.data_width = width;
+    settings_save();
+}
+
+/**@brief Get the storage generation. */
+uint32_t settings_storage_generation_get(void)
+{
+    return m_settings.storage_generation;
+}
+
+/**@brief Count a clear of the data storage. */
+void settings_storage_generation_bump(void)
+{
+    m_settings.storage_generation ++;
+    settings_save();
+}
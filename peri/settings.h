@@ -0,0 +1,76 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_settings Persistent Settings
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Header for the settings kept in FLASH across resets.
+ *
+ * The settings are one pstorage block of their own, registered after the data memory so that
+ * its location does not move. Until settings are saved, the defaults are used.
+ */
+
+#ifndef CUSTOM_SETTINGS_H__
+#define CUSTOM_SETTINGS_H__
+
+#include <stdint.h>
+
+#define SETTINGS_BLOCK_SIZE     16                                                      /**< Size of the settings pstorage block (in uint8_t). */
+#define SETTINGS_MAGIC          0x31544553                                              /**< "SET1", marks saved settings of this layout. */
+
+/**@brief Settings layout in FLASH. */
+typedef struct
+{
+    uint32_t    magic;                                                                  /**< SETTINGS_MAGIC once saved. */
+    uint32_t    sample_period_ms;                                                       /**< Sampling period (in ms). */
+    uint32_t    data_width;                                                             /**< Data width of the blocks (BD_WIDTH_*), erased (0xFFFFFFFF) if saved without it. */
+    uint32_t    storage_generation;                                                     /**< Number of times the data storage was cleared, erased (0xFFFFFFFF) if never. */
+} settings_t;
+
+/**@brief Register the settings block and load the saved settings.
+ *
+ * @note  Call after back_data_init(), pstorage blocks are allocated in registration order.
+ */
+void settings_init(void);
+
+/**@brief Get the saved sampling period.
+ *
+ * @retval Sampling period (in ms), SAMPLE_PERIOD_DEFAULT_MS if none was saved.
+ */
+uint32_t settings_sample_period_get(void);
+
+/**@brief Save the sampling period.
+ *
+ * @details The block is written asynchronously. Nothing is written if the period is unchanged.
+ *
+ * @param[in] period_ms Sampling period (in ms).
+ */
+void settings_sample_period_set(uint32_t period_ms);
+
+/**@brief Get the saved data width.
+ *
+ * @retval Data width (BD_WIDTH_*), BD_DATA_WIDTH if none was saved.
+ */
+uint32_t settings_data_width_get(void);
+
+/**@brief Save the data width (see settings_sample_period_set()).
+ *
+ * @param[in] width Data width (BD_WIDTH_*).
+ */
+void settings_data_width_set(uint32_t width);
+
+/**@brief Get the storage generation.
+ *
+ * @retval Number of times the data storage was cleared (see back_data_clear_storage), 0 if never.
+ */
+uint32_t settings_storage_generation_get(void);
+
+/**@brief Count a clear of the data storage, and save it (see settings_sample_period_set()).
+ *
+ * @details Positions saved in sequence # (e.g. the sync mark of a central) are only valid
+ *          with the generation they were saved with.
+ */
+void settings_storage_generation_bump(void);
+
+#endif
+
+/** @} */
@@ -3,11 +3,163 @@
 #include "gpio.h"
 #include "back_dat.h"
 
+#include "nordic_common.h"
+#include "app_error.h"
 #include "app_timer.h"
 
-static app_timer_id_t   m_battery_timer_id;         /**< Battery timer. */
 static app_timer_id_t   m_data_report_timer_id;     /**< Data report timer. */
+static app_timer_id_t   m_conversion_timer_id;      /**< Sensor conversion timer. */
 static app_timer_id_t   m_blinky_led_timer_id;      /**< LED control timer. */
+static app_timer_id_t   m_time_keeping_timer_id;    /**< Time keeping timer. */
+
+static uint32_t         m_rtc_last;                 /**< RTC1 counter at the last time update. */
+static uint32_t         m_rtc_ticks;                /**< RTC1 ticks not counted in m_uptime yet. */
+static uint32_t         m_uptime;                   /**< Seconds since boot. */
+static bool             m_time_set;                 /**< The host has set the time since boot. */
+static uint32_t         m_epoch_offset;             /**< Time at boot (in seconds), set by the host or restored from the newest block. */
+
+static uint32_t         m_sample_period_ms;         /**< Sampling period (in ms). */
+static uint32_t         m_sample_interval;          /**< Data report timer interval (in ticks). */
+static uint32_t         m_sample_skip;              /**< Data report timer events per sample. */
+static uint32_t         m_sample_tick;              /**< Data report timer events since the last sample. */
+static bool             m_sampling;                 /**< Data report timer is running. */
+
+/*****************************************************************************
+* Time Keeping
+*****************************************************************************/
+
+/**@brief Function for accumulating the RTC1 ticks elapsed since the last update.
+ *
+ * @note The RTC1 counter is 24-bit wide, so this must be called at least once per counter period.
+ */
+static void time_update(void)
+{
+    uint32_t err_code;
+    uint32_t ticks;
+    uint32_t diff;
+
+    err_code = app_timer_cnt_get(&ticks);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_cnt_diff_compute(ticks, m_rtc_last, &diff);
+    APP_ERROR_CHECK(err_code);
+
+    m_rtc_last = ticks;
+    m_rtc_ticks += diff;
+    m_uptime += m_rtc_ticks / TIME_TICKS_PER_SEC;
+    m_rtc_ticks %= TIME_TICKS_PER_SEC;
+}
+
+/**@brief Function for handling the time keeping timer timeout.
+ */
+static void time_keeping_timeout_handler(void *p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    time_update();
+}
+
+/**@brief Function for getting the current time.
+ *
+ * @retval Current time (in seconds, Unix time once set by the host).
+ */
+uint32_t timers_time_get(void)
+{
+    time_update();
+
+    return m_epoch_offset + m_uptime;
+}
+
+/**@brief Function for setting the current time.
+ *
+ * @param[in] time  Current time (in seconds, Unix time).
+ */
+void timers_time_set(uint32_t time)
+{
+    time_update();
+
+    m_epoch_offset = time - m_uptime;
+    m_time_set = true;
+}
+
+/**@brief Function for checking whether the host has set the time since boot.
+ */
+bool timers_time_is_set(void)
+{
+    return m_time_set;
+}
+
+/*****************************************************************************
+* Sampling
+*****************************************************************************/
+
+/**@brief Function for handling the data report timer timeout.
+ *
+ * @details Sampling periods longer than SAMPLE_TIMER_MAX_MS take several timer events.
+ */
+static void sample_timeout_handler(void *p_context)
+{
+    if (++m_sample_tick < m_sample_skip) return;
+    
+    m_sample_tick = 0;
+    data_report_timeout_handler(p_context);
+}
+
+/**@brief Function for setting the sampling period.
+ *
+ * @param[in] period_ms Sampling period (in ms, SAMPLE_PERIOD_MIN_MS to SAMPLE_PERIOD_MAX_MS).
+ */
+void timers_sample_period_set(uint32_t period_ms)
+{
+    uint32_t err_code;
+    
+    m_sample_period_ms = period_ms;
+    m_sample_skip      = (period_ms + SAMPLE_TIMER_MAX_MS - 1) / SAMPLE_TIMER_MAX_MS;
+    m_sample_interval  = (uint32_t)(((uint64_t) period_ms * TIME_TICKS_PER_SEC) / (1000 * m_sample_skip));
+    m_sample_tick      = 0;
+    
+    if (m_sampling)
+    {
+        err_code = app_timer_stop(m_data_report_timer_id);
+        APP_ERROR_CHECK(err_code);
+        
+        err_code = app_timer_start(m_data_report_timer_id, m_sample_interval, NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+/**@brief Function for getting the sampling period.
+ *
+ * @return Sampling period (in ms).
+ */
+uint32_t timers_sample_period_get(void)
+{
+    return m_sample_period_ms;
+}
+
+/**@brief Function for starting the sensor conversion timer.
+ *
+ * @param[in] conversion_ms Conversion time (in ms).
+ */
+void timers_conversion_start(uint32_t conversion_ms)
+{
+    uint32_t err_code;
+    
+    err_code = app_timer_start(m_conversion_timer_id,
+                               APP_TIMER_TICKS(conversion_ms, APP_TIMER_PRESCALER),
+                               NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for stopping the sensor conversion timer, if it is running.
+ */
+void timers_conversion_stop(void)
+{
+    uint32_t err_code;
+    
+    err_code = app_timer_stop(m_conversion_timer_id);
+    APP_ERROR_CHECK(err_code);
+}
 
 /*****************************************************************************
 * Initilization Functions
@@ -24,17 +176,23 @@ void timers_init(void)
     // Initialize timer module, making it use the scheduler
     APP_TIMER_INIT(APP_TIMER_PRESCALER, APP_TIMER_MAX_TIMERS, APP_TIMER_OP_QUEUE_SIZE, true);
 
-    // Timer for supply voltage monitor (BLE)
-    err_code = app_timer_create(&m_battery_timer_id,
-                                APP_TIMER_MODE_REPEATED,
-                                battery_level_meas_timeout_handler);
-    APP_ERROR_CHECK(err_code);
+    // Go on from the newest block (after back_data_init), one second later: the time never goes back across a reset
+    m_epoch_offset = back_data_newest_time_get();
+    if (m_epoch_offset != 0) m_epoch_offset ++;
 
     // Timer for data report (BLE)
     err_code = app_timer_create(&m_data_report_timer_id,
                                 APP_TIMER_MODE_REPEATED,
-                                data_report_timeout_handler);
+                                sample_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    // Timer for sensor conversion (one-shot, started by each sample)
+    err_code = app_timer_create(&m_conversion_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                data_conversion_timeout_handler);
     APP_ERROR_CHECK(err_code);
+    
+    timers_sample_period_set(SAMPLE_PERIOD_DEFAULT_MS);
 
     // Timer for blinky LED
     err_code = app_timer_create(&m_blinky_led_timer_id,
@@ -42,9 +200,19 @@ void timers_init(void)
                                 blinky_led_button_press_timeout_handler);
     APP_ERROR_CHECK(err_code);
     
+    // Timer for time keeping
+    err_code = app_timer_create(&m_time_keeping_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                time_keeping_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+    
     // Start LED blinky timer
     err_code = app_timer_start(m_blinky_led_timer_id, BLINKY_LED_INTERVAL, NULL);
     APP_ERROR_CHECK(err_code);
+    
+    // Start time keeping timer
+    err_code = app_timer_start(m_time_keeping_timer_id, TIME_KEEPING_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
 }
 
 /*****************************************************************************
@@ -52,25 +220,20 @@ void timers_init(void)
 *****************************************************************************/
 
 /**@brief Function for starting timers (used for BLE services).
+ *
+ * @details The battery level measurements run on RTC1 compare register ADC_RTC_CC, next to
+ *          app_timer (see adc.c).
 */
 void ble_timers_start(void)
 {
-    uint32_t err_code;
-
-    err_code = app_timer_start(m_battery_timer_id, BATTERY_LEVEL_MEAS_INTERVAL, NULL);
-    APP_ERROR_CHECK(err_code);
-
+    battery_level_meas_start();
 }
 
 /**@brief Function for stopping timers (used for BLE services).
 */
 void ble_timers_stop(void)
 {
-    uint32_t err_code;
-
-    err_code = app_timer_stop(m_battery_timer_id);
-    APP_ERROR_CHECK(err_code);
-
+    battery_level_meas_stop();
 }
 
 /**@brief Function for starting global timers (timers for flashing LED, data recording, etc.).
@@ -79,8 +242,12 @@ void glb_timers_start(void)
 {
     uint32_t err_code;
 
-    err_code = app_timer_start(m_data_report_timer_id, DATA_REPORT_INTERVAL, NULL);
+    if (m_sampling) return;             //< Already running, keep its phase
+    
+    err_code = app_timer_start(m_data_report_timer_id, m_sample_interval, NULL);
     APP_ERROR_CHECK(err_code);
+    
+    m_sampling = true;
 }
 
 /**@brief Function for stoping global timers (timers for flashing LED, data recording, etc.).
@@ -91,7 +258,11 @@ void glb_timers_stop(void)
 
     err_code = app_timer_stop(m_data_report_timer_id);
     APP_ERROR_CHECK(err_code);
-
+    
+    err_code = app_timer_stop(m_conversion_timer_id);
+    APP_ERROR_CHECK(err_code);
+    
+    m_sampling = false;
 }
 
 
@@ -9,23 +9,34 @@
 #ifndef CUSTOM_TIMER_H__
 #define CUSTOM_TIMER_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 // APP TIMERS
 #define APP_TIMER_PRESCALER             0                                           /**< Value of the RTC1 PRESCALER register. */
-#define APP_TIMER_MAX_TIMERS            5                                           /**< Maximum number of simultaneously created timers. */
+#define APP_TIMER_MAX_TIMERS            6                                           /**< Maximum number of simultaneously created timers (4 here, 1 in app_button and 1 in ble_conn_params). */
 #define APP_TIMER_OP_QUEUE_SIZE         5                                           /**< Size of timer operation queues. */
 
 // BATTERY SERVICE
-#define BATTERY_LEVEL_MEAS_INTERVAL     APP_TIMER_TICKS(4000, APP_TIMER_PRESCALER)  /**< Battery level measurement interval (ticks -> 4s). */
+#define BATTERY_LEVEL_MEAS_INTERVAL     APP_TIMER_TICKS(4000, APP_TIMER_PRESCALER)  /**< Battery level measurement interval (RTC1 ticks -> 4s, see adc.c). */
 
-// DATA REPORT SERVICE (HEART RATE SERVICE)
-#define DATA_REPORT_INTERVAL            APP_TIMER_TICKS(1000, APP_TIMER_PRESCALER)  /**< Instant data report interval (0.5s) */
+// DATA RECORDING (set at runtime, see back_data_sample_period_set)
+#define SAMPLE_PERIOD_DEFAULT_MS        2000                                        /**< Default sampling period (2s). */
+#define SAMPLE_PERIOD_MIN_MS            100                                         /**< Shortest sampling period (10Hz). */
+#define SAMPLE_PERIOD_MAX_MS            3600000                                     /**< Longest sampling period (1h). */
+#define SAMPLE_TIMER_MAX_MS             240000                                      /**< Longest data report timer interval (240s), must be shorter than one 24-bit RTC1 period (512s). Longer sampling periods count several timer events. */
 
 // BLINKY LED TIMER
 #define BLINKY_LED_INTERVAL             APP_TIMER_TICKS(100, APP_TIMER_PRESCALER)   /**< LED event interval (100ms) */
 
+// TIME KEEPING
+#define TIME_TICKS_PER_SEC              (APP_TIMER_CLOCK_FREQ / (APP_TIMER_PRESCALER + 1))  /**< RTC1 ticks per second. */
+#define TIME_KEEPING_INTERVAL           APP_TIMER_TICKS(60000, APP_TIMER_PRESCALER) /**< Time update interval (60s), must be shorter than one 24-bit RTC1 period (512s). */
+
 /**@brief Function for the Timer initialization.
  *
- * @details Initializes the timer module.
+ * @details Initializes the timer module. The time starts from the newest block in FLASH, so
+ *          call after back_data_init().
  */
 void timers_init(void);
 
@@ -45,6 +56,57 @@ void glb_timers_start(void);
 */
 void glb_timers_stop(void);
 
+/**@brief Function for setting the sampling period.
+ *
+ * @details Restarts the data report timer if it is running.
+ *
+ * @param[in] period_ms Sampling period (in ms, SAMPLE_PERIOD_MIN_MS to SAMPLE_PERIOD_MAX_MS).
+ */
+void timers_sample_period_set(uint32_t period_ms);
+
+/**@brief Function for getting the sampling period.
+ *
+ * @return Sampling period (in ms), as last set by timers_sample_period_set.
+ */
+uint32_t timers_sample_period_get(void);
+
+/**@brief Function for starting the sensor conversion timer.
+ *
+ * @details data_conversion_timeout_handler() is called once, when the conversions started by
+ *          data_report_timeout_handler() are done.
+ *
+ * @param[in] conversion_ms Conversion time (in ms).
+ */
+void timers_conversion_start(uint32_t conversion_ms);
+
+/**@brief Function for stopping the sensor conversion timer.
+ *
+ * @details The conversions started by the last data report are not read.
+ */
+void timers_conversion_stop(void);
+
+/**@brief Function for getting the current time.
+ *
+ * @details The 24-bit RTC1 counter is extended to 32-bit seconds since boot, plus the epoch
+ *          offset set by the host. Until the host sets the time, the value is the uptime in seconds,
+ *          from the time of the newest block in FLASH at boot (see timers_init).
+ *
+ * @retval Current time (in seconds, Unix time once set by the host).
+ */
+uint32_t timers_time_get(void);
+
+/**@brief Function for setting the current time.
+ *
+ * @param[in] time  Current time (in seconds, Unix time).
+ */
+void timers_time_set(uint32_t time);
+
+/**@brief Function for checking whether the host has set the time since boot.
+ *
+ * @retval TRUE  timers_time_get() returns Unix time, not the time going on from the newest block.
+ */
+bool timers_time_is_set(void);
+
 #endif
 
 /** @} */
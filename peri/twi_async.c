@@ -0,0 +1,421 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nordic_common.h"
+#include "nrf.h"
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+#include "nrf_soc.h"
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_util_platform.h"
+#include "app_timer.h"
+
+#include "timers.h"
+#include "twi_async.h"
+
+#define TWI_ASYNC_TIMEOUT_TICKS APP_TIMER_TICKS(TWI_ASYNC_TIMEOUT_MS, APP_TIMER_PRESCALER)  /**< Timeout of a transaction (in RTC1 ticks). */
+
+/**@brief Queued transaction. */
+typedef struct
+{
+    const twi_async_xfer_t *p_xfers;                                                    /**< Transfers, in bus order. */
+    uint8_t                 count;                                                      /**< Number of transfers. */
+    twi_async_xfer_t        single;                                                     /**< Transfer queued by twi_async_transfer(). */
+    bool                    blocking;                                                   /**< Queued by twi_async_transaction_wait(). */
+    twi_async_handler_t     handler;                                                    /**< Completion handler, NULL if none. */
+    void *                  p_context;                                                  /**< Context given to the handler. */
+} twi_trans_t;
+
+enum
+{
+    TWI_WAIT_PENDING,
+    TWI_WAIT_DONE,
+    TWI_WAIT_FAILED
+};
+
+static twi_trans_t          m_queue[TWI_ASYNC_QUEUE_SIZE];                              /**< Queued transactions, the first one is on the bus. */
+static volatile uint8_t     m_head;                                                     /**< Index of the first queued transaction. */
+static volatile uint8_t     m_count;                                                    /**< Number of queued transactions. */
+static volatile bool        m_running;                                                  /**< The first queued transaction is on the bus. */
+static uint8_t              m_xfer_idx;                                                 /**< Running transfer of the transaction. */
+static uint8_t              m_idx;                                                      /**< Bytes written or read by the running transfer. */
+static bool                 m_error;                                                    /**< The running transfer failed, a stop condition is on its way. */
+static volatile uint8_t     m_wait_result;                                              /**< Result of the transaction of twi_async_transaction_wait(). */
+static uint32_t             m_start_tick;                                               /**< RTC1 counter when the first queued transaction was put on the bus. */
+
+/*****************************************************************************
+* Transfer State Machine
+*****************************************************************************/
+
+/**@brief Run a transfer completion handler from the scheduler. */
+static void twi_evt_handler(void *p_event_data, uint16_t event_size)
+{
+    twi_async_evt_t * p_evt = (twi_async_evt_t *) p_event_data;
+
+    UNUSED_PARAMETER(event_size);
+
+    p_evt->handler(p_evt->success, p_evt->p_context);
+}
+
+/**@brief Put the running transfer of the first queued transaction on the bus. */
+static void xfer_start(void)
+{
+    const twi_async_xfer_t *p_xfer = &m_queue[m_head].p_xfers[m_xfer_idx];
+    uint32_t                err_code;
+
+    m_idx   = 0;
+    m_error = false;
+
+    NRF_TWI1->ADDRESS = p_xfer->address >> 1;
+
+    if (p_xfer->address & TWI_READ_BIT)
+    {
+        // Suspend after each byte to fetch it, stop after the last one
+        err_code = sd_ppi_channel_assign(TWI_ASYNC_PPI_CHANNEL,
+                                         &(NRF_TWI1->EVENTS_BB),
+                                         (p_xfer->length == 1) ? &(NRF_TWI1->TASKS_STOP)
+                                                               : &(NRF_TWI1->TASKS_SUSPEND));
+        APP_ERROR_CHECK(err_code);
+
+        err_code = sd_ppi_channel_enable_set(1 << TWI_ASYNC_PPI_CHANNEL);
+        APP_ERROR_CHECK(err_code);
+
+        NRF_TWI1->TASKS_STARTRX = 1;
+    }
+    else
+    {
+        NRF_TWI1->TXD = p_xfer->p_data[0];
+        NRF_TWI1->TASKS_STARTTX = 1;
+    }
+}
+
+/**@brief Put the first queued transaction on the bus. */
+static void trans_start(void)
+{
+    m_running    = true;
+    m_xfer_idx   = 0;
+    m_start_tick = NRF_RTC1->COUNTER;
+
+    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos;
+
+    xfer_start();
+}
+
+/**@brief Report the running transaction and start the next one.
+ *
+ * @param[in] success   Result of the transaction.
+ * @param[in] stopped   The transaction ended with a stop condition, TWI1 may be powered down.
+ */
+static void trans_end(bool success, bool stopped)
+{
+    twi_trans_t *   p_trans = &m_queue[m_head];
+    twi_async_evt_t evt;
+    uint32_t        err_code;
+
+    if (p_trans->blocking)
+    {
+        m_wait_result = success ? TWI_WAIT_DONE : TWI_WAIT_FAILED;
+    }
+    else if (p_trans->handler != NULL)
+    {
+        evt.handler   = p_trans->handler;
+        evt.p_context = p_trans->p_context;
+        evt.success   = success;
+
+        err_code = app_sched_event_put(&evt, sizeof(evt), twi_evt_handler);
+        APP_ERROR_CHECK(err_code);
+    }
+
+    m_head    = (m_head + 1) % TWI_ASYNC_QUEUE_SIZE;
+    m_count  -= 1;
+    m_running = false;
+
+    if (m_count != 0)
+    {
+        trans_start();
+    }
+    else if (stopped)
+    {
+        NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos; /**< Save power! */
+    }
+}
+
+/**@brief End the running transfer: go on with the next one of the transaction or end it.
+ *
+ * @param[in] success   Result of the transfer. A failure ends the transaction.
+ * @param[in] stopped   The transfer ended with a stop condition.
+ */
+static void xfer_end(bool success, bool stopped)
+{
+    if (success && ++m_xfer_idx < m_queue[m_head].count)
+    {
+        xfer_start();
+    }
+    else
+    {
+        trans_end(success, stopped);
+    }
+}
+
+/**@brief Fail the running transaction if it has held the bus longer than TWI_ASYNC_TIMEOUT_MS.
+ *
+ * @details TWI1 is disabled, which drops the transfer, and twi_master_init() clocks SCL until a
+ *          slave holding SDA releases it. The next transaction starts on a re-enabled TWI1.
+ */
+static void trans_timeout_check(void)
+{
+    uint32_t err_code;
+
+    CRITICAL_REGION_ENTER();
+
+    if (m_running && ((NRF_RTC1->COUNTER - m_start_tick) & RTC_COUNTER_COUNTER_Msk) >= TWI_ASYNC_TIMEOUT_TICKS)
+    {
+        NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos;
+
+        err_code = sd_ppi_channel_enable_clr(1 << TWI_ASYNC_PPI_CHANNEL);
+        APP_ERROR_CHECK(err_code);
+
+        NRF_TWI1->EVENTS_TXDSENT  = 0;
+        NRF_TWI1->EVENTS_RXDREADY = 0;
+        NRF_TWI1->EVENTS_STOPPED  = 0;
+        NRF_TWI1->EVENTS_ERROR    = 0;
+        NRF_TWI1->ERRORSRC        = TWI_ERRORSRC_ANACK_Msk | TWI_ERRORSRC_DNACK_Msk | TWI_ERRORSRC_OVERRUN_Msk;
+
+        (void) twi_master_init();   //< Bus clear, the next transaction fails again if the bus is still stuck
+
+        trans_end(false, true);
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+/**@brief Queue a transaction, start it if the bus is free.
+ *
+ * @param[in] p_single  Transfer to copy into the queue entry, NULL to use p_xfers as is.
+ */
+static uint32_t trans_queue(const twi_async_xfer_t *    p_xfers,
+                            uint8_t                     count,
+                            const twi_async_xfer_t *    p_single,
+                            bool                        blocking,
+                            twi_async_handler_t         handler,
+                            void *                      p_context)
+{
+    twi_trans_t *   p_trans;
+    uint32_t        err_code = NRF_SUCCESS;
+    uint8_t         i;
+
+    if (count == 0) return NRF_ERROR_INVALID_PARAM;
+    for (i = 0; i < count; i++)
+    {
+        if (p_xfers[i].length == 0) return NRF_ERROR_INVALID_PARAM;
+    }
+
+    trans_timeout_check();          //< Not to queue behind a hung transaction
+
+    CRITICAL_REGION_ENTER();
+
+    if (m_count == TWI_ASYNC_QUEUE_SIZE)
+    {
+        err_code = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        p_trans = &m_queue[(m_head + m_count) % TWI_ASYNC_QUEUE_SIZE];
+
+        if (p_single != NULL)
+        {
+            p_trans->single  = *p_single;
+            p_trans->p_xfers = &p_trans->single;
+        }
+        else
+        {
+            p_trans->p_xfers = p_xfers;
+        }
+        p_trans->count     = count;
+        p_trans->blocking  = blocking;
+        p_trans->handler   = handler;
+        p_trans->p_context = p_context;
+
+        m_count += 1;
+
+        if (!m_running) trans_start();
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return err_code;
+}
+
+/*****************************************************************************
+* Interface Functions
+*****************************************************************************/
+
+/**@brief Initialize TWI1 and its interrupt. */
+bool twi_async_init(void)
+{
+    uint32_t    err_code;
+    bool        bus_clear;
+
+    bus_clear = twi_master_init();
+
+    NRF_TWI1->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos;   /**< Powered while transfers are queued. */
+
+    NRF_TWI1->EVENTS_TXDSENT  = 0;
+    NRF_TWI1->EVENTS_RXDREADY = 0;
+    NRF_TWI1->EVENTS_STOPPED  = 0;
+    NRF_TWI1->EVENTS_ERROR    = 0;
+    NRF_TWI1->INTENSET        = TWI_INTENSET_TXDSENT_Msk  |
+                                TWI_INTENSET_RXDREADY_Msk |
+                                TWI_INTENSET_STOPPED_Msk  |
+                                TWI_INTENSET_ERROR_Msk;
+
+    err_code = sd_nvic_ClearPendingIRQ(SPI1_TWI1_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_nvic_SetPriority(SPI1_TWI1_IRQn, NRF_APP_PRIORITY_LOW);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_nvic_EnableIRQ(SPI1_TWI1_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    return bus_clear;
+}
+
+/**@brief Queue a transfer. */
+uint32_t twi_async_transfer(uint8_t                 address,
+                            uint8_t *               p_data,
+                            uint8_t                 length,
+                            bool                    issue_stop,
+                            twi_async_handler_t     handler,
+                            void *                  p_context)
+{
+    twi_async_xfer_t xfer = TWI_ASYNC_XFER(address, p_data, length, issue_stop);
+
+    return trans_queue(&xfer, 1, &xfer, false, handler, p_context);
+}
+
+/**@brief Queue a transaction. */
+uint32_t twi_async_transaction(const twi_async_xfer_t *    p_xfers,
+                               uint8_t                     count,
+                               twi_async_handler_t         handler,
+                               void *                      p_context)
+{
+    return trans_queue(p_xfers, count, NULL, false, handler, p_context);
+}
+
+/**@brief Queue a transaction and sleep until it is done. */
+bool twi_async_transaction_wait(const twi_async_xfer_t *p_xfers, uint8_t count)
+{
+    uint32_t err_code;
+
+    m_wait_result = TWI_WAIT_PENDING;
+
+    if (trans_queue(p_xfers, count, NULL, true, NULL, NULL) != NRF_SUCCESS)
+    {
+        return false;
+    }
+
+    while (m_wait_result == TWI_WAIT_PENDING)
+    {
+        err_code = sd_app_evt_wait();
+        APP_ERROR_CHECK(err_code);
+
+        trans_timeout_check();      //< Woken up by app_timer at least
+    }
+
+    return (m_wait_result == TWI_WAIT_DONE);
+}
+
+/**@brief Queue a transfer and sleep until it is done. */
+bool twi_async_transfer_wait(uint8_t address, uint8_t *p_data, uint8_t length, bool issue_stop)
+{
+    twi_async_xfer_t xfer = TWI_ASYNC_XFER(address, p_data, length, issue_stop);
+
+    return twi_async_transaction_wait(&xfer, 1);
+}
+
+/**@brief Check whether transactions are queued or running. */
+bool twi_async_is_busy(void)
+{
+    trans_timeout_check();
+
+    return (m_count != 0);
+}
+
+/*****************************************************************************
+* Interruption Handler
+*****************************************************************************/
+
+/**@brief Function for handling the TWI1 interrupt.
+ * @details  Feeds the bytes of the running transfer and ends it on the last byte, the stop
+ *           condition or an error. An error skips the rest of the transaction.
+ */
+void SPI1_TWI1_IRQHandler(void)
+{
+    const twi_async_xfer_t *p_xfer = &m_queue[m_head].p_xfers[m_xfer_idx];
+    uint32_t                err_code;
+
+    if (NRF_TWI1->EVENTS_ERROR != 0)
+    {
+        NRF_TWI1->EVENTS_ERROR = 0;
+        NRF_TWI1->ERRORSRC     = TWI_ERRORSRC_ANACK_Msk | TWI_ERRORSRC_DNACK_Msk | TWI_ERRORSRC_OVERRUN_Msk;
+        m_error = true;
+        NRF_TWI1->TASKS_STOP   = 1;     //< Ended at STOPPED
+    }
+
+    if (NRF_TWI1->EVENTS_TXDSENT != 0)
+    {
+        NRF_TWI1->EVENTS_TXDSENT = 0;
+
+        if (!m_error)
+        {
+            if (++m_idx < p_xfer->length)
+            {
+                NRF_TWI1->TXD = p_xfer->p_data[m_idx];
+            }
+            else if (p_xfer->issue_stop)
+            {
+                NRF_TWI1->TASKS_STOP = 1;
+            }
+            else
+            {
+                xfer_end(true, false);  //< Bus kept for a repeated start
+            }
+        }
+    }
+
+    if (NRF_TWI1->EVENTS_RXDREADY != 0)
+    {
+        NRF_TWI1->EVENTS_RXDREADY = 0;
+
+        if (!m_error && m_idx < p_xfer->length)
+        {
+            p_xfer->p_data[m_idx++] = NRF_TWI1->RXD;
+
+            if (m_idx < p_xfer->length)
+            {
+                if (p_xfer->length - m_idx == 1)
+                {
+                    // Stop before the byte boundary of the last byte
+                    err_code = sd_ppi_channel_assign(TWI_ASYNC_PPI_CHANNEL,
+                                                     &(NRF_TWI1->EVENTS_BB),
+                                                     &(NRF_TWI1->TASKS_STOP));
+                    APP_ERROR_CHECK(err_code);
+                }
+                NRF_TWI1->TASKS_RESUME = 1;
+            }
+        }
+    }
+
+    if (NRF_TWI1->EVENTS_STOPPED != 0)
+    {
+        NRF_TWI1->EVENTS_STOPPED = 0;
+
+        err_code = sd_ppi_channel_enable_clr(1 << TWI_ASYNC_PPI_CHANNEL);
+        APP_ERROR_CHECK(err_code);
+
+        if (m_running) xfer_end(!m_error, true);
+    }
+}
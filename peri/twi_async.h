@@ -0,0 +1,152 @@
+/** @file
+ *
+ * @defgroup ble_back_rec_twi_async Asynchronous TWI Master
+ * @{
+ * @ingroup ble_back_rec
+ * @brief Interrupt-driven TWI1 master with a transaction queue.
+ *
+ * A transaction is a list of transfers run back to back from the TWI1 interrupt, the CPU sleeps
+ * in sd_app_evt_wait() meanwhile. Its completion handler is run once by the scheduler, after the
+ * last transfer or the first failed one (the rest is skipped). Transactions are queued and run
+ * one after the other, a single transfer is a transaction of its own.
+ *
+ * A write without stop condition keeps the bus, the next transfer starts with a repeated start:
+ * a command and the read of its answer go back to back. A read always ends with a stop
+ * condition. TWI1 is powered from the first queued transaction until a stop condition empties
+ * the queue.
+ *
+ * A transaction holding the bus longer than TWI_ASYNC_TIMEOUT_MS (a slave holding SCL, or TWI1
+ * hung) fails: TWI1 is disabled, the bus is cleared and the next transaction starts. The timeout
+ * is checked by the next transaction queued, by twi_async_is_busy() and by the blocking waits,
+ * which wake up at least on each app_timer tick.
+ *
+ * The pins are configured and the bus is cleared by twi_master_init() (sd_twi_hw_master.c),
+ * whose blocking transfers must not be used once this driver is initialized.
+ */
+
+#ifndef CUSTOM_TWI_ASYNC_H__
+#define CUSTOM_TWI_ASYNC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "twi_master.h"
+
+#ifndef TWI_ASYNC_QUEUE_SIZE
+#define TWI_ASYNC_QUEUE_SIZE    8                                                       /**< Maximum number of queued transactions. */
+#endif
+
+#ifndef TWI_ASYNC_TIMEOUT_MS
+#define TWI_ASYNC_TIMEOUT_MS    20                                                      /**< Longest time a transaction may hold the bus (in ms), 4 bytes take 0.4 ms at 100 kHz. */
+#endif
+
+#define TWI_ASYNC_PPI_CHANNEL   0                                                       /**< PPI channel stopping or suspending reads on the byte boundary (as sd_twi_hw_master.c). */
+
+/**@brief Transfer of a transaction. */
+typedef struct
+{
+    uint8_t                 address;                                                    /**< Slave address, with TWI_READ_BIT set for a read. */
+    uint8_t *               p_data;                                                     /**< Bytes to write, or buffer for the bytes read. */
+    uint8_t                 length;                                                     /**< Number of bytes, at least 1. */
+    bool                    issue_stop;                                                 /**< TWI_ISSUE_STOP or TWI_DONT_ISSUE_STOP (writes only). */
+} twi_async_xfer_t;
+
+/**@brief Initializer of a transfer. */
+#define TWI_ASYNC_XFER(ADDRESS, P_DATA, LENGTH, ISSUE_STOP) \
+    { (ADDRESS), (uint8_t *)(P_DATA), (LENGTH), (ISSUE_STOP) }
+
+/**@brief Initializer of a write, followed by a repeated start unless it is the last transfer. */
+#define TWI_ASYNC_WRITE(ADDRESS, P_DATA, LENGTH) \
+    TWI_ASYNC_XFER((ADDRESS), (P_DATA), (LENGTH), TWI_DONT_ISSUE_STOP)
+
+/**@brief Initializer of a write ended with a stop condition. */
+#define TWI_ASYNC_WRITE_STOP(ADDRESS, P_DATA, LENGTH) \
+    TWI_ASYNC_XFER((ADDRESS), (P_DATA), (LENGTH), TWI_ISSUE_STOP)
+
+/**@brief Initializer of a read. */
+#define TWI_ASYNC_READ(ADDRESS, P_DATA, LENGTH) \
+    TWI_ASYNC_XFER((ADDRESS) | TWI_READ_BIT, (P_DATA), (LENGTH), TWI_ISSUE_STOP)
+
+/**@brief Transaction completion handler type.
+ *
+ * @param[in] success   The slave acknowledged every byte written, and all bytes were read.
+ * @param[in] p_context Context given with the transaction.
+ */
+typedef void (*twi_async_handler_t)(bool success, void *p_context);
+
+/**@brief Transaction completion, as posted to the scheduler. */
+typedef struct
+{
+    twi_async_handler_t     handler;                                                    /**< Completion handler. */
+    void *                  p_context;                                                  /**< Context given with the transaction. */
+    bool                    success;                                                    /**< Result of the transaction. */
+} twi_async_evt_t;
+
+/**@brief Initialize TWI1 and its interrupt.
+ *
+ * @retval TRUE  The bus is clear.
+ */
+bool twi_async_init(void);
+
+/**@brief Queue a single transfer.
+ *
+ * @param[in] address       Slave address, with TWI_READ_BIT set for a read.
+ * @param[in] p_data        Bytes to write, or buffer for the bytes read. Kept until completion.
+ * @param[in] length        Number of bytes, at least 1.
+ * @param[in] issue_stop    TWI_ISSUE_STOP or TWI_DONT_ISSUE_STOP (writes only).
+ * @param[in] handler       Completion handler, run by the scheduler. NULL if not needed.
+ * @param[in] p_context     Context given to the handler.
+ *
+ * @retval NRF_SUCCESS, NRF_ERROR_INVALID_PARAM if length is 0, NRF_ERROR_NO_MEM if the queue is full.
+ */
+uint32_t twi_async_transfer(uint8_t                 address,
+                            uint8_t *               p_data,
+                            uint8_t                 length,
+                            bool                    issue_stop,
+                            twi_async_handler_t     handler,
+                            void *                  p_context);
+
+/**@brief Queue a transaction.
+ *
+ * @param[in] p_xfers   Transfers, in bus order. Kept, with their data, until completion.
+ * @param[in] count     Number of transfers, at least 1.
+ * @param[in] handler   Completion handler, run by the scheduler. NULL if not needed.
+ * @param[in] p_context Context given to the handler.
+ *
+ * @retval NRF_SUCCESS, NRF_ERROR_INVALID_PARAM if there is no transfer or an empty one,
+ *         NRF_ERROR_NO_MEM if the queue is full.
+ */
+uint32_t twi_async_transaction(const twi_async_xfer_t *    p_xfers,
+                               uint8_t                     count,
+                               twi_async_handler_t         handler,
+                               void *                      p_context);
+
+/**@brief Queue a transaction and sleep until it is done.
+ *
+ * @details For configuration, not for sampling. Must not be called from an interrupt. Needs
+ *          RTC1 running (timers_init()) for the timeout.
+ *
+ * @retval TRUE  The transaction succeeded.
+ */
+bool twi_async_transaction_wait(const twi_async_xfer_t *p_xfers, uint8_t count);
+
+/**@brief Queue a transfer and sleep until it is done (see twi_async_transaction_wait()).
+ *
+ * @retval TRUE  The transfer succeeded.
+ */
+bool twi_async_transfer_wait(uint8_t address, uint8_t *p_data, uint8_t length, bool issue_stop);
+
+/**@brief Check whether transactions are queued or running.
+ *
+ * @details Fails the running transaction if it timed out.
+ *
+ * @retval TRUE  A transaction is not done yet.
+ */
+bool twi_async_is_busy(void);
+
+/**@brief Function for handling the TWI1 interrupt. */
+void SPI1_TWI1_IRQHandler(void);
+
+#endif
+
+/** @} */
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "nrf.h"
@@ -15,7 +16,69 @@ struct __FILE
 };
 FILE __stdout = { UART_WIRE_OUT };      /**< File handle (output) for UART */
 
-static volatile uint8_t uart_tx_busy = 0;  /**< indication to the state of UART TX module */
+#if (UART_TX_BUFFER_SIZE & (UART_TX_BUFFER_SIZE - 1)) || (UART_TX_BUFFER_SIZE > 32768)
+#error "UART_TX_BUFFER_SIZE must be a power of 2, up to 32768."
+#endif
+
+static uint8_t              m_tx_buf[UART_TX_BUFFER_SIZE];  /**< TX ring buffer. */
+static volatile uint16_t    m_tx_head;                      /**< Index of the next character queued (free-running, written by the producer). */
+static volatile uint16_t    m_tx_tail;                      /**< Index of the next character sent (free-running, written by the TXDRDY interrupt). */
+static volatile bool        m_tx_running;                   /**< A character is on the wire, its TXDRDY event sends the next one. */
+static bool                 m_tx_dropping;                  /**< The last character was dropped. */
+static bool                 m_tx_wait;                      /**< Wait for room instead of dropping characters. */
+static uart_tx_stats_t      m_tx_stats;                     /**< TX ring buffer counters. */
+
+/************************************************************
+ * TX Ring Buffer
+ ***********************************************************/
+
+/** @brief Send the next queued character, if any (on TXDRDY, or to start sending). */
+static void uart_tx_next(void)
+{
+    if (m_tx_tail != m_tx_head)
+    {
+        NRF_UART0->TXD = m_tx_buf[m_tx_tail & (UART_TX_BUFFER_SIZE - 1)];
+        m_tx_tail ++;
+    }
+    else
+    {
+        m_tx_running = false;
+    }
+}
+
+/** @brief Queue a character. If the buffer is full, drop it or wait for room (uart_tx_wait_set()).
+ *
+ * @note  m_tx_running is read after m_tx_head is written: either the TXDRDY interrupt still
+ *        runs and sends the character, or it is done and sending starts here.
+ */
+static void uart_put(uint8_t c)
+{
+    uint16_t used = (uint16_t)(m_tx_head - m_tx_tail);
+
+    while (m_tx_wait && used >= UART_TX_BUFFER_SIZE)
+    {
+        used = (uint16_t)(m_tx_head - m_tx_tail);       //< The TXDRDY interrupt makes room
+    }
+
+    if (used >= UART_TX_BUFFER_SIZE)
+    {
+        if (!m_tx_dropping) m_tx_stats.overflows ++;
+        m_tx_dropping = true;
+        m_tx_stats.dropped ++;
+        return;
+    }
+    m_tx_dropping = false;
+
+    m_tx_buf[m_tx_head & (UART_TX_BUFFER_SIZE - 1)] = c;
+    m_tx_head ++;
+    if (used + 1 > m_tx_stats.max_used) m_tx_stats.max_used = used + 1;
+
+    if (!m_tx_running)
+    {
+        m_tx_running = true;
+        uart_tx_next();
+    }
+}
 
 /************************************************************
  * Retarget printf
@@ -29,9 +92,7 @@ int fputc(int c, FILE *f)
         case UART_WIRE_OUT :
         {
             /** @note stdout is UART0 */
-            uart_tx_busy = 1;
-            NRF_UART0->TXD = (uint8_t) c;
-            while (uart_tx_busy);
+            uart_put((uint8_t) c);
             break;
         }
     }
@@ -47,9 +108,7 @@ int ferror(FILE *f)
 /** @brief printf tty handle */
 void _ttywrch(int c)
 {
-    uart_tx_busy = 1;
-    NRF_UART0->TXD = (uint8_t) c;
-    while (uart_tx_busy);
+    uart_put((uint8_t) c);
 }
 
 /** @brief printf handle */
@@ -71,26 +130,54 @@ void uart_putstr(const uint8_t *str)
 
     while (ch != '\0')
     {
-        uart_tx_busy = 1;
-        NRF_UART0->TXD = (uint8_t) ch;
+        uart_put(ch);
         ch = str[i++];
-        while (uart_tx_busy);
     }
 
 }
 
+/** @brief Wait until the TX ring buffer is sent, polling UART0 (before a reset, also from an interrupt) */
+void uart_flush(void)
+{
+    NRF_UART0->INTENCLR = UART_INTENCLR_TXDRDY_Msk;
+
+    while (m_tx_running)
+    {
+        if (NRF_UART0->EVENTS_TXDRDY == 1)
+        {
+            NRF_UART0->EVENTS_TXDRDY = 0;
+            uart_tx_next();
+        }
+    }
+
+    NRF_UART0->INTENSET = UART_INTENSET_TXDRDY_Msk;
+}
+
+/** @brief Wait for room in the TX ring buffer instead of dropping characters (for data dumps) */
+void uart_tx_wait_set(bool wait)
+{
+    m_tx_wait = wait;
+}
+
+/** @brief Get the TX ring buffer counters since boot */
+void uart_tx_stats_get(uart_tx_stats_t *p_stats)
+{
+    *p_stats = m_tx_stats;
+}
+
 /************************************************************
  * IRQ Handlers
  ***********************************************************/
 
 /**@brief UART0 IRQ handler
+ * @details Sends the next character of the TX ring buffer.
  */
 void UART0_IRQHandler(void)
 {
     if (NRF_UART0->EVENTS_TXDRDY == 1)
     {
-        uart_tx_busy = 0;
         NRF_UART0->EVENTS_TXDRDY = 0;
+        uart_tx_next();
     }
 }
 
@@ -6,15 +6,31 @@
  * @brief UART debug library
  *
  * This file contains functions for UART operations. It works mainly for debug purpose.
- * The UART interruption handle implements scheduler.
+ * Characters are queued in a ring buffer and sent by the UART0 TXDRDY interrupt, so printing
+ * only costs the copy. When the buffer is full, characters are dropped and counted.
+ *
+ * The buffer has a single producer: print from the main loop (scheduler) only. An interrupt
+ * handler may print before a reset, after uart_flush().
  */
 
 #ifndef CUSTOM_UART_H__
 #define CUSTOM_UART_H__
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 
-#define UART_DEBUG_ENABLE 1
+/* Log levels */
+#define UART_LOG_NONE   0           /**< No debug output. */
+#define UART_LOG_INFO   1           /**< Init, state changes, settings and errors (DEBUG_ASSERT, DEBUG_PF). */
+#define UART_LOG_DEBUG  2           /**< Per-sample and per-block traces as well (DEBUG_TRACE). */
+
+#ifndef UART_LOG_LEVEL
+#define UART_LOG_LEVEL  UART_LOG_DEBUG
+#endif
+
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 256     /**< Size of the TX ring buffer (a power of 2, up to 32768). */
+#endif
 
 #define RX_PIN_NO       11
 #define TX_PIN_NO       9
@@ -28,26 +44,53 @@ enum
     UART_BLE_OUT
 };
 
+/**@brief TX ring buffer counters. */
+typedef struct
+{
+    uint32_t    dropped;            /**< Characters dropped, the buffer being full. */
+    uint32_t    overflows;          /**< Messages cut short (runs of dropped characters). */
+    uint32_t    max_used;           /**< Highest number of characters waiting in the buffer. */
+} uart_tx_stats_t;
+
 int fputc(int c, FILE *f);  /**< Retarget fputc() */
 int ferror(FILE *f);        /**< Retarget ferror() */
 
 /** @brief Print a string to UART terminal */
 void uart_putstr(const uint8_t *str);
 
+/** @brief Wait until the TX ring buffer is sent, polling UART0 (before a reset, also from an interrupt). */
+void uart_flush(void);
+
+/** @brief Wait for room in the TX ring buffer instead of dropping characters (for data dumps).
+ *
+ * @param[in] wait  TRUE to wait, FALSE to drop (default).
+ */
+void uart_tx_wait_set(bool wait);
+
+/** @brief Get the TX ring buffer counters since boot. */
+void uart_tx_stats_get(uart_tx_stats_t *p_stats);
+
 /**@brief Function for initializing UART operation */
 void uart_init(void);
 
 /** @brief UART debug assert */
-#ifdef UART_DEBUG_ENABLE
+#if UART_LOG_LEVEL >= UART_LOG_INFO
 #define DEBUG_ASSERT(STR) uart_putstr((uint8_t *) STR);
 #else
 #define DEBUG_ASSERT(STR)
 #endif
 
-#ifdef UART_DEBUG_ENABLE
-#define DEBUG_PF(STR,...) printf(STR, __VA_ARGS__);
+#if UART_LOG_LEVEL >= UART_LOG_INFO
+#define DEBUG_PF(...) printf(__VA_ARGS__);
+#else
+#define DEBUG_PF(...)
+#endif
+
+/** @brief UART debug trace, for messages printed on each sample or block */
+#if UART_LOG_LEVEL >= UART_LOG_DEBUG
+#define DEBUG_TRACE(...) printf(__VA_ARGS__);
 #else
-#define DEBUG_PF(STR,...)
+#define DEBUG_TRACE(...)
 #endif
 
 